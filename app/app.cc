@@ -2,6 +2,7 @@
 #include <cstring>
 #include <cerrno>
 #include <climits>
+#include <cmath>
 
 #include <functional>
 #include <algorithm>
@@ -13,6 +14,7 @@
 #include <mutex>
 #include <atomic>
 #include <chrono>
+#include <thread>
 
 #include "binpack.h"
 #include "image.h"
@@ -34,6 +36,7 @@
 #include "process.h"
 #include "cellgrid.h"
 #include "render.h"
+#include "panes.h"
 
 using namespace std::chrono;
 
@@ -45,13 +48,31 @@ bool resource_prefix = true;
 
 /* globals */
 
+/*
+ * each window holds a pane layout with tabs of split panes, and each
+ * pane has its own teletype, cellgrid, renderer and process. the font
+ * manager, glyph atlases and GL textures are shared by all windows,
+ * whose contexts are in one share group.
+ */
+
+struct tty_window
+{
+    GLFWwindow* window;
+    tty_pane_layout layout;
+    tty_pane* captured;
+    std::vector<int> opers;
+    vec2 mouse_pos;
+    int swap_interval;
+    char q;
+    char b;
+};
+
 static font_manager_ft manager;
-static std::unique_ptr<tty_teletype> tty;
-static std::unique_ptr<tty_cellgrid> cg;
-static std::unique_ptr<tty_render> render;
-static std::unique_ptr<tty_process> process;
-static GLFWwindow* window;
-static vec2 mouse_pos;
+static std::unique_ptr<tty_render_context> render_ctx;
+static std::vector<std::unique_ptr<tty_window>> windows;
+static tty_window* current;
+static bool new_window_pending = false;
+static bool history_pending = true;
 
 static bool help_text = false;
 static bool overlay_stats = false;
@@ -59,6 +80,11 @@ static bool execute_args = false;
 static bool enable_linenumbers = false;
 static bool enable_timestamps = false;
 static bool enable_scrollbars = false;
+static const char* history_file = nullptr;
+static const char* pipe_command = nullptr;
+static tty_history_codec history_codec = tty_history_none;
+static int glyph_threads = -1;
+static int window_count = 1;
 
 static const char* app_name = "cutty";
 static const char* default_path = "bash";
@@ -67,6 +93,9 @@ static const char* exec_path = default_path;
 static const char * const * exec_argv = default_argv;
 static std::vector<const char*> exec_vec;
 
+/* wait for input when no window has drawn, so idle windows sleep */
+static const double idle_timeout = 1.0 / 240.0;
+
 
 /* cursors */
 
@@ -93,26 +122,46 @@ static void init_keymap()
 
 void app_set_cursor(app_cursor cursor)
 {
-    glfwSetCursor(window, cursor_objects[cursor]);
+    glfwSetCursor(current->window, cursor_objects[cursor]);
 }
 
 const char* app_get_clipboard()
 {
-    return glfwGetClipboardString(window);
+    return glfwGetClipboardString(current->window);
 }
 
 void app_set_clipboard(const char* str)
 {
-    glfwSetClipboardString(window, str);
+    glfwSetClipboardString(current->window, str);
+}
+
+void app_window_oper(int oper)
+{
+    /* called from event callbacks, so the layout is changed in the loop */
+    if (oper == tty_oper_new_window) {
+        new_window_pending = true;
+    } else if (current) {
+        current->opers.push_back(oper);
+    }
+}
+
+/* events are routed to the window they were delivered to */
+
+static tty_window* lookup(GLFWwindow* window)
+{
+    current = static_cast<tty_window*>(glfwGetWindowUserPointer(window));
+    return current;
 }
 
 /* keyboard callback */
 
 static void keyboard(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
-    if (tty->keyboard(key, scancode, action, mods)) {
-        if (tty->scroll_row() != 0) {
-            tty->set_scroll_row(0);
+    tty_window *w = lookup(window);
+    tty_pane *p = w->layout.focused;
+    if (p && p->tty->keyboard(key, scancode, action, mods)) {
+        if (p->tty->scroll_row() != 0) {
+            p->tty->set_scroll_row(0);
         }
     }
 }
@@ -124,126 +173,159 @@ static void scroll(GLFWwindow* window, double xoffset, double yoffset)
     //
 }
 
-static char q;
-static char b;
+/* buttons and motion go to the pane under the pointer, or the one
+ * that took the press until it is released, in pane coordinates */
 
-static bool mouse_button_ui9(int button, int action, int mods, vec3 pos)
+static tty_pane* mouse_pane(tty_window *w)
+{
+    return w->captured ? w->captured : w->layout.pane_at(w->mouse_pos);
+}
+
+static bool mouse_button_ui9(tty_window *w, tty_pane *p, int button, int action, int mods, vec3 pos)
 {
     switch(button) {
-    case GLFW_MOUSE_BUTTON_LEFT:  b = ui9::left_button;  break;
-    case GLFW_MOUSE_BUTTON_RIGHT: b = ui9::right_button; break;
+    case GLFW_MOUSE_BUTTON_LEFT:  w->b = ui9::left_button;  break;
+    case GLFW_MOUSE_BUTTON_RIGHT: w->b = ui9::right_button; break;
     }
     switch(action) {
-    case GLFW_PRESS:   q = ui9::pressed;  break;
-    case GLFW_RELEASE: q = ui9::released; break;
+    case GLFW_PRESS:   w->q = ui9::pressed;  break;
+    case GLFW_RELEASE: w->q = ui9::released; break;
     }
-    vec3 v = cg->get_canvas()->get_inverse_transform() * pos;
-    ui9::MouseEvent evt{{ui9::mouse, q}, b, v};
-    bool handled = cg->get_root()->dispatch(&evt.header);
-    return (!handled) ? cg->mouse_event(&evt) : false;
+    vec3 v = p->cg->get_canvas()->get_inverse_transform() * pos;
+    ui9::MouseEvent evt{{ui9::mouse, w->q}, w->b, v};
+    bool handled = p->cg->get_root()->dispatch(&evt.header);
+    return (!handled) ? p->cg->mouse_event(&evt) : false;
 }
 
-static bool mouse_motion_ui9(vec3 pos)
+static bool mouse_motion_ui9(tty_window *w, tty_pane *p, vec3 pos)
 {
-    vec3 v = cg->get_canvas()->get_inverse_transform() * pos;
-    ui9::MouseEvent evt{{ui9::mouse, ui9::motion}, b, v};
+    vec3 v = p->cg->get_canvas()->get_inverse_transform() * pos;
+    ui9::MouseEvent evt{{ui9::mouse, ui9::motion}, w->b, v};
     bool handled = false;
-    handled |= cg->get_root()->dispatch(&evt.header);
-    handled |= cg->mouse_event(&evt);
+    handled |= p->cg->get_root()->dispatch(&evt.header);
+    handled |= p->cg->mouse_event(&evt);
     return handled;
 }
 
-static bool scroll_wheel_ui9(vec3 v)
+static bool scroll_wheel_ui9(tty_window *w, tty_pane *p, vec3 v)
 {
-    ui9::MouseEvent evt{{ui9::mouse, ui9::wheel}, b, v};
+    ui9::MouseEvent evt{{ui9::mouse, ui9::wheel}, w->b, v};
     bool handled = false;
-    handled |= cg->get_root()->dispatch(&evt.header);
-    handled |= cg->mouse_event(&evt);
+    handled |= p->cg->get_root()->dispatch(&evt.header);
+    handled |= p->cg->mouse_event(&evt);
     return handled;
 }
 
 static void scroll_wheel(GLFWwindow* window, double xoffset, double yoffset)
 {
-    if (scroll_wheel_ui9(vec3(xoffset, yoffset, 0.f))) {
-        tty->set_needs_update();
+    tty_window *w = lookup(window);
+    tty_pane *p = mouse_pane(w);
+    if (p && scroll_wheel_ui9(w, p, vec3(xoffset, yoffset, 0.f))) {
+        p->tty->set_needs_update();
     }
 }
 
 static void mouse_button(GLFWwindow* window, int button, int action, int mods)
 {
-    if (mouse_button_ui9(button, action, mods, vec3(mouse_pos, 1))) {
-        tty->set_needs_update();
+    tty_window *w = lookup(window);
+    tty_pane *p = mouse_pane(w);
+    if (!p) return;
+    if (action == GLFW_PRESS) {
+        w->captured = p;
+        if (p != w->layout.focused) {
+            w->layout.set_focus(p, glfwGetWindowAttrib(window, GLFW_FOCUSED));
+        }
+    }
+    if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS) {
+        p->tty->set_selection_mode((mods & GLFW_MOD_ALT) ? tty_select_block
+                                                         : tty_select_linear);
+    }
+    if (mouse_button_ui9(w, p, button, action, mods, vec3(p->local(w->mouse_pos), 1))) {
+        p->tty->set_needs_update();
+    }
+    if (action == GLFW_RELEASE) {
+        w->captured = nullptr;
     }
 }
 
 static void cursor_position(GLFWwindow* window, double xpos, double ypos)
 {
-    mouse_pos = vec2(xpos, ypos);
+    tty_window *w = lookup(window);
+    w->mouse_pos = vec2(xpos, ypos);
 
-    if (mouse_motion_ui9(vec3(mouse_pos, 1))) {
-        tty->set_needs_update();
+    tty_pane *p = mouse_pane(w);
+    if (p && mouse_motion_ui9(w, p, vec3(p->local(w->mouse_pos), 1))) {
+        p->tty->set_needs_update();
         return;
     }
 }
 
 static void cursor_enter(GLFWwindow* window, int entered)
 {
+    lookup(window);
     app_set_cursor(entered ? app_cursor_ibeam : app_cursor_arrow);
 }
 
-static void reshape()
+static void reshape(tty_window *w)
 {
     int framebuffer_width, framebuffer_height;
     int window_width, window_height;
 
-    glfwGetWindowSize(window, &window_width, &window_height);
-    glfwGetFramebufferSize(window, &framebuffer_width, &framebuffer_height);
-    glViewport(0, 0, framebuffer_width, framebuffer_height);
+    glfwGetWindowSize(w->window, &window_width, &window_height);
+    glfwGetFramebufferSize(w->window, &framebuffer_width, &framebuffer_height);
 
     float scale = sqrtf((float)(framebuffer_width * framebuffer_height) /
                        (float)(window_width * window_height));
 
-    render->reshape(window_width, window_height);
+    w->layout.reshape(vec2(window_width, window_height), scale);
+}
 
-    tty_style lstyle = cg->get_style();
-    tty_style style = lstyle;
-    style.width = (float)window_width;
-    style.height = (float)window_height;
-    style.rscale = 1.0f/scale;
-    if (style != lstyle) {
-        cg->set_style(style);
+/*
+ * swap intervals are per context and a vsynced swap blocks until the
+ * next refresh, so only the last window to swap in a frame waits for
+ * vertical sync, otherwise n windows would each draw at refresh/n.
+ */
+static void composite(tty_window *w, bool vsync)
+{
+    int framebuffer_width, framebuffer_height;
+    glfwGetFramebufferSize(w->window, &framebuffer_width, &framebuffer_height);
+    uint divider = w->layout.focused ?
+        w->layout.focused->cg->get_style().select_nofocus_color : 0;
+    w->layout.composite(framebuffer_width, framebuffer_height, divider);
+    if (w->swap_interval != (int)vsync) {
+        w->swap_interval = (int)vsync;
+        glfwSwapInterval(w->swap_interval);
     }
+    glfwSwapBuffers(w->window);
+}
 
-    tty_winsize dim = cg->get_winsize();
-    tty_winsize ldim = tty->get_winsize();
-    if (dim != ldim) {
-        tty->set_winsize(dim);
-        process->winsize(dim);
-    }
+static void redraw(tty_window *w)
+{
+    w->layout.update();
+    composite(w, false);
 }
 
 static void framebuffer_size(GLFWwindow* window, int w, int h)
 {
-    tty->set_needs_update();
-    reshape();
-    render->update();
-    render->display();
-    glfwSwapBuffers(window);
+    tty_window *tw = lookup(window);
+    glfwMakeContextCurrent(window);
+    reshape(tw);
+    redraw(tw);
 }
 
 static void window_focus(GLFWwindow* window, int focused)
 {
-    tty->set_needs_update();
-    cg->set_flag(tty_cellgrid_focused, focused);
-    render->update();
-    render->display();
-    glfwSwapBuffers(window);
+    tty_window *w = lookup(window);
+    glfwMakeContextCurrent(window);
+    w->layout.set_focus(w->layout.focused, focused);
+    redraw(w);
 }
 
 static void window_refresh(GLFWwindow* window)
 {
-    render->display();
-    glfwSwapBuffers(window);
+    tty_window *w = lookup(window);
+    glfwMakeContextCurrent(window);
+    composite(w, false);
 }
 
 static void window_pos(GLFWwindow* window, int x, int y)
@@ -256,11 +338,168 @@ static void window_size(GLFWwindow* window, int w, int h)
     //printf("%s: w=%d h=%d\n", __func__, w, h);
 }
 
-static void tty_app(int argc, char **argv)
+static void update_title(tty_window *w)
 {
-    int framebuffer_width, framebuffer_height;
-    int window_width, window_height;
+    char title[64];
+    if (w->layout.tabs.size() > 1) {
+        snprintf(title, sizeof(title), "%s [%zu/%zu]", app_name,
+            w->layout.active_tab + 1, w->layout.tabs.size());
+        glfwSetWindowTitle(w->window, title);
+    } else {
+        glfwSetWindowTitle(w->window, app_name);
+    }
+}
+
+/* panes are created with the window's context current */
+
+static tty_pane* create_pane()
+{
+    tty_pane *p = new tty_pane();
+    p->tty = std::unique_ptr<tty_teletype>(tty_new());
+    p->process = std::unique_ptr<tty_process>(tty_process_new());
+    p->cg = std::unique_ptr<tty_cellgrid>(tty_cellgrid_new(&manager, p->tty.get()));
+    p->cg->set_flag(tty_cellgrid_timestamps, enable_timestamps);
+    p->cg->set_flag(tty_cellgrid_linenumbers, enable_linenumbers);
+    p->cg->set_flag(tty_cellgrid_scrollbars, enable_scrollbars);
+    p->tty->set_winsize(p->cg->get_winsize());
+    return p;
+}
+
+static void create_render(tty_pane *p)
+{
+    p->render = std::unique_ptr<tty_render>(tty_render_new(&manager,
+        p->cg.get(), render_ctx.get()));
+    p->render->set_overlay(overlay_stats);
+    p->render->initialize();
+}
+
+static void exec_pane(tty_pane *p)
+{
+    /* the pane is laid out first, so the shell starts with its size */
+    tty_winsize dim = p->tty->get_winsize();
+
+    /* history is restored into and saved from the first pane */
+    p->history = history_pending && history_file;
+    history_pending = false;
+
+    p->tty->reset();
+    if (p->history && file::fileExists(history_file)) {
+        p->tty->load_history(history_file);
+    }
+    p->tty->set_fd(p->process->exec(dim, exec_path, exec_argv, true /* fixme */));
+}
 
+static void close_pane(tty_window *w, tty_pane *p)
+{
+    if (p->history) {
+        p->tty->save_history(history_file, history_codec);
+    }
+    p->tty->close();
+
+    /* the pane's own GL objects are deleted in its window's context */
+    glfwMakeContextCurrent(w->window);
+    p->render->release();
+    if (w->captured == p) {
+        w->captured = nullptr;
+    }
+}
+
+static tty_window* open_window()
+{
+    std::unique_ptr<tty_window> w(new tty_window());
+    tty_pane *p = create_pane();
+    tty_style style = p->cg->get_style();
+
+    /* share textures and programs with the windows that are already open */
+    GLFWwindow *share = windows.size() > 0 ? windows.front()->window : NULL;
+    w->window = glfwCreateWindow((int)style.width, (int)style.height,
+        app_name, NULL, share);
+    if (!w->window) {
+        Error("error: glfwCreateWindow failed\n");
+        delete p;
+        return nullptr;
+    }
+    glfwSetWindowUserPointer(w->window, w.get());
+    glfwMakeContextCurrent(w->window);
+    if (!share) {
+        gladLoadGL();
+    }
+    w->swap_interval = 1;
+    glfwSwapInterval(w->swap_interval);
+    glfwSetScrollCallback(w->window, scroll);
+    glfwSetKeyCallback(w->window, keyboard);
+    glfwSetMouseButtonCallback(w->window, mouse_button);
+    glfwSetScrollCallback(w->window, scroll_wheel);
+    glfwSetCursorEnterCallback(w->window, cursor_enter);
+    glfwSetCursorPosCallback(w->window, cursor_position);
+    glfwSetFramebufferSizeCallback(w->window, framebuffer_size);
+    glfwSetWindowFocusCallback(w->window, window_focus);
+    glfwSetWindowRefreshCallback(w->window, window_refresh);
+    glfwSetWindowPosCallback(w->window, window_pos);
+    glfwSetWindowSizeCallback(w->window, window_size);
+
+    create_render(p);
+    w->layout.add_tab(p);
+    reshape(w.get());
+    exec_pane(p);
+
+    windows.push_back(std::move(w));
+    return windows.back().get();
+}
+
+static void close_window(tty_window *w)
+{
+    w->layout.all_panes([w](tty_pane *p) { close_pane(w, p); });
+    w->layout.tabs.clear();
+    glfwMakeContextCurrent(NULL);
+    glfwDestroyWindow(w->window);
+
+    if (current == w) {
+        current = nullptr;
+    }
+}
+
+static void window_oper(tty_window *w, int oper)
+{
+    tty_pane *p = nullptr;
+    glfwMakeContextCurrent(w->window);
+    switch (oper) {
+    case tty_oper_new_tab:
+        p = create_pane();
+        create_render(p);
+        w->layout.add_tab(p);
+        break;
+    case tty_oper_split_right:
+    case tty_oper_split_down:
+        if (!w->layout.focused) break;
+        p = create_pane();
+        create_render(p);
+        w->layout.split(p, oper == tty_oper_split_right ? tty_split_columns
+                                                        : tty_split_rows);
+        break;
+    case tty_oper_next_tab:
+        w->layout.next_tab();
+        break;
+    case tty_oper_next_pane:
+        w->layout.next_pane();
+        break;
+    case tty_oper_pipe:
+        if (!w->layout.focused) break;
+        if (!pipe_command) {
+            Error("pipe: no command, use --pipe <command>\n");
+            break;
+        }
+        tty_process_pipe(w->layout.focused->tty.get(), pipe_command);
+        break;
+    }
+    if (p) {
+        exec_pane(p);
+    }
+    update_title(w);
+}
+
+static void tty_app(int argc, char **argv)
+{
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, CTX_OPENGL_MAJOR);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, CTX_OPENGL_MINOR);
@@ -275,60 +514,88 @@ static void tty_app(int argc, char **argv)
         manager.scanFontDir("fonts");
     }
 
-    tty = std::unique_ptr<tty_teletype>(tty_new());
-    process = std::unique_ptr<tty_process>(tty_process_new());
-    cg = std::unique_ptr<tty_cellgrid>(tty_cellgrid_new(&manager, tty.get()));
-    cg->set_flag(tty_cellgrid_timestamps, enable_timestamps);
-    cg->set_flag(tty_cellgrid_linenumbers, enable_linenumbers);
-    cg->set_flag(tty_cellgrid_scrollbars, enable_scrollbars);
-    tty_winsize dim = cg->get_winsize();
-    tty_style style = cg->get_style();
-
-    window = glfwCreateWindow((int)style.width, (int)style.height, app_name, NULL, NULL);
-    glfwMakeContextCurrent(window);
-    gladLoadGL();
-    glfwSwapInterval(1);
-    glfwSetScrollCallback(window, scroll);
-    glfwSetKeyCallback(window, keyboard);
-    glfwSetMouseButtonCallback(window, mouse_button);
-    glfwSetScrollCallback(window, scroll_wheel);
-    glfwSetCursorEnterCallback(window, cursor_enter);
-    glfwSetCursorPosCallback(window, cursor_position);
-    glfwSetFramebufferSizeCallback(window, framebuffer_size);
-    glfwSetWindowFocusCallback(window, window_focus);
-    glfwSetWindowRefreshCallback(window, window_refresh);
-    glfwSetWindowPosCallback(window, window_pos);
-    glfwSetWindowSizeCallback(window, window_size);
-    glfwGetWindowSize(window, &window_width, &window_height);
-    glfwGetFramebufferSize(window, &framebuffer_width, &framebuffer_height);
+    /* rasterize glyph misses on worker threads, -1 uses all cores */
+    if (glyph_threads < 0) {
+        glyph_threads = (int)std::thread::hardware_concurrency();
+    }
+    manager.set_async(glyph_threads);
 
     init_keymap();
     init_cursors();
 
-    render = std::unique_ptr<tty_render>(tty_render_new(&manager, cg.get()));
-    render->set_overlay(overlay_stats);
-    render->initialize();
-    reshape();
-
-    tty->set_winsize(dim);
-    tty->reset();
-    tty->set_fd(process->exec(dim, exec_path, exec_argv, true /* fixme */));
-
-    while (!glfwWindowShouldClose(window)) {
-        render->update();
-        render->display();
-        glfwSwapBuffers(window);
-        glfwPollEvents();
-        do if (tty->io() < 0) {
-            glfwSetWindowShouldClose(window, 1);
+    render_ctx = std::unique_ptr<tty_render_context>(tty_render_context_new());
+    for (int i = 0; i < window_count; i++) {
+        if (!open_window()) break;
+    }
+
+    while (windows.size() > 0) {
+        /* panes with damage render to their targets and the window
+         * composites them, windows only swap when a pane has drawn */
+        std::vector<tty_window*> drawn;
+        /* panes share glyph stamps so advance the frame and repack once */
+        manager.next_frame();
+        for (auto &w : windows) {
+            glfwMakeContextCurrent(w->window);
+            if (w->layout.update()) {
+                drawn.push_back(w.get());
+            }
+        }
+        for (size_t i = 0; i < drawn.size(); i++) {
+            glfwMakeContextCurrent(drawn[i]->window);
+            composite(drawn[i], i + 1 == drawn.size());
+        }
+        if (drawn.size() > 0) {
+            glfwPollEvents();
+        } else {
+            glfwWaitEventsTimeout(idle_timeout);
+        }
+        if (new_window_pending) {
+            new_window_pending = false;
+            open_window();
+        }
+        for (auto &w : windows) {
+            std::vector<int> opers = std::move(w->opers);
+            w->opers.clear();
+            for (int oper : opers) {
+                window_oper(w.get(), oper);
+            }
+        }
+        for (auto &w : windows) {
+            w->layout.all_panes([](tty_pane *p) {
+                do if (p->tty->io() < 0) {
+                    p->closed = true;
+                }
+                while (p->tty->proc() > 0);
+            });
+
+            /* panes whose process exited are removed from the layout */
+            std::vector<tty_pane*> closed;
+            w->layout.all_panes([&closed](tty_pane *p) {
+                if (p->closed) closed.push_back(p);
+            });
+            for (tty_pane *p : closed) {
+                close_pane(w.get(), p);
+                w->layout.remove(p);
+            }
+            if (closed.size() > 0) {
+                update_title(w.get());
+            }
+            if (w->layout.tabs.size() == 0) {
+                glfwSetWindowShouldClose(w->window, 1);
+            }
+        }
+        for (auto i = windows.begin(); i != windows.end(); ) {
+            if (glfwWindowShouldClose((*i)->window)) {
+                close_window(i->get());
+                i = windows.erase(i);
+            } else {
+                i++;
+            }
         }
-        while (tty->proc() > 0);
     }
 
-    glfwDestroyWindow(window);
+    render_ctx.reset();
     glfwTerminate();
-
-    tty->close();
 }
 
 /* help text */
@@ -345,7 +612,14 @@ void print_help(int argc, char **argv)
         "  -L, --line-numbers        enable line numbers column\n"
         "  -T, --time-stamps         enable time stamps column\n"
         "  -y, --overlay-stats       show statistics overlay\n"
-        "  -m, --enable-msdf         enable MSDF font rendering\n",
+        "  -m, --enable-msdf         enable MSDF font rendering\n"
+        "  -M, --msdf-min-size <px>  smallest font size rendered with MSDF\n"
+        "  -l, --enable-lcd          enable LCD subpixel font rendering\n"
+        "  -H, --history <file>      restore and save history file\n"
+        "  -z, --history-codec <c>   compress history (none|zlib|brotli)\n"
+        "  -p, --pipe <command>      shell command the selection is piped to\n"
+        "  -j, --glyph-threads <n>   glyph rasterizer threads (0 = sync)\n"
+        "  -w, --windows <n>         number of windows to open\n",
         argv[0]);
 }
 
@@ -396,6 +670,37 @@ void parse_options(int argc, char **argv)
             manager.msdf_enabled = true;
             manager.msdf_autoload = true;
             i++;
+        } else if (match_opt(argv[i], "-l", "--enable-lcd")) {
+            manager.lcd_enabled = true;
+            i++;
+        } else if (match_opt(argv[i], "-M", "--msdf-min-size")) {
+            if (check_param(++i == argc, "--msdf-min-size")) break;
+            manager.msdf_min_size = atoi(argv[i++]) << 6;
+        } else if (match_opt(argv[i], "-j", "--glyph-threads")) {
+            if (check_param(++i == argc, "--glyph-threads")) break;
+            glyph_threads = atoi(argv[i++]);
+        } else if (match_opt(argv[i], "-w", "--windows")) {
+            if (check_param(++i == argc, "--windows")) break;
+            window_count = std::max(1, atoi(argv[i++]));
+        } else if (match_opt(argv[i], "-H", "--history")) {
+            if (check_param(++i == argc, "--history")) break;
+            history_file = argv[i++];
+        } else if (match_opt(argv[i], "-p", "--pipe")) {
+            if (check_param(++i == argc, "--pipe")) break;
+            pipe_command = argv[i++];
+        } else if (match_opt(argv[i], "-z", "--history-codec")) {
+            if (check_param(++i == argc, "--history-codec")) break;
+            if (strcmp(argv[i], "none") == 0) {
+                history_codec = tty_history_none;
+            } else if (strcmp(argv[i], "zlib") == 0) {
+                history_codec = tty_history_zlib;
+            } else if (strcmp(argv[i], "brotli") == 0) {
+                history_codec = tty_history_brotli;
+            } else {
+                fprintf(stderr, "error: unknown codec: %s\n", argv[i]);
+                help_text = true;
+            }
+            i++;
         } else {
             if (!execute_args) {
                 fprintf(stderr, "error: unknown option: %s\n", argv[i]);
@@ -6,14 +6,16 @@
  *
  *   compile_shader, make_program, link_program, use_program,
  *   vertex_array_1f, vertex_array_4f, uniform_1i, uniform_matrix_4fv,
- *   buffer_texture_create, image_create_texture, image_update_texture,
- *   vertex_buffer_create, vertex_array_pointer, declare_main
+ *   stream_buffer_write, stream_buffer_fence, buffer_texture_create,
+ *   image_create_texture, image_update_texture, vertex_array_pointer,
+ *   declare_main
  */
 #pragma once
 
 #include <cstring>
 
 #include <algorithm>
+#include <numeric>
 #include <memory>
 #include <string>
 #include <vector>
@@ -52,15 +54,36 @@ typedef struct {
     std::map<std::string,GLuint> uniforms;
 } program;
 
+static const size_t stream_buffer_count = 3;
+
+typedef struct {
+    GLuint obj;
+    size_t size;
+    size_t region;
+    size_t offset;
+    size_t length;
+    uint8_t *map;
+    GLsync fence[stream_buffer_count];
+} stream_buffer;
+
 typedef struct {
-    GLuint tbo;
+    stream_buffer buf;
     GLuint tex;
 } texture_buffer;
 
+static const size_t pixel_buffer_count = 3;
+
+typedef struct {
+    GLuint pbo[pixel_buffer_count];
+    size_t size[pixel_buffer_count];
+    size_t next;
+} pixel_buffer_ring;
+
 enum app_cursor { app_cursor_arrow, app_cursor_ibeam };
 void app_set_cursor(app_cursor cursor);
 const char* app_get_clipboard();
 void app_set_clipboard(const char* str);
+void app_window_oper(int oper);
 
 static std::vector<char> load_file(const char *filename)
 {
@@ -223,19 +246,6 @@ static void use_program(program *prog)
     }
 }
 
-template <typename T>
-static void vertex_buffer_create(const char* name, GLuint *obj,
-    GLenum target, std::vector<T> &v)
-{
-    if (!*obj) {
-        glGenBuffers(1, obj);
-        Debug("buffer %s = %u (%zu bytes)\n", name, *obj, v.size() * sizeof(T));
-    }
-    glBindBuffer(target, *obj);
-    glBufferData(target, v.size() * sizeof(T), v.data(), GL_STATIC_DRAW);
-    glBindBuffer(target, *obj);
-}
-
 template<typename X, typename T>
 static void vertex_array_pointer(program *prog, const char *attr, GLint size,
     GLenum type, GLboolean norm, X T::*member)
@@ -279,20 +289,101 @@ static void uniform_matrix_4fv(program *prog, const char *uniform, const GLfloat
     }
 }
 
+static bool stream_buffer_persistent()
+{
+    /* persistent mapped storage and texture buffer ranges need GL 4.4 */
+#if defined(USE_OSMESA)
+    return false;
+#else
+    return GLAD_GL_VERSION_4_4;
+#endif
+}
+
 template <typename T>
-static void buffer_texture_create(texture_buffer &buf, std::vector<T> vec,
-    GLenum texture, GLenum format)
+static bool stream_buffer_write(const char *name, stream_buffer &buf,
+    GLenum target, const std::vector<T> &v)
 {
-    GLvoid *data = vec.data();
-    size_t length = vec.size() * sizeof(T);
+    /*
+     * write vector into the next region of a streaming buffer.
+     *
+     * with GL 4.4 the buffer holds three regions in persistent mapped
+     * storage, and we copy straight into the region the GPU finished
+     * with, waiting on its fence. otherwise the buffer is orphaned and
+     * updated with glBufferSubData. returns true if the buffer object
+     * was created, so vertex array state needs to be set up again.
+     */
+    size_t length = v.size() * sizeof(T);
+    bool persistent = stream_buffer_persistent();
     bool created = false;
 
-    if (!buf.tbo) {
-        glGenBuffers(1, &buf.tbo);
+    if (!buf.obj || length > buf.size) {
+        /* regions stay aligned to elements and texture buffer offsets */
+        size_t align = sizeof(T) * 256 / std::gcd(sizeof(T), (size_t)256);
+        size_t size = std::max(length + length / 2, (size_t)65536);
+        size = (size + align - 1) / align * align;
+        if (buf.obj) {
+            for (auto &fence : buf.fence) {
+                if (fence) glDeleteSync(fence);
+                fence = 0;
+            }
+            glDeleteBuffers(1, &buf.obj);
+        }
+        glGenBuffers(1, &buf.obj);
+        glBindBuffer(target, buf.obj);
+        if (persistent) {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT |
+                GL_MAP_COHERENT_BIT;
+            glBufferStorage(target, size * stream_buffer_count, NULL, flags);
+            buf.map = (uint8_t*)glMapBufferRange(target, 0,
+                size * stream_buffer_count, flags);
+        } else {
+            glBufferData(target, size, NULL, GL_STREAM_DRAW);
+            buf.map = nullptr;
+        }
+        buf.size = size;
+        buf.region = 0;
         created = true;
+        Debug("buffer %s = %u (%zu bytes%s)\n", name, buf.obj, size,
+            persistent ? " x 3 persistent" : "");
     }
-    glBindBuffer(GL_TEXTURE_BUFFER, buf.tbo);
-    glBufferData(GL_TEXTURE_BUFFER, length, data, GL_STATIC_DRAW);
+
+    if (buf.map) {
+        buf.region = (buf.region + 1) % stream_buffer_count;
+        GLsync &fence = buf.fence[buf.region];
+        if (fence) {
+            glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+            glDeleteSync(fence);
+            fence = 0;
+        }
+        buf.offset = buf.region * buf.size;
+        if (length > 0) {
+            memcpy(buf.map + buf.offset, v.data(), length);
+        }
+    } else {
+        glBindBuffer(target, buf.obj);
+        glBufferData(target, buf.size, NULL, GL_STREAM_DRAW);
+        glBufferSubData(target, 0, length, v.data());
+        buf.offset = 0;
+    }
+    buf.length = length;
+
+    return created;
+}
+
+static void stream_buffer_fence(stream_buffer &buf)
+{
+    /* mark the region in use by the commands issued for this frame */
+    if (!buf.map) return;
+    GLsync &fence = buf.fence[buf.region];
+    if (fence) glDeleteSync(fence);
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+template <typename T>
+static void buffer_texture_create(texture_buffer &buf, const std::vector<T> &vec,
+    GLenum texture, GLenum format)
+{
+    bool created = stream_buffer_write("tbo", buf.buf, GL_TEXTURE_BUFFER, vec);
 
     if (!buf.tex) {
         glGenTextures(1, &buf.tex);
@@ -300,12 +391,20 @@ static void buffer_texture_create(texture_buffer &buf, std::vector<T> vec,
     }
     glActiveTexture(texture);
     glBindTexture(GL_TEXTURE_BUFFER, buf.tex);
-    glTexBuffer(GL_TEXTURE_BUFFER, format, buf.tbo);
+    if (buf.buf.map) {
+        /* point the texture at the region we just wrote */
+        if (buf.buf.length > 0) {
+            glTexBufferRange(GL_TEXTURE_BUFFER, format, buf.buf.obj,
+                buf.buf.offset, buf.buf.length);
+        }
+    } else if (created) {
+        glTexBuffer(GL_TEXTURE_BUFFER, format, buf.buf.obj);
+    }
     glBindBuffer(GL_TEXTURE_BUFFER, 0);
 
     if (created) {
         Debug("buffer texture unit = %zu tbo = %u, tex = %u, size = %zu\n",
-            (size_t)(texture - GL_TEXTURE0), buf.tbo, buf.tex, length);
+            (size_t)(texture - GL_TEXTURE0), buf.buf.obj, buf.tex, buf.buf.size);
     }
 }
 
@@ -337,6 +436,10 @@ static GLuint image_create_texture(draw_image img)
             0, GL_RED, GL_UNSIGNED_BYTE, (GLvoid*)img.pixels);
         glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzleMask);
         break;
+    case 3:
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height,
+            0, GL_RGB, GL_UNSIGNED_BYTE, (GLvoid*)img.pixels);
+        break;
     case 4:
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height,
             0, GL_RGBA, GL_UNSIGNED_BYTE, (GLvoid*)img.pixels);
@@ -349,28 +452,64 @@ static GLuint image_create_texture(draw_image img)
     return tex;
 }
 
-static void image_update_texture(GLuint tex, draw_image img)
+static void image_update_texture(pixel_buffer_ring &ring, GLuint tex,
+    draw_image img, const std::vector<draw_image_rect> &rects)
 {
     GLsizei width = (GLsizei)img.size[0];
-    GLsizei height = (GLsizei)img.size[1];
     GLsizei depth = (GLsizei)img.size[2];
+    GLenum format = depth == 4 ? GL_RGBA : depth == 3 ? GL_RGB : GL_RED;
 
-    /* skip texture update if modified width and height is less than zero
-     * note: we currently ignore the dimensions of the modified rectangle */
-    if (img.modrect[2] <= 0 || img.modrect[3] <= 0) return;
+    /* skip texture update if the image has no modified rectangles */
+    size_t length = 0;
+    for (auto &r : rects) {
+        if (r.iid != img.iid) continue;
+        length += (size_t)r.rect[2] * r.rect[3] * depth;
+    }
+    if (length == 0) return;
 
-    glBindTexture(GL_TEXTURE_2D, tex);
+    /*
+     * copy the modified rectangles into the next pixel unpack buffer in
+     * the ring and upload from there, so the copy into the texture is
+     * asynchronous. the buffer is orphaned so we never wait for the GPU
+     * to finish with the previous contents.
+     */
+    size_t n = ring.next;
+    ring.next = (ring.next + 1) % pixel_buffer_count;
+    if (!ring.pbo[n]) {
+        glGenBuffers(1, &ring.pbo[n]);
+    }
+    ring.size[n] = std::max(ring.size[n], length);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring.pbo[n]);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, ring.size[n], NULL, GL_STREAM_DRAW);
+    uint8_t *buf = (uint8_t*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, length,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (!buf) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        return;
+    }
+    size_t offset = 0;
+    for (auto &r : rects) {
+        if (r.iid != img.iid) continue;
+        size_t row = (size_t)r.rect[2] * depth;
+        for (int y = 0; y < r.rect[3]; y++) {
+            memcpy(buf + offset, img.pixels +
+                ((size_t)(r.rect[1] + y) * width + r.rect[0]) * depth, row);
+            offset += row;
+        }
+    }
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
 
-    switch (depth) {
-    case 1:
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, width, height,
-            0, GL_RED, GL_UNSIGNED_BYTE, (GLvoid*)img.pixels);
-        break;
-    case 4:
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height,
-            0, GL_RGBA, GL_UNSIGNED_BYTE, (GLvoid*)img.pixels);
-        break;
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    offset = 0;
+    for (auto &r : rects) {
+        if (r.iid != img.iid) continue;
+        glTexSubImage2D(GL_TEXTURE_2D, 0, r.rect[0], r.rect[1],
+            r.rect[2], r.rect[3], format, GL_UNSIGNED_BYTE, (GLvoid*)offset);
+        offset += (size_t)r.rect[2] * r.rect[3] * depth;
     }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 }
 
 static GLenum cmd_mode_gl(int cmd_mode)
@@ -2,6 +2,7 @@
 #include <cstring>
 #include <cerrno>
 #include <climits>
+#include <cmath>
 
 #include <functional>
 #include <algorithm>
@@ -67,6 +68,7 @@ static uint8_t *buffer;
 void app_set_cursor(app_cursor cursor) {}
 const char* app_get_clipboard() { return ""; }
 void app_set_clipboard(const char* str) {}
+void app_window_oper(int oper) {}
 
 static void osmesa_init(int width, int height)
 {
@@ -127,6 +129,7 @@ static void capture_app(int argc, char **argv)
     uint running = 1;
     while (running) {
         if (enable_render) {
+            manager.next_frame();
             render->update();
             render->display();
             glFlush();
@@ -2,6 +2,7 @@
 #include <cstring>
 #include <cerrno>
 #include <climits>
+#include <cmath>
 #include <cctype>
 
 #include <functional>
@@ -76,6 +77,70 @@ static const tty_cellgrid_ref null_cellgrid_ref = { 1.f/0.f, 1.f/0.f };
 inline bool operator== (const tty_cellgrid_ref &a, const tty_cellgrid_ref &b)
 { return std::tie(a.row, a.col) == std::tie(b.row, b.col); }
 
+/*
+ * resolved glyph for a cell, keyed by codepoint, bold flag and font size.
+ * holds the face, glyph index and atlas entry so that drawing a cell only
+ * needs one probe. the cache is cleared when the font size or scale change.
+ */
+struct tty_cellgrid_glyph
+{
+    font_face *face;
+    uint glyph;
+    bool valid;
+    glyph_entry ent;
+};
+
+inline glyph_key tty_cellgrid_glyph_key(uint codepoint, uint flags,
+    int font_size, int phase)
+{
+    int64_t bold = (flags & tty_cell_bold) ? 1 : 0;
+    return glyph_key((codepoint >> 20) | (bold << 1), font_size,
+        codepoint & 0xfffff, phase);
+}
+
+/*
+ * shaped run of cells with the same style, keyed by a hash of the run
+ * text, face and font size. glyph clusters are mapped back to columns
+ * within the run, and x offsets include the pen advance of preceding
+ * glyphs in the same cluster, so cached runs draw without HarfBuzz.
+ */
+struct tty_cellgrid_run
+{
+    font_face *face;
+    int font_size;
+    std::vector<uint> text;
+    std::vector<glyph_shape> shapes;
+};
+
+inline glyph_key tty_cellgrid_run_key(font_face *face, int font_size,
+    const uint *text, size_t len)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+    auto mix = [&h](uint64_t v) { h = (h ^ v) * 0x100000001b3ull; };
+    mix(face->font_id);
+    mix(font_size);
+    for (size_t i = 0; i < len; i++) mix(text[i]);
+    glyph_key key;
+    key.opaque = h == glyph_hash_map<size_t>::empty_key ? h - 1 : h;
+    return key;
+}
+
+/* shaped glyphs are keyed by glyph index, apart from codepoint keys */
+inline glyph_key tty_cellgrid_shaped_key(font_face *face, uint glyph,
+    int font_size, int phase)
+{
+    return glyph_key(4 | ((int64_t)face->font_id << 3), font_size, glyph, phase);
+}
+
+/* codepoint ranges rasterized in the background before the first frame */
+static const uint tty_cellgrid_prewarm_ranges[][2] = {
+    { 0x0020, 0x007e }, /* ASCII */
+    { 0x00a0, 0x00ff }, /* Latin-1 */
+    { 0x2500, 0x257f }, /* box drawing */
+    { 0x2580, 0x259f }, /* block elements */
+    { 0xe0a0, 0xe0d4 }, /* powerline */
+};
+
 struct tty_cellgrid_impl : tty_cellgrid
 {
     tty_teletype *tty;
@@ -96,6 +161,13 @@ struct tty_cellgrid_impl : tty_cellgrid
     ui9::Scroller *hscroll;
     bool in_select;
     tty_cellgrid_span vsel;
+    glyph_hash_map<tty_cellgrid_glyph> glyph_cache;
+    int glyph_cache_size;
+    float glyph_cache_rscale;
+    uint32_t glyph_cache_epoch;
+    text_shaper_hb shaper;
+    glyph_hash_map<size_t> run_index;
+    std::vector<tty_cellgrid_run> run_cache;
 
     static constexpr float column_padding = 5.0f;
     static const uint linenumber_fgcolor = 0xff484848;
@@ -106,6 +178,7 @@ struct tty_cellgrid_impl : tty_cellgrid
     static const uint timestamp_bgcolor = 0xffe8e8e8;
     static const tty_cellgrid_face timestamp_face = tty_cellgrid_face_condensed_regular;
     static const tty_timestamp_fmt timestamp_format = tty_timestamp_fmt_iso_datetime_us;
+    static const size_t run_cache_limit = 4096;
 
     tty_cellgrid_impl(font_manager_ft *manager, tty_teletype *tty, bool test_mode);
 
@@ -137,8 +210,14 @@ struct tty_cellgrid_impl : tty_cellgrid
     void scroll_event(ui9::axis_2D axis, float val);
 
     font_face* cell_font(tty_cell &cell);
+    void check_glyph_cache(int font_size);
+    tty_cellgrid_glyph* cell_glyph(tty_cell &cell, int font_size, int phase);
+    tty_cellgrid_glyph* shaped_glyph(font_face *face, uint glyph, int font_size, int phase);
+    tty_cellgrid_run* shape_run(font_face *face, int font_size, const uint *text, size_t len);
+    void prewarm();
     tty_cell_ref vcell_to_lcell(tty_cellgrid_ref cell);
-    tty_cell cell_col(tty_cell &cell);
+    tty_cell_ref vcell_to_vref(tty_cellgrid_ref cell);
+    tty_cell_style cell_col(tty_cell &cell);
     void draw_loop(int rows, int cols,
         std::function<void(tty_line&,size_t,size_t,size_t,size_t)> linepre_cb,
         std::function<void(tty_cell&,size_t,size_t,size_t,size_t)> cell_cb,
@@ -197,9 +276,14 @@ tty_cellgrid_impl::tty_cellgrid_impl(font_manager_ft *manager, tty_teletype *tty
     fm = tty_typeface_get_metrics(mono1_regular, style.font_size, 'M');
     fmc = tty_typeface_get_metrics(mono1_condensed_regular, style.font_size, 'M');
     tty_typeface_print_metrics(mono1_regular, fm);
+    prewarm();
 
     in_select = false;
     vsel = { null_cellgrid_ref, null_cellgrid_ref };
+
+    glyph_cache_size = 0;
+    glyph_cache_rscale = 0.f;
+    glyph_cache_epoch = 0;
 }
 
 tty_cellgrid* tty_cellgrid_new(font_manager_ft *manager, tty_teletype *tty, bool test_mode)
@@ -271,7 +355,14 @@ tty_winsize tty_cellgrid_impl::get_winsize()
 
 const char* tty_cellgrid_impl::get_lang() { return text_lang; }
 tty_style tty_cellgrid_impl::get_style() { return style; }
-void tty_cellgrid_impl::set_style(tty_style s) { style = s; }
+
+void tty_cellgrid_impl::set_style(tty_style s)
+{
+    bool resized = s.font_size != style.font_size || s.rscale != style.rscale;
+    style = s;
+    if (resized) prewarm();
+}
+
 tty_font_metric tty_cellgrid_impl::get_font_metric() { return fm; }
 font_manager_ft* tty_cellgrid_impl::get_manager() { return manager; }
 tty_teletype* tty_cellgrid_impl::get_teletype() { return tty; }
@@ -285,7 +376,7 @@ font_face* tty_cellgrid_impl::cell_font(tty_cell &cell)
     if (cell.codepoint >= 0x1f000 && cell.codepoint <= 0x1ffff) {
         face = mono1_emoji;
     }
-    else if (cell.flags & tty_cell_bold) {
+    else if (tty_cell_style_get(cell.style).flags & tty_cell_bold) {
         face = mono1_bold;
     }
     else {
@@ -295,6 +386,152 @@ font_face* tty_cellgrid_impl::cell_font(tty_cell &cell)
     return face;
 }
 
+void tty_cellgrid_impl::check_glyph_cache(int font_size)
+{
+    /* atlas eviction or repacking bumps the epoch making entries stale */
+    if (glyph_cache_size != font_size || glyph_cache_rscale != style.rscale ||
+        glyph_cache_epoch != manager->glyph_epoch) {
+        glyph_cache.clear();
+        glyph_cache_size = font_size;
+        glyph_cache_rscale = style.rscale;
+        glyph_cache_epoch = manager->glyph_epoch;
+    }
+}
+
+tty_cellgrid_glyph* tty_cellgrid_impl::cell_glyph(tty_cell &cell, int font_size,
+    int phase)
+{
+    check_glyph_cache(font_size);
+
+    uint flags = tty_cell_style_get(cell.style).flags;
+    glyph_key key = tty_cellgrid_glyph_key(cell.codepoint, flags, font_size,
+        phase);
+    auto gi = glyph_cache.find(key);
+    if (gi != glyph_cache.end()) {
+        return &gi->second;
+    }
+
+    tty_cellgrid_glyph g = {};
+    g.face = cell_font(cell);
+    g.glyph = tty_typeface_lookup_glyph(g.face, cell.codepoint);
+    glyph_entry *ge = manager->lookup(g.face, font_size/style.rscale, g.glyph,
+        phase);
+    if (ge) {
+        g.valid = true;
+        g.ent = *ge;
+    } else if (manager->async_pending()) {
+        /* glyph is being rasterized, draw it blank without caching */
+        static tty_cellgrid_glyph pending = {};
+        return &pending;
+    }
+
+    return &glyph_cache.insert({key, g}).first->second;
+}
+
+tty_cellgrid_glyph* tty_cellgrid_impl::shaped_glyph(font_face *face, uint glyph,
+    int font_size, int phase)
+{
+    check_glyph_cache(font_size);
+
+    glyph_key key = tty_cellgrid_shaped_key(face, glyph, font_size, phase);
+    auto gi = glyph_cache.find(key);
+    if (gi != glyph_cache.end()) {
+        return &gi->second;
+    }
+
+    tty_cellgrid_glyph g = {};
+    g.face = face;
+    g.glyph = glyph;
+    glyph_entry *ge = manager->lookup(face, font_size/style.rscale, glyph, phase);
+    if (ge) {
+        g.valid = true;
+        g.ent = *ge;
+    } else if (manager->async_pending()) {
+        static tty_cellgrid_glyph pending = {};
+        return &pending;
+    }
+
+    return &glyph_cache.insert({key, g}).first->second;
+}
+
+tty_cellgrid_run* tty_cellgrid_impl::shape_run(font_face *face, int font_size,
+    const uint *text, size_t len)
+{
+    /* unchanged runs hit the cache, so only new text is reshaped */
+    glyph_key key = tty_cellgrid_run_key(face, font_size, text, len);
+    auto ri = run_index.find(key);
+    if (ri != run_index.end()) {
+        tty_cellgrid_run *r = &run_cache[ri->second];
+        /* the hash can collide, so compare everything in the key */
+        if (r->face == face && r->font_size == font_size &&
+            r->text.size() == len && std::equal(text, text + len, r->text.begin())) {
+            return r;
+        }
+        run_index.erase(key);
+    }
+    if (run_cache.size() >= run_cache_limit) {
+        run_index.clear();
+        run_cache.clear();
+    }
+
+    /* clusters are byte offsets, so remember where each cell starts */
+    std::string str;
+    std::vector<uint> offsets(len);
+    for (size_t i = 0; i < len; i++) {
+        char buf[8];
+        offsets[i] = (uint)str.size();
+        int n = utf32_to_utf8(buf, sizeof(buf), text[i]);
+        str.append(buf, std::max(n, 0));
+    }
+
+    tty_cellgrid_run r;
+    r.face = face;
+    r.font_size = font_size;
+    r.text.assign(text, text + len);
+    text_segment segment(str, text_lang, face, font_size, 0, 0, 0);
+    shaper.shape(r.shapes, segment);
+
+    size_t last_col = SIZE_MAX;
+    int pen = 0;
+    for (auto &g : r.shapes) {
+        size_t col = std::upper_bound(offsets.begin(), offsets.end(),
+            g.cluster) - offsets.begin() - 1;
+        if (col != last_col) {
+            pen = 0;
+            last_col = col;
+        }
+        g.cluster = (unsigned)col;
+        g.x_offset += pen;
+        pen += g.x_advance;
+    }
+
+    run_index.insert({key, run_cache.size()});
+    run_cache.push_back(std::move(r));
+    return &run_cache.back();
+}
+
+void tty_cellgrid_impl::prewarm()
+{
+    int font_size = (int)(fm.size * 64.0f);
+    font_face *faces[] = {
+        mono1_regular, mono1_bold,
+        mono1_condensed_regular, mono1_condensed_bold
+    };
+    /*
+     * glyphs land on every subpixel phase as the grid origin moves with
+     * the line number and timestamp fields, and shaped glyphs carry their
+     * own offsets. the manager folds phases for faces drawn unpositioned.
+     */
+    for (auto face : faces) {
+        for (int phase = 0; phase < glyph_subpixel_phases; phase++) {
+            for (auto &r : tty_cellgrid_prewarm_ranges) {
+                manager->prewarm(face, font_size/style.rscale, r[0], r[1],
+                    phase);
+            }
+        }
+    }
+}
+
 tty_cell_ref tty_cellgrid_impl::vcell_to_lcell(tty_cellgrid_ref vcell)
 {
     llong row = floorf(vcell.row), vcol = floorf(vcell.col);
@@ -305,21 +542,31 @@ tty_cell_ref tty_cellgrid_impl::vcell_to_lcell(tty_cellgrid_ref vcell)
     return { loff.lline, std::min(loff.loff + vcol, (llong)line.cells.size()) };
 }
 
-tty_cell tty_cellgrid_impl::cell_col(tty_cell &cell)
+tty_cell_ref tty_cellgrid_impl::vcell_to_vref(tty_cellgrid_ref vcell)
+{
+    /* visible row and column, not clamped to the length of the line */
+    llong row = floorf(vcell.row), vcol = floorf(vcell.col);
+    llong visible_rows = tty->visible_rows(), total_rows = tty->total_rows();
+    llong offset = total_rows < visible_rows ? visible_rows - total_rows : 0;
+    return { row + offset, std::max(0ll, vcol) };
+}
+
+tty_cell_style tty_cellgrid_impl::cell_col(tty_cell &cell)
 {
-    uint fg = cell.fg;
-    uint bg = cell.bg;
+    tty_cell_style s = tty_cell_style_get(cell.style);
+    uint fg = s.fg;
+    uint bg = s.bg;
 
-    if ((cell.flags & tty_cell_faint) > 0) {
-        color col = color(cell.fg);
+    if ((s.flags & tty_cell_faint) > 0) {
+        color col = color(s.fg);
         col = col.blend(color(0.5f,0.5f,0.5f,1.f), 0.5f);
         fg = col.rgba32();
     }
 
-    if ((cell.flags & tty_cell_inverse) > 0) {
-        return tty_cell{ 0, 0, bg, fg };
+    if ((s.flags & tty_cell_inverse) > 0) {
+        return tty_cell_style{ 0, bg, fg };
     } else {
-        return tty_cell{ 0, 0, fg, bg };
+        return tty_cell_style{ 0, fg, bg };
     }
 }
 
@@ -373,6 +620,7 @@ void tty_cellgrid_impl::draw_background(draw_list &batch)
     canvas.set_stroke_brush(MVGBrush{MVGBrushSolid, { }, { black }});
     canvas.set_stroke_width(w);
     canvas.new_rounded_rectangle(vec2(tx, ty), vec2(tx - m, ty - m), m);
+    draw_list_layer(batch, layer_underlay);
     canvas.emit(batch);
 }
 
@@ -410,7 +658,9 @@ void tty_cellgrid_impl::draw_timestamps(draw_list &batch, tty_winsize ws,
                     glyph, (unsigned)i, 0, 0, advance_cx, 0, timestamp_fgcolor
                });
             }
+            draw_list_layer(batch, layer_background);
             rect(batch, oy - l * fm.leading, ox, fm.leading, field_width, timestamp_bgcolor);
+            draw_list_layer(batch, layer_text);
             render_text(ox, oy - l * fm.leading, face);
         },
         [&] (auto cell, auto k, auto l, auto o, auto i) {},
@@ -451,7 +701,9 @@ void tty_cellgrid_impl::draw_linenumbers(draw_list &batch, tty_winsize ws,
                     glyph, (unsigned)i, 0, 0, advance_cx, 0, linenumber_fgcolor
                });
             }
+            draw_list_layer(batch, layer_background);
             rect(batch, oy - l * fm.leading, ox, fm.leading, field_width, linenumber_bgcolor);
+            draw_list_layer(batch, layer_text);
             render_text(ox, oy - l * fm.leading, face);
         },
         [&] (auto cell, auto k, auto l, auto o, auto i) {},
@@ -463,7 +715,6 @@ void tty_cellgrid_impl::draw_cellgrid(draw_list &batch, tty_winsize ws,
     float ox, float oy, float field_width)
 {
     text_renderer_ft renderer(manager, style.rscale);
-    std::vector<glyph_shape> shapes;
 
     int rows = ws.vis_rows, cols = ws.vis_cols;
     int fit_cols = (int)floorf(std::max(0.f, field_width) / fm.advance);
@@ -489,21 +740,26 @@ void tty_cellgrid_impl::draw_cellgrid(draw_list &batch, tty_winsize ws,
         p1->new_line({0.0f,0.0f}, {lw,0.0f});
     };
 
-    auto render_text = [&](float x, float y, font_face *face)
-    {
-        text_segment segment("", text_lang, face, font_size, x, y-y_offset, 0);
-        renderer.render(batch, shapes, segment);
-        shapes.clear();
-    };
-
     tty_cell_span selected = tty->get_selection();
+    tty_select_mode select_mode = tty->get_selection_mode();
 
     // todo: add offset adjustment
 
-    auto is_selected = [&](tty_cell_ref cellref) -> bool
+    /* block selections are in visible rows, counted as in draw_loop */
+    llong total_rows = tty->total_rows();
+    llong top_vrow = total_rows - 1 - tty->scroll_row() +
+        (total_rows < rows ? rows - total_rows : 0);
+    llong scroll_col = tty->scroll_col();
+
+    auto is_selected = [&](tty_cell_ref cellref, tty_cell_ref vref) -> bool
     {
         if (selected.start == null_cell_ref && selected.end == null_cell_ref) {
             return false;
+        } else if (select_mode == tty_select_block) {
+            return vref.row >= std::min(selected.start.row, selected.end.row) &&
+                   vref.row <= std::max(selected.start.row, selected.end.row) &&
+                   vref.col >= std::min(selected.start.col, selected.end.col) &&
+                   vref.col <= std::max(selected.start.col, selected.end.col);
         } else if (selected.end > selected.start) {
             return cellref >= selected.start && cellref <= selected.end;
         } else {
@@ -512,11 +768,13 @@ void tty_cellgrid_impl::draw_cellgrid(draw_list &batch, tty_winsize ws,
     };
 
     /* render background colors */
+    draw_list_layer(batch, layer_background);
     draw_loop(rows, fit_cols,
         [&] (auto line, auto k, auto l, auto o, auto i) {},
         [&] (auto cell, auto k, auto l, auto o, auto i) {
             tty_cell_ref cellref = { (llong)k, (llong)i };
-            uint bg = is_selected(cellref) ?
+            tty_cell_ref vref = { top_vrow - (llong)l, scroll_col + (llong)(i-o) };
+            uint bg = is_selected(cellref, vref) ?
                 has_flag(tty_cellgrid_focused) ?
                 style.select_focus_color :
                 style.select_nofocus_color :
@@ -527,18 +785,82 @@ void tty_cellgrid_impl::draw_cellgrid(draw_list &batch, tty_winsize ws,
     );
 
     /* render text */
+    auto render_glyph = [&](tty_cellgrid_glyph *g, float x, float y, uint fg)
+    {
+        float rs = style.rscale, xi;
+        glyph_entry *ge = &g->ent;
+        if (!g->valid || ge->w <= 0 || ge->h <= 0) return;
+        manager->touch(ge);
+        /* bitmaps hold the phase so they go on whole device pixels */
+        if (atlas_subpixel(ge->atlas)) {
+            glyph_subpixel_split(x / rs, &xi);
+            x = xi * rs;
+        }
+        float x1 = x + ge->ox * rs;
+        float y1 = y - y_offset - ge->oy * rs - ge->h * rs;
+        float x2 = x1 + ge->w * rs, y2 = y1 + ge->h * rs;
+        bool color_enabled = (g->face->flags & font_face_color) > 0;
+        renderer.render_quad(batch, ge, x1, y1, x2, y2, fg, color_enabled);
+    };
+
+    /*
+     * cells are gathered into runs with the same style and face, split
+     * at blanks. single cells use the codepoint cache, longer runs are
+     * shaped with HarfBuzz so ligatures, marks and complex scripts
+     * work, with each glyph placed at the column of its cluster.
+     */
+    std::vector<uint> run_text;
+    tty_cell run_cell = {};
+    font_face *run_face = nullptr;
+    size_t run_col = 0;
+
+    auto flush_run = [&](size_t l)
+    {
+        size_t len = run_text.size();
+        if (len == 0) return;
+        float y = oy - l * fm.leading;
+        uint fg = cell_col(run_cell).fg;
+        if (len == 1) {
+            float x = ox + run_col * fm.advance, xi;
+            int phase = glyph_subpixel_split(x / style.rscale, &xi);
+            render_glyph(cell_glyph(run_cell, font_size, phase), x, y, fg);
+        } else {
+            tty_cellgrid_run *r = shape_run(run_face, font_size,
+                run_text.data(), len);
+            for (auto &sh : r->shapes) {
+                float x = ox + (run_col + sh.cluster) * fm.advance +
+                    sh.x_offset / 64.0f, xi;
+                int phase = glyph_subpixel_split(x / style.rscale, &xi);
+                render_glyph(shaped_glyph(run_face, sh.glyph, font_size, phase),
+                    x, y + sh.y_offset / 64.0f, fg);
+            }
+        }
+        run_text.clear();
+    };
+
+    draw_list_layer(batch, layer_text);
     draw_loop(rows, fit_cols,
         [&] (auto line, auto k, auto l, auto o, auto i) {},
         [&] (auto cell, auto k, auto l, auto o, auto i) {
+            if (cell.codepoint == 0 || cell.codepoint == ' ') {
+                flush_run(l);
+                return;
+            }
             font_face *face = cell_font(cell);
-            uint glyph = tty_typeface_lookup_glyph(face, cell.codepoint);
-            int advance_x = (int)(fm.advance * 64.0f);
-            shapes.push_back({
-                glyph, (unsigned)o, 0, 0, advance_x, 0, cell_col(cell).fg
-            });
-            render_text(ox + (i-o) * fm.advance, oy - l * fm.leading, face);
+            if (run_text.size() > 0 &&
+                (cell.style != run_cell.style || face != run_face)) {
+                flush_run(l);
+            }
+            if (run_text.size() == 0) {
+                run_cell = cell;
+                run_face = face;
+                run_col = i-o;
+            }
+            run_text.push_back(cell.codepoint);
         },
-        [&] (auto line, auto k, auto l, auto o, auto i) {}
+        [&] (auto line, auto k, auto l, auto o, auto i) {
+            flush_run(l);
+        }
     );
 
     /* render underline */
@@ -551,7 +873,7 @@ void tty_cellgrid_impl::draw_cellgrid(draw_list &batch, tty_winsize ws,
             lfg = fg = 0;
         },
         [&] (auto cell, auto k, auto l, auto o, auto i) {
-            u = (cell.flags & tty_cell_underline) > 0;
+            u = (tty_cell_style_get(cell.style).flags & tty_cell_underline) > 0;
             fg = cell_col(cell).fg;
             if ((i-o)-lou > 0 && (u != lu || fg != lfg)) {
                 if (lu) render_underline(fm, l, lou, (i-o)-lou, lfg);
@@ -569,6 +891,7 @@ void tty_cellgrid_impl::draw_cellgrid(draw_list &batch, tty_winsize ws,
         }
     );
 
+    draw_list_layer(batch, layer_decoration);
     canvas.emit(batch);
 }
 
@@ -597,6 +920,7 @@ void tty_cellgrid_impl::draw_cursor(draw_list &batch, tty_winsize ws,
     };
 
     /* render cursor */
+    draw_list_layer(batch, layer_decoration);
     draw_loop(rows, fit_cols,
         [&] (auto line, auto k, auto l, auto o, auto i) {
             if (lline == k && loff >= o && loff < o + fit_cols) {
@@ -623,6 +947,7 @@ void tty_cellgrid_impl::draw_scrollbars(draw_list &batch)
     hscroll->set_preferred_size({style.width - style.margin, 15, 0});
 
     root.layout(&canvas);
+    draw_list_layer(batch, layer_overlay);
     canvas.emit(batch);
 }
 
@@ -781,7 +1106,18 @@ bool tty_cellgrid_impl::mouse_event(ui9::MouseEvent *me)
 
     tty_cell_span lsel = { vcell_to_lcell(vsel.start), vcell_to_lcell(vsel.end) };
 
-    if (lsel.start < lsel.end) {
+    if (tty->get_selection_mode() == tty_select_block) {
+        /* blocks hold visible rows and columns, nudged to whole cells */
+        tty_cellgrid_ref l = vsel.start.col < vsel.end.col ? vsel.start : vsel.end;
+        tty_cellgrid_ref r = vsel.start.col < vsel.end.col ? vsel.end : vsel.start;
+        lsel = { vcell_to_vref(vsel.start), vcell_to_vref(vsel.end) };
+        llong col0 = vcell_to_vref(l).col, col1 = vcell_to_vref(r).col;
+        if (fmodf(l.col, 1.f) > 0.5f) col0++;
+        if (fmodf(r.col, 1.f) < 0.5f) col1--;
+        lsel.start.col = col0;
+        lsel.end.col = col1;
+        if (col0 > col1) lsel = { null_cell_ref, null_cell_ref };
+    } else if (lsel.start < lsel.end) {
         if (fmodf(vsel.start.col, 1.f) > 0.5f) lsel.start.col++;
         if (fmodf(vsel.end.col, 1.f) < 0.5f) lsel.end.col--;
         if (lsel.start > lsel.end) lsel = { null_cell_ref, null_cell_ref };
@@ -0,0 +1,318 @@
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+
+#include <functional>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <mutex>
+#include <atomic>
+
+#include "binpack.h"
+#include "image.h"
+#include "color.h"
+#include "utf8.h"
+#include "draw.h"
+#include "font.h"
+#include "glyph.h"
+#include "canvas.h"
+#include "logger.h"
+#include "file.h"
+#include "app.h"
+#include "ui9.h"
+
+#include "timestamp.h"
+#include "teletype.h"
+#include "process.h"
+#include "cellgrid.h"
+#include "render.h"
+#include "panes.h"
+
+static tty_pane* as_pane(ui9::Visible *v) { return dynamic_cast<tty_pane*>(v); }
+static tty_pane_split* as_split(ui9::Visible *v) { return dynamic_cast<tty_pane_split*>(v); }
+
+/*
+ * pane
+ */
+
+tty_pane::tty_pane() : ui9::Visible("Pane"), history(false), closed(false)
+{
+    visible = true;
+}
+
+void tty_pane::resize(float scale)
+{
+    tty_style lstyle = cg->get_style();
+    tty_style style = lstyle;
+    style.width = assigned_size.x;
+    style.height = assigned_size.y;
+    style.rscale = 1.0f/scale;
+    if (style != lstyle) {
+        cg->set_style(style);
+    }
+
+    /* the target is in framebuffer pixels, the grid in window coordinates */
+    render->reshape((int)style.width, (int)style.height);
+    render->set_offscreen((int)roundf(style.width * scale),
+        (int)roundf(style.height * scale));
+
+    tty_winsize dim = cg->get_winsize();
+    tty_winsize ldim = tty->get_winsize();
+    if (dim != ldim) {
+        tty->set_winsize(dim);
+        if (process->pid > 0) {
+            process->winsize(dim);
+        }
+    }
+    tty->set_needs_update();
+}
+
+bool tty_pane::contains(vec2 pos)
+{
+    return pos.x >= position.x && pos.x < position.x + assigned_size.x &&
+           pos.y >= position.y && pos.y < position.y + assigned_size.y;
+}
+
+vec2 tty_pane::local(vec2 pos)
+{
+    return pos - vec2(position);
+}
+
+/*
+ * split
+ */
+
+tty_pane_split::tty_pane_split(tty_split_dir dir) :
+    ui9::Container("Split"), dir(dir), ratio(0.5f)
+{
+    visible = true;
+}
+
+void tty_pane_split::grant_size(vec3 size)
+{
+    /* whole units so neighbouring panes meet at the divider */
+    float extent = (dir == tty_split_columns ? size.x : size.y) - divider;
+    float first = floorf(extent * ratio);
+    float second = extent - first;
+
+    if (children.size() == 2) {
+        if (dir == tty_split_columns) {
+            children[0]->grant_size(vec3(first, size.y, 0));
+            children[1]->grant_size(vec3(second, size.y, 0));
+        } else {
+            children[0]->grant_size(vec3(size.x, first, 0));
+            children[1]->grant_size(vec3(size.x, second, 0));
+        }
+    }
+    ui9::Visible::grant_size(size);
+}
+
+void tty_pane_split::layout(MVGCanvas *c)
+{
+    if (children.size() == 2) {
+        vec3 first = children[0]->get_assigned_size();
+        children[0]->set_position(position);
+        if (dir == tty_split_columns) {
+            children[1]->set_position(position + vec3(first.x + divider, 0, 0));
+        } else {
+            children[1]->set_position(position + vec3(0, first.y + divider, 0));
+        }
+    }
+    ui9::Container::layout(c);
+}
+
+/*
+ * layout
+ */
+
+tty_pane_layout::tty_pane_layout() :
+    tabs(), active_tab(0), focused(nullptr), size(0), scale(1.0f),
+    damaged(true) {}
+
+static void visit(ui9::Visible *v, std::function<void(tty_pane*)> &fn)
+{
+    tty_pane *p;
+    tty_pane_split *s;
+    if ((p = as_pane(v))) {
+        fn(p);
+    } else if ((s = as_split(v))) {
+        for (auto &c : s->children) visit(c.get(), fn);
+    }
+}
+
+static std::unique_ptr<ui9::Visible>* owner(tty_pane_layout *l, ui9::Visible *v)
+{
+    /* find the pointer that owns a node, in its parent or the tab list */
+    std::vector<std::unique_ptr<ui9::Visible>> *list = &l->tabs;
+    if (v->get_parent()) {
+        list = &static_cast<tty_pane_split*>(v->get_parent())->children;
+    }
+    for (auto &o : *list) {
+        if (o.get() == v) return &o;
+    }
+    return nullptr;
+}
+
+void tty_pane_layout::panes(std::function<void(tty_pane*)> fn)
+{
+    if (active_tab < tabs.size()) {
+        visit(tabs[active_tab].get(), fn);
+    }
+}
+
+void tty_pane_layout::all_panes(std::function<void(tty_pane*)> fn)
+{
+    for (auto &t : tabs) {
+        visit(t.get(), fn);
+    }
+}
+
+void tty_pane_layout::add_tab(tty_pane *p)
+{
+    tabs.push_back(std::unique_ptr<ui9::Visible>(p));
+    active_tab = tabs.size() - 1;
+    set_focus(p);
+    layout();
+}
+
+void tty_pane_layout::split(tty_pane *p, tty_split_dir dir)
+{
+    /* the split takes the place of the focused pane, which it then holds */
+    std::unique_ptr<ui9::Visible> *o = owner(this, focused);
+    if (!o) {
+        delete p;
+        return;
+    }
+    ui9::Visible *parent = focused->get_parent();
+    tty_pane_split *s = new tty_pane_split(dir);
+    s->add_child(o->release());
+    s->add_child(p);
+    o->reset(s);
+    s->set_parent(parent);
+    set_focus(p);
+    layout();
+}
+
+void tty_pane_layout::remove(tty_pane *p)
+{
+    /* the sibling of a removed pane takes the place of their split */
+    ui9::Visible *parent = p->get_parent();
+    if (!parent) {
+        auto i = std::find_if(tabs.begin(), tabs.end(),
+            [p](std::unique_ptr<ui9::Visible> &t) { return t.get() == p; });
+        if (i == tabs.end()) return;
+        size_t idx = i - tabs.begin();
+        tabs.erase(i);
+        if (active_tab > idx || active_tab == tabs.size()) {
+            active_tab = active_tab > 0 ? active_tab - 1 : 0;
+        }
+    } else {
+        tty_pane_split *s = static_cast<tty_pane_split*>(parent);
+        size_t idx = s->children[0].get() == p ? 1 : 0;
+        ui9::Visible *grandparent = s->get_parent();
+        std::unique_ptr<ui9::Visible> sibling = std::move(s->children[idx]);
+        std::unique_ptr<ui9::Visible> *o = owner(this, s);
+        sibling->set_parent(grandparent);
+        o->reset(sibling.release()); /* deletes the split and the pane */
+    }
+    if (focused == p) {
+        focused = nullptr;
+        panes([this](tty_pane *q) { if (!focused) set_focus(q); });
+    }
+    layout();
+}
+
+void tty_pane_layout::next_pane()
+{
+    std::vector<tty_pane*> l;
+    panes([&l](tty_pane *p) { l.push_back(p); });
+    auto i = std::find(l.begin(), l.end(), focused);
+    if (i == l.end() || ++i == l.end()) i = l.begin();
+    if (i != l.end()) set_focus(*i);
+}
+
+void tty_pane_layout::next_tab()
+{
+    if (tabs.size() < 2) return;
+    active_tab = (active_tab + 1) % tabs.size();
+    focused = nullptr;
+    panes([this](tty_pane *q) { if (!focused) set_focus(q); });
+    layout();
+}
+
+void tty_pane_layout::set_focus(tty_pane *p, bool window_focused)
+{
+    if (focused && focused != p) {
+        focused->cg->set_flag(tty_cellgrid_focused, false);
+        focused->tty->set_needs_update();
+    }
+    focused = p;
+    if (focused) {
+        focused->cg->set_flag(tty_cellgrid_focused, window_focused);
+        focused->tty->set_needs_update();
+    }
+}
+
+void tty_pane_layout::reshape(vec2 size, float scale)
+{
+    this->size = size;
+    this->scale = scale;
+    layout();
+}
+
+void tty_pane_layout::layout()
+{
+    /* hidden tabs are laid out when they become active */
+    if (active_tab < tabs.size() && size.x > 0 && size.y > 0) {
+        ui9::Visible *root = tabs[active_tab].get();
+        root->set_position(vec3(0));
+        root->grant_size(vec3(size, 0));
+        root->layout(nullptr);
+        panes([this](tty_pane *p) { p->resize(scale); });
+    }
+    damaged = true;
+}
+
+tty_pane* tty_pane_layout::pane_at(vec2 pos)
+{
+    tty_pane *found = nullptr;
+    panes([&](tty_pane *p) { if (p->contains(pos)) found = p; });
+    return found;
+}
+
+bool tty_pane_layout::update()
+{
+    /* render panes with damage into their targets, idle panes are skipped */
+    bool drawn = damaged;
+    panes([&drawn](tty_pane *p) {
+        if (p->render->update()) {
+            p->render->display();
+            drawn = true;
+        }
+    });
+    damaged = false;
+    return drawn;
+}
+
+void tty_pane_layout::composite(int width, int height, uint divider_color)
+{
+    /* the dividers are the background showing between the panes */
+    color c(divider_color);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, width, height);
+    glClearColor(c.r, c.g, c.b, c.a);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    /* framebuffer rows count up from the bottom */
+    panes([&](tty_pane *p) {
+        int x = (int)roundf(p->position.x * scale);
+        int y = (int)roundf((p->position.y + p->assigned_size.y) * scale);
+        p->render->composite(x, height - y);
+    });
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+/*
+ * pane layout
+ *
+ * a window holds tabs and each tab is a tree of splits with panes at
+ * the leaves. every pane has its own teletype, pty, cellgrid and an
+ * offscreen render target. panes are only rendered when they have
+ * damage, and the window composites the cached targets of the active
+ * tab into one frame, so idle panes cost nothing per frame.
+ *
+ * positions and sizes are in window coordinates, with the position
+ * being the top left corner of the space granted to a node.
+ */
+
+enum tty_split_dir
+{
+    tty_split_columns,  /* side by side */
+    tty_split_rows      /* one above the other */
+};
+
+struct tty_pane : ui9::Visible
+{
+    std::unique_ptr<tty_teletype> tty;
+    std::unique_ptr<tty_cellgrid> cg;
+    std::unique_ptr<tty_render> render;
+    std::unique_ptr<tty_process> process;
+    bool history;
+    bool closed;
+
+    tty_pane();
+
+    void resize(float scale);
+    bool contains(vec2 pos);
+    vec2 local(vec2 pos);
+};
+
+struct tty_pane_split : ui9::Container
+{
+    static constexpr float divider = 1.0f;
+
+    tty_split_dir dir;
+    float ratio;
+
+    tty_pane_split(tty_split_dir dir);
+
+    virtual void grant_size(vec3 size);
+    virtual void layout(MVGCanvas *c);
+};
+
+struct tty_pane_layout
+{
+    std::vector<std::unique_ptr<ui9::Visible>> tabs;
+    size_t active_tab;
+    tty_pane *focused;
+    vec2 size;
+    float scale;
+    bool damaged;
+
+    tty_pane_layout();
+
+    void add_tab(tty_pane *p);
+    void split(tty_pane *p, tty_split_dir dir);
+    void remove(tty_pane *p);
+    void next_pane();
+    void next_tab();
+    void set_focus(tty_pane *p, bool window_focused = true);
+    void reshape(vec2 size, float scale);
+    void layout();
+
+    tty_pane* pane_at(vec2 pos);
+    void panes(std::function<void(tty_pane*)> fn);
+    void all_panes(std::function<void(tty_pane*)> fn);
+
+    bool update();
+    void composite(int width, int height, uint divider_color);
+};
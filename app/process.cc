@@ -11,6 +11,7 @@
 #include <signal.h>
 #include <sys/ioctl.h>
 #include <sys/param.h>
+#include <sys/wait.h>
 
 #if defined(__linux__)
 #include <pty.h>
@@ -160,3 +161,45 @@ bool tty_process::winsize(tty_winsize zws)
 
     return true;
 }
+
+ssize_t tty_process_pipe(tty_teletype *tty, const char *cmd)
+{
+    int fds[2];
+    pid_t pid;
+
+    if (pipe(fds) < 0) {
+        Error("tty_process_pipe: pipe: %s\n", strerror(errno));
+        return -1;
+    }
+
+    /* the command runs in a grandchild so it is reaped by init */
+    switch ((pid = fork())) {
+    case -1:
+        Error("tty_process_pipe: fork: %s\n", strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    case 0:
+        if (fork() == 0) {
+            dup2(fds[0], 0);
+            close(fds[0]);
+            close(fds[1]);
+            execl("/bin/sh", "sh", "-c", cmd, (char*)NULL);
+        }
+        _exit(1);
+    }
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+
+    /* a command that exits early must not take the terminal with it */
+    struct sigaction sa = {}, old_sa;
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, &old_sa);
+    ssize_t ret = tty->write_selected_text(fds[1]);
+    sigaction(SIGPIPE, &old_sa, NULL);
+    close(fds[1]);
+
+    Debug("tty_process_pipe: cmd=%s bytes=%zd\n", cmd, ret);
+
+    return ret;
+}
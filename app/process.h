@@ -12,3 +12,4 @@ struct tty_process
 };
 
 tty_process* tty_process_new();
+ssize_t tty_process_pipe(tty_teletype *tty, const char *cmd);
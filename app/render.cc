@@ -2,6 +2,7 @@
 #include <cstring>
 #include <cerrno>
 #include <climits>
+#include <cmath>
 
 #include <functional>
 #include <algorithm>
@@ -47,56 +48,98 @@ struct circular_buffer
     llong samples[31];
 };
 
+struct tty_render_context_opengl : tty_render_context
+{
+    program prog_flat;
+    program prog_texture;
+    program prog_msdf;
+    program prog_lcd;
+    program prog_canvas;
+    std::map<int,GLuint> tex_map;
+    pixel_buffer_ring upload_ring;
+    bool initialized;
+
+    tty_render_context_opengl();
+
+    void initialize();
+};
+
+tty_render_context_opengl::tty_render_context_opengl()
+: prog_flat(), prog_texture(), prog_msdf(), prog_lcd(), prog_canvas(),
+  tex_map(), upload_ring(), initialized(false) {}
+
+tty_render_context* tty_render_context_new()
+{
+    return new tty_render_context_opengl();
+}
+
 struct tty_render_opengl : tty_render
 {
     font_manager_ft *manager;
     tty_cellgrid *cg;
+    std::unique_ptr<tty_render_context_opengl> own_ctx;
+    tty_render_context_opengl *ctx;
     circular_buffer frame_times;
+    ullong frame_last;
     texture_buffer shape_tb;
     texture_buffer edge_tb;
     texture_buffer brush_tb;
-    program prog_flat;
-    program prog_texture;
-    program prog_msdf;
-    program prog_canvas;
     GLuint vao;
-    GLuint vbo;
-    GLuint ibo;
-    std::map<int,GLuint> tex_map;
+    stream_buffer vbo;
+    stream_buffer ibo;
+    GLuint fbo;
+    GLuint fbo_tex;
+    int fbo_width, fbo_height;
+    int target_width, target_height;
     draw_list batch;
     mat4 mvp;
     bool overlay_stats;
+    size_t draw_count;
+    uint32_t glyph_epoch;
+    uint32_t commit_epoch;
 
-    tty_render_opengl(font_manager_ft *manager, tty_cellgrid *cg);
+    tty_render_opengl(font_manager_ft *manager, tty_cellgrid *cg,
+        tty_render_context_opengl *ctx);
     virtual ~tty_render_opengl();
 
     virtual void set_overlay(bool val);
 
-    virtual void update();
+    virtual bool update();
     virtual void display();
     virtual void reshape(int width, int height);
     virtual void initialize();
+    virtual void release();
+    virtual void set_offscreen(int width, int height);
+    virtual void composite(int x, int y);
 
 protected:
     void create_layout();
+    void bind_target();
+    void bind_vertex_array();
     program* cmd_shader_gl(int cmd_shader);
     std::vector<std::string> get_stats();
     void render_stats(draw_list &batch);
     void update_uniforms(program *prog);
 };
 
-tty_render_opengl::tty_render_opengl(font_manager_ft *manager, tty_cellgrid *cg)
-: manager(manager), cg(cg), frame_times{},
+tty_render_opengl::tty_render_opengl(font_manager_ft *manager, tty_cellgrid *cg,
+    tty_render_context_opengl *ctx)
+: manager(manager), cg(cg),
+  own_ctx(ctx ? nullptr : new tty_render_context_opengl()),
+  ctx(ctx ? ctx : own_ctx.get()), frame_times{}, frame_last(0),
   shape_tb(), edge_tb(), brush_tb(),
-  prog_flat(), prog_texture(), prog_msdf(), prog_canvas(),
-  vao(0), vbo(0), ibo(0), tex_map(), batch(), mvp{},
-  overlay_stats(false) {}
+  vao(0), vbo(), ibo(), fbo(0), fbo_tex(0), fbo_width(0), fbo_height(0),
+  target_width(0), target_height(0), batch(), mvp{},
+  overlay_stats(false), draw_count(0), glyph_epoch(0),
+  commit_epoch(0) {}
 
 tty_render_opengl::~tty_render_opengl() {}
 
-tty_render* tty_render_new(font_manager_ft *manager, tty_cellgrid *cg)
+tty_render* tty_render_new(font_manager_ft *manager, tty_cellgrid *cg,
+    tty_render_context *ctx)
 {
-    return new tty_render_opengl(manager, cg);
+    return new tty_render_opengl(manager, cg,
+        static_cast<tty_render_context_opengl*>(ctx));
 }
 
 static void circular_buffer_add(circular_buffer *buffer, llong new_value)
@@ -131,6 +174,13 @@ std::vector<std::string> tty_render_opengl::get_stats()
     std::vector<std::string> stats;
     stats.push_back(format_string("FPS: %4.1f",
         1e9 / circular_buffer_average(&frame_times)));
+    stats.push_back(format_string("Draws: %zu", draw_count));
+    stats.push_back(format_string("Glyphs: %zu front %zu map %zu miss",
+        manager->glyph_stats.front_hits, manager->glyph_stats.map_hits,
+        manager->glyph_stats.misses));
+    stats.push_back(format_string("Atlas: %zu KiB %zu evict %zu repack",
+        manager->atlas_bytes() >> 10, manager->glyph_stats.evictions,
+        manager->glyph_stats.repacks));
     return stats;
 }
 
@@ -161,18 +211,30 @@ void tty_render_opengl::render_stats(draw_list &batch)
     }
 }
 
-void tty_render_opengl::update()
+bool tty_render_opengl::update()
 {
-    static ullong tl, tn;
+    ullong tn;
+
+    /*
+     * commit glyphs rasterized in the background and redraw, or redraw
+     * to retry glyphs that didn't fit until the atlas has been repacked.
+     * another pane sharing the manager may have committed the glyphs,
+     * or evicted or moved ours, which bumps the epochs.
+     */
+    manager->update_async();
+    if (manager->repack_pending() || manager->glyph_epoch != glyph_epoch ||
+        manager->commit_epoch != commit_epoch) {
+        cg->get_teletype()->set_needs_update();
+    }
 
-    if (!cg->get_teletype()->get_needs_update()) return;
+    if (!cg->get_teletype()->get_needs_update()) return false;
 
     cg->update_scroll();
 
     auto now = high_resolution_clock::now();
     tn = duration_cast<nanoseconds>(now.time_since_epoch()).count();
-    if (tl != 0) circular_buffer_add(&frame_times, tn - tl);
-    tl = tn;
+    if (frame_last != 0) circular_buffer_add(&frame_times, tn - frame_last);
+    frame_last = tn;
 
     /* start frame with empty draw list */
     draw_list_clear(batch);
@@ -182,49 +244,154 @@ void tty_render_opengl::update()
 
     /* render stats text */
     if (overlay_stats) {
+        draw_list_layer(batch, layer_overlay);
         render_stats(batch);
     }
 
+    /* sort commands into layers and merge compatible ranges */
+    draw_list_sort(batch);
+    draw_count = batch.cmds.size();
+
     /* synchronize canvas texture buffers */
     buffer_texture_create(shape_tb, cg->get_canvas()->ctx->shapes, GL_TEXTURE0, GL_R32F);
     buffer_texture_create(edge_tb, cg->get_canvas()->ctx->edges, GL_TEXTURE1, GL_R32F);
     buffer_texture_create(brush_tb, cg->get_canvas()->ctx->brushes, GL_TEXTURE2, GL_R32F);
 
-    /* update vertex and index buffers arrays (idempotent) */
-    vertex_buffer_create("vbo", &vbo, GL_ARRAY_BUFFER, batch.vertices);
-    vertex_buffer_create("ibo", &ibo, GL_ELEMENT_ARRAY_BUFFER, batch.indices);
+    /* stream vertex and index arrays into the next buffer region */
+    bool created = false;
+    created |= stream_buffer_write("vbo", vbo, GL_ARRAY_BUFFER, batch.vertices);
+    created |= stream_buffer_write("ibo", ibo, GL_ELEMENT_ARRAY_BUFFER, batch.indices);
+    if (created) {
+        bind_vertex_array();
+    }
+
+    /* the batch was built with glyph positions from this epoch */
+    glyph_epoch = manager->glyph_epoch;
+    commit_epoch = manager->commit_epoch;
+
+    return true;
+}
+
+void tty_render_opengl::bind_vertex_array()
+{
+    /* the vertex array holds buffer names, so is set up on creation */
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo.obj);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo.obj);
+    program *p = &ctx->prog_canvas; /* use any program to get attribute locations */
+    vertex_array_pointer(p, "a_pos", 3, GL_FLOAT, 0, &draw_vertex::pos);
+    vertex_array_pointer(p, "a_uv0", 2, GL_FLOAT, 0, &draw_vertex::uv);
+    vertex_array_pointer(p, "a_color", 4, GL_UNSIGNED_BYTE, 1, &draw_vertex::color);
+    vertex_array_pointer(p, "a_shape", 1, GL_FLOAT, 0, &draw_vertex::shape);
+    vertex_array_1f(p, "a_gamma", 1.0f);
+    glBindVertexArray(0);
 }
 
 program* tty_render_opengl::cmd_shader_gl(int cmd_shader)
 {
     switch (cmd_shader) {
-    case shader_flat:    return &prog_flat;
-    case shader_texture: return &prog_texture;
-    case shader_msdf:    return &prog_msdf;
-    case shader_canvas:  return &prog_canvas;
+    case shader_flat:    return &ctx->prog_flat;
+    case shader_texture: return &ctx->prog_texture;
+    case shader_msdf:    return &ctx->prog_msdf;
+    case shader_lcd:     return &ctx->prog_lcd;
+    case shader_canvas:  return &ctx->prog_canvas;
     default: return nullptr;
     }
 }
 
+void tty_render_opengl::set_offscreen(int width, int height)
+{
+    /* the target is resized in display, when our context is current */
+    target_width = std::max(width, 0);
+    target_height = std::max(height, 0);
+}
+
+void tty_render_opengl::bind_target()
+{
+    if (target_width == 0 || target_height == 0) return;
+
+    if (!fbo) {
+        glGenFramebuffers(1, &fbo);
+        glGenTextures(1, &fbo_tex);
+    }
+    if (fbo_width != target_width || fbo_height != target_height) {
+        glBindTexture(GL_TEXTURE_2D, fbo_tex);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, target_width, target_height,
+            0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+            GL_TEXTURE_2D, fbo_tex, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            Error("error: offscreen framebuffer incomplete: %dx%d\n",
+                target_width, target_height);
+        }
+        fbo_width = target_width;
+        fbo_height = target_height;
+        Debug("framebuffer %u = %d x %d\n", fbo, fbo_width, fbo_height);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glViewport(0, 0, fbo_width, fbo_height);
+}
+
+void tty_render_opengl::composite(int x, int y)
+{
+    /* copy the cached frame, which is only redrawn when it has damage */
+    if (!fbo || fbo_width == 0 || fbo_height == 0) return;
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+    glBlitFramebuffer(0, 0, fbo_width, fbo_height,
+        x, y, x + fbo_width, y + fbo_height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+}
+
 void tty_render_opengl::display()
 {
+    bind_target();
+
     /* okay, lets send commands to the GPU */
     color bg(cg->get_style().background_color);
     glClearColor(bg.r, bg.g, bg.b, bg.a);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    /* draw list batch with tbo_iid canvas texture buffer special case */
+    /*
+     * draw list batch with tbo_iid canvas texture buffer special case.
+     * textures are shared, so the window that takes the dirty regions
+     * of an atlas uploads them for every window.
+     */
+    auto &tex_map = ctx->tex_map;
     for (auto img : batch.images) {
         auto ti = tex_map.find(img.iid);
         if (ti == tex_map.end()) {
             tex_map[img.iid] = image_create_texture(img);
         } else {
-            image_update_texture(tex_map[img.iid], img);
+            image_update_texture(ctx->upload_ring, tex_map[img.iid], img,
+                batch.rects);
         }
     }
-    for (auto cmd : batch.cmds) {
-        glUseProgram(cmd_shader_gl(cmd.shader)->pid);
-        if (cmd.iid == tbo_iid) {
+    /* regions are uploaded once, even if we redisplay the same batch */
+    batch.rects.clear();
+
+    /* commands are sorted, so only bind state when it changes */
+    uint last_shader = 0, last_iid = image_none;
+    glBindVertexArray(vao);
+    for (auto &cmd : batch.cmds) {
+        if (cmd.shader != last_shader) {
+            /* programs are shared, so set the transform of this window */
+            program *prog = cmd_shader_gl(cmd.shader);
+            glUseProgram(prog->pid);
+            update_uniforms(prog);
+            /* LCD coverage is blended per channel by the second output */
+            if (cmd.shader == shader_lcd) {
+                glBlendFunc(GL_SRC1_COLOR, GL_ONE_MINUS_SRC1_COLOR);
+            } else if (last_shader == shader_lcd) {
+                glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            }
+            last_shader = cmd.shader;
+        }
+        if (cmd.iid == last_iid) {
+            /* textures are already bound */
+        } else if (cmd.iid == tbo_iid) {
             glActiveTexture(GL_TEXTURE0);
             glBindTexture(GL_TEXTURE_BUFFER, shape_tb.tex);
             glActiveTexture(GL_TEXTURE1);
@@ -235,9 +402,26 @@ void tty_render_opengl::display()
             glActiveTexture(GL_TEXTURE0);
             glBindTexture(GL_TEXTURE_2D, tex_map[cmd.iid]);
         }
-        glBindVertexArray(vao);
-        glDrawElements(cmd_mode_gl(cmd.mode), cmd.count, GL_UNSIGNED_INT,
-            (void*)(cmd.offset * sizeof(uint)));
+        last_iid = cmd.iid;
+        glDrawElementsBaseVertex(cmd_mode_gl(cmd.mode), cmd.count,
+            GL_UNSIGNED_INT, (void*)(ibo.offset + cmd.offset * sizeof(uint)),
+            (GLint)(vbo.offset / sizeof(draw_vertex)));
+    }
+    if (last_shader == shader_lcd) {
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    }
+    /* the next pane streams its indices with the element binding free */
+    glBindVertexArray(0);
+
+    /* regions can't be rewritten until the GPU is done with them */
+    stream_buffer_fence(vbo);
+    stream_buffer_fence(ibo);
+    stream_buffer_fence(shape_tb.buf);
+    stream_buffer_fence(edge_tb.buf);
+    stream_buffer_fence(brush_tb.buf);
+
+    if (fbo) {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
     }
 }
 
@@ -254,24 +438,17 @@ void tty_render_opengl::reshape(int width, int height)
 {
     tty_style style = cg->get_style();
 
+    /* uniforms are set when programs are bound in display */
     mvp = glm::ortho(0.0f, style.width, style.height, 0.0f, 0.0f, 100.0f);
-
-    glUseProgram(prog_canvas.pid);
-    update_uniforms(&prog_canvas);
-
-    glUseProgram(prog_msdf.pid);
-    update_uniforms(&prog_msdf);
-
-    glUseProgram(prog_flat.pid);
-    update_uniforms(&prog_flat);
-
-    glUseProgram(prog_texture.pid);
-    update_uniforms(&prog_texture);
 }
 
-void tty_render_opengl::initialize()
+void tty_render_context_opengl::initialize()
 {
-    GLuint flat_fsh, texture_fsh, msdf_fsh, canvas_fsh, vsh;
+    GLuint flat_fsh, texture_fsh, msdf_fsh, lcd_fsh, canvas_fsh, vsh;
+
+    /* programs are compiled once for all windows in the share group */
+    if (initialized) return;
+    initialized = true;
 
     std::vector<std::string> attrs = {
         "a_pos", "a_uv0", "a_color", "a_shape", "a_gamma"
@@ -283,39 +460,39 @@ void tty_render_opengl::initialize()
         flat_fsh = compile_shader(GL_FRAGMENT_SHADER, "Resources/shaders/flat.fsh");
         texture_fsh = compile_shader(GL_FRAGMENT_SHADER, "Resources/shaders/texture.fsh");
         msdf_fsh = compile_shader(GL_FRAGMENT_SHADER, "Resources/shaders/msdf.fsh");
+        lcd_fsh = compile_shader(GL_FRAGMENT_SHADER, "Resources/shaders/lcd.fsh");
         canvas_fsh = compile_shader(GL_FRAGMENT_SHADER, "Resources/shaders/canvas.fsh");
     } else {
         vsh = compile_shader(GL_VERTEX_SHADER, "shaders/simple.vsh");
         flat_fsh = compile_shader(GL_FRAGMENT_SHADER, "shaders/flat.fsh");
         texture_fsh = compile_shader(GL_FRAGMENT_SHADER, "shaders/texture.fsh");
         msdf_fsh = compile_shader(GL_FRAGMENT_SHADER, "shaders/msdf.fsh");
+        lcd_fsh = compile_shader(GL_FRAGMENT_SHADER, "shaders/lcd.fsh");
         canvas_fsh = compile_shader(GL_FRAGMENT_SHADER, "shaders/canvas.fsh");
     }
     link_program(&prog_flat, vsh, flat_fsh, attrs);
     link_program(&prog_texture, vsh, texture_fsh, attrs);
     link_program(&prog_msdf, vsh, msdf_fsh, attrs);
+    link_program(&prog_lcd, vsh, lcd_fsh, attrs);
     link_program(&prog_canvas, vsh, canvas_fsh, attrs);
     glDeleteShader(vsh);
     glDeleteShader(texture_fsh);
     glDeleteShader(msdf_fsh);
+    glDeleteShader(lcd_fsh);
     glDeleteShader(canvas_fsh);
+}
+
+void tty_render_opengl::initialize()
+{
+    ctx->initialize();
 
     /* create vertex and index buffers arrays */
-    vertex_buffer_create("vbo", &vbo, GL_ARRAY_BUFFER, batch.vertices);
-    vertex_buffer_create("ibo", &ibo, GL_ELEMENT_ARRAY_BUFFER, batch.indices);
+    stream_buffer_write("vbo", vbo, GL_ARRAY_BUFFER, batch.vertices);
+    stream_buffer_write("ibo", ibo, GL_ELEMENT_ARRAY_BUFFER, batch.indices);
 
     /* configure vertex array object */
     glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
-    program *p = &prog_canvas; /* use any program to get attribute locations */
-    vertex_array_pointer(p, "a_pos", 3, GL_FLOAT, 0, &draw_vertex::pos);
-    vertex_array_pointer(p, "a_uv0", 2, GL_FLOAT, 0, &draw_vertex::uv);
-    vertex_array_pointer(p, "a_color", 4, GL_UNSIGNED_BYTE, 1, &draw_vertex::color);
-    vertex_array_pointer(p, "a_shape", 1, GL_FLOAT, 0, &draw_vertex::shape);
-    vertex_array_1f(p, "a_gamma", 1.0f);
-    glBindVertexArray(0);
+    bind_vertex_array();
 
     /* pipeline */
     glEnable(GL_CULL_FACE);
@@ -325,3 +502,26 @@ void tty_render_opengl::initialize()
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glDisable(GL_DEPTH_TEST);
 }
+
+void tty_render_opengl::release()
+{
+    /* delete the objects owned by this window, its context must be current */
+    for (auto *buf : { &vbo, &ibo, &shape_tb.buf, &edge_tb.buf, &brush_tb.buf }) {
+        for (auto &fence : buf->fence) {
+            if (fence) glDeleteSync(fence);
+            fence = 0;
+        }
+        if (buf->obj) glDeleteBuffers(1, &buf->obj);
+        buf->obj = 0;
+    }
+    for (auto *tb : { &shape_tb, &edge_tb, &brush_tb }) {
+        if (tb->tex) glDeleteTextures(1, &tb->tex);
+        tb->tex = 0;
+    }
+    if (vao) glDeleteVertexArrays(1, &vao);
+    vao = 0;
+    if (fbo) glDeleteFramebuffers(1, &fbo);
+    if (fbo_tex) glDeleteTextures(1, &fbo_tex);
+    fbo = fbo_tex = 0;
+    fbo_width = fbo_height = 0;
+}
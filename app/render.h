@@ -1,15 +1,37 @@
 #pragma once
 
+/*
+ * GL objects shared by every window in a context share group: shader
+ * programs, atlas textures and the pixel unpack buffers used to upload
+ * them. vertex arrays are not shared between contexts, so each window
+ * keeps its own vertex array and streaming buffers.
+ */
+struct tty_render_context
+{
+    virtual ~tty_render_context() = default;
+};
+
+tty_render_context* tty_render_context_new();
+
 struct tty_render
 {
     virtual ~tty_render() = default;
 
     virtual void set_overlay(bool val) = 0;
 
-    virtual void update() = 0;
+    virtual bool update() = 0;
     virtual void display() = 0;
     virtual void reshape(int width, int height) = 0;
     virtual void initialize() = 0;
+    virtual void release() = 0;
+
+    /*
+     * with an offscreen size, display draws into a cached framebuffer
+     * texture that composite copies into the bound framebuffer.
+     */
+    virtual void set_offscreen(int width, int height) = 0;
+    virtual void composite(int x, int y) = 0;
 };
 
-tty_render* tty_render_new(font_manager_ft *manager, tty_cellgrid *cg);
+tty_render* tty_render_new(font_manager_ft *manager, tty_cellgrid *cg,
+    tty_render_context *ctx = nullptr);
@@ -3,10 +3,18 @@
 #include <cerrno>
 #include <cassert>
 #include <climits>
+#include <unordered_map>
 
 #include <time.h>
 #include <poll.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <zlib.h>
+#include <brotli/encode.h>
+#include <brotli/decode.h>
 
 #include "app.h"
 #include "utf8.h"
@@ -227,15 +235,44 @@ struct tty_line_store
     tty_line& get_line(llong lline, bool edit);
     llong count_cells(tty_packed_line &pline);
     llong count_cells(llong lline);
+    llong text_size(llong lline);
+    llong copy_text(llong lline, llong start, llong end,
+        std::function<void(const char*,size_t)> emit);
     void clear_line(llong lline);
     void erase_line(llong lline, llong start, llong end, llong cols, tty_cell tmpl);
     void clear_all();
     void invalidate_cache();
     void dump_stats();
+    bool save(const char *path, tty_history_codec codec);
+    bool load(const char *path);
 
     tty_line_store();
 };
 
+struct tty_screen_grid
+{
+    llong rows;
+    llong cols;
+    std::vector<tty_cell> cells;
+    std::vector<llong> index;
+    tty_line line;
+
+    tty_cell* row(llong r) { return cells.data() + index[r] * cols; }
+
+    void resize(llong rows, llong cols);
+    void erase(llong r, llong start, llong end, tty_cell tmpl);
+    void scroll(llong top, llong bot, llong n, tty_cell tmpl);
+    void insert_chars(llong r, llong col, llong n, tty_cell tmpl);
+    void delete_chars(llong r, llong col, llong n, tty_cell tmpl);
+    llong count_cells(llong r);
+    llong text_size(llong r);
+    llong copy_text(llong r, llong start, llong end,
+        std::function<void(const char*,size_t)> emit);
+    tty_line& get_line(llong r);
+
+    tty_screen_grid();
+};
+
 struct tty_teletype_impl : tty_teletype
 {
     uint state;
@@ -257,10 +294,13 @@ struct tty_teletype_impl : tty_teletype
     ssize_t out_end;
 
     tty_timestamp tv;
-    tty_cell tmpl;
+    tty_cell_style tmpl;
+    uint tmpl_style;
     tty_line_store hist;
+    tty_screen_grid alt;
     tty_line empty_line;
     tty_cell_span sel;
+    tty_select_mode sel_mode;
     tty_winsize ws;
     llong cur_line;
     llong cur_offset;
@@ -268,8 +308,8 @@ struct tty_teletype_impl : tty_teletype
     llong sav_line;
     llong sav_offset;
     llong sav_overflow;
-    llong sav_row;
-    llong sav_col;
+    llong sav_row[2];
+    llong sav_col[2];
     llong min_line;
     llong max_cols;
     llong top_marg;
@@ -278,7 +318,7 @@ struct tty_teletype_impl : tty_teletype
     llong scr_col;
 
     tty_teletype_impl();
-    virtual ~tty_teletype_impl() = default;
+    virtual ~tty_teletype_impl();
 
     virtual void log(logger::L level, const char *fmt, ...);
 
@@ -291,7 +331,12 @@ struct tty_teletype_impl : tty_teletype
     virtual tty_line& get_line(llong lline);
     virtual void set_selection(tty_cell_span sel);
     virtual tty_cell_span get_selection();
+    virtual void set_selection_mode(tty_select_mode mode);
+    virtual tty_select_mode get_selection_mode();
     virtual std::string get_selected_text();
+    virtual ssize_t write_selected_text(int fd);
+    virtual bool save_history(const char *path, tty_history_codec codec);
+    virtual bool load_history(const char *path);
     virtual llong total_rows();
     virtual llong total_cols();
     virtual llong visible_rows();
@@ -323,10 +368,19 @@ struct tty_teletype_impl : tty_teletype
     virtual void emit_loop(const char *buf, size_t len);
     virtual bool keyboard(int key, int scancode, int action, int mods);
 
+    void mark_styles(std::vector<uint> &remap);
+    void remap_styles(const std::vector<uint> &remap);
+
 protected:
     std::string args_str();
     int opt_arg(int arg, int opt);
 
+    llong selection_size();
+    void copy_selection(std::function<void(const char*,size_t)> emit);
+
+    bool alt_screen();
+    void switch_screen(bool enable);
+
     void send(uint c);
     void move(tty_coord row, tty_coord col);
     void reset_style();
@@ -362,6 +416,104 @@ protected:
     void absorb(uint c);
 };
 
+/*
+ * cell styles are interned so that cells hold a 32-bit style index in
+ * place of flags and colors. styles are only interned when the graphic
+ * rendition changes, and lookups are a vector index. the table is shared
+ * by all terminals, so when it grows past its limit, styles no longer
+ * referenced by any cell are reclaimed and indices are compacted. this
+ * happens between input chunks, and the limit is then raised to twice
+ * the live count so that reclaims are amortized.
+ */
+
+struct tty_cell_style_hash
+{
+    size_t operator()(const tty_cell_style &s) const
+    {
+        uint64_t h = (((uint64_t)s.fg << 32) | s.bg) * 0x9e3779b97f4a7c15ull;
+        h = (h ^ s.flags) * 0x9e3779b97f4a7c15ull;
+        return (size_t)(h ^ (h >> 32));
+    }
+};
+
+struct tty_cell_style_eq
+{
+    bool operator()(const tty_cell_style &l, const tty_cell_style &r) const
+    {
+        return l.flags == r.flags && l.fg == r.fg && l.bg == r.bg;
+    }
+};
+
+struct tty_cell_style_table
+{
+    std::vector<tty_cell_style> styles;
+    std::unordered_map<tty_cell_style,uint,
+        tty_cell_style_hash,tty_cell_style_eq> index;
+    std::vector<tty_teletype_impl*> terms;
+    size_t limit;
+
+    static const size_t style_limit = 1 << 16;
+
+    tty_cell_style_table() : styles(), index(), terms(), limit(style_limit)
+    {
+        intern(tty_cell_style{ 0, 0, 0 });
+        intern(tty_cell_style{ 0, tty_cell_color_fg_dfl, tty_cell_color_bg_dfl });
+    }
+
+    uint intern(tty_cell_style s)
+    {
+        auto i = index.find(s);
+        if (i != index.end()) return i->second;
+        uint style = (uint)styles.size();
+        styles.push_back(s);
+        index.insert({s, style});
+        return style;
+    }
+
+    void compact()
+    {
+        if (styles.size() <= limit) return;
+
+        /* mark styles referenced by cells, keeping none and default */
+        std::vector<uint> remap(styles.size(), UINT_MAX);
+        remap[tty_cell_style_none] = remap[tty_cell_style_dfl] = 0;
+        for (tty_teletype_impl *t : terms) t->mark_styles(remap);
+
+        /* assign new indices in order so none and default are unchanged */
+        std::vector<tty_cell_style> live;
+        index.clear();
+        for (size_t i = 0; i < styles.size(); i++) {
+            if (remap[i] == UINT_MAX) continue;
+            remap[i] = (uint)live.size();
+            index.insert({styles[i], remap[i]});
+            live.push_back(styles[i]);
+        }
+        for (tty_teletype_impl *t : terms) t->remap_styles(remap);
+
+        Debug("tty_cell_style_table: compacted %zu styles to %zu\n",
+            styles.size(), live.size());
+        styles.swap(live);
+        limit = std::max(styles.size() * 2, (size_t)style_limit);
+    }
+};
+
+static tty_cell_style_table& tty_cell_styles()
+{
+    static tty_cell_style_table table;
+    return table;
+}
+
+uint tty_cell_style_intern(tty_cell_style s)
+{
+    return tty_cell_styles().intern(s);
+}
+
+tty_cell_style tty_cell_style_get(uint style)
+{
+    tty_cell_style_table &table = tty_cell_styles();
+    return style < table.styles.size() ? table.styles[style] : table.styles[0];
+}
+
 static tty_private_mode_rec dec_flags[] = {
     {    1, tty_flag_DECCKM,     "app_cursor_keys"        },
     {    7, tty_flag_DECAWM,     "auto_wrap"              },
@@ -394,15 +546,21 @@ tty_teletype_impl::tty_teletype_impl() :
     out_start(0),
     out_end(0),
     tmpl{},
+    tmpl_style(tty_cell_style_none),
     hist(),
+    alt(),
     empty_line{},
     sel{null_cell_ref, null_cell_ref},
+    sel_mode(tty_select_linear),
     ws{0,0,0,0},
     cur_line(0),
     cur_offset(0),
     cur_overflow(0),
-    sav_row(0),
-    sav_col(0),
+    sav_line(0),
+    sav_offset(0),
+    sav_overflow(0),
+    sav_row{0, 0},
+    sav_col{0, 0},
     min_line(0),
     max_cols(0),
     top_marg(0),
@@ -412,6 +570,13 @@ tty_teletype_impl::tty_teletype_impl() :
 {
     in_buf.resize(io_buffer_size);
     out_buf.resize(io_buffer_size);
+    tty_cell_styles().terms.push_back(this);
+}
+
+tty_teletype_impl::~tty_teletype_impl()
+{
+    std::vector<tty_teletype_impl*> &terms = tty_cell_styles().terms;
+    terms.erase(std::remove(terms.begin(), terms.end(), this), terms.end());
 }
 
 tty_teletype* tty_new()
@@ -419,6 +584,46 @@ tty_teletype* tty_new()
     return new tty_teletype_impl();
 }
 
+/*
+ * styles are marked from the packed cells of each line rather than the
+ * whole cells vector, which also holds stale runs from repacked lines.
+ * stale runs are remapped to style none as nothing refers to them.
+ */
+void tty_teletype_impl::mark_styles(std::vector<uint> &remap)
+{
+    auto mark = [&](uint style) {
+        if (style < remap.size()) remap[style] = 0;
+    };
+    for (tty_packed_line &pline : hist.lines) {
+        llong k = tty_int48_get(pline.cell_offset);
+        llong m = tty_int48_get(pline.cell_count);
+        for (llong p = 0; p < m; p++) mark(hist.cells[k + p].style);
+    }
+    for (tty_cached_line &cl : hist.cache) {
+        for (tty_cell &cell : cl.ldata.cells) mark(cell.style);
+    }
+    for (tty_cell &cell : alt.cells) mark(cell.style);
+    for (tty_cell &cell : alt.line.cells) mark(cell.style);
+    for (tty_cell &cell : empty_line.cells) mark(cell.style);
+    mark(tmpl_style);
+}
+
+void tty_teletype_impl::remap_styles(const std::vector<uint> &remap)
+{
+    auto map = [&](uint &style) {
+        style = style < remap.size() && remap[style] != UINT_MAX
+            ? remap[style] : (uint)tty_cell_style_none;
+    };
+    for (tty_cell &cell : hist.cells) map(cell.style);
+    for (tty_cached_line &cl : hist.cache) {
+        for (tty_cell &cell : cl.ldata.cells) map(cell.style);
+    }
+    for (tty_cell &cell : alt.cells) map(cell.style);
+    for (tty_cell &cell : alt.line.cells) map(cell.style);
+    for (tty_cell &cell : empty_line.cells) map(cell.style);
+    map(tmpl_style);
+}
+
 void tty_teletype_impl::close()
 {
     ::close(fd);
@@ -507,8 +712,8 @@ void tty_teletype_impl::send(uint c)
 
 /*
  * - unpacked lines: cells vector has one element for every character and
- *   each cell has a utf32 codepoint. style flags, foreground and background
- *   colors. the cell count for the line is in cells.size().
+ *   each cell has a utf32 codepoint and a style index. the cell count for
+ *   the line is in cells.size().
  * - packed lines: cells vector holds style changes. the codepoint element
  *   contains an offset into utf8_data and the cell count is in pcount.
  */
@@ -534,8 +739,8 @@ tty_packed_line tty_line_store::pack(tty_line &uline)
         llong l = utf32_to_utf8(u, sizeof(u), s.codepoint);
         llong o = text.size(), p = o - toff;
         assert(p < (1ull << 32));
-        if (s.flags != t.flags || s.fg != t.fg || s.bg != t.bg) {
-            t = tty_cell{(uint)p, s.flags, s.fg, s.bg};
+        if (s.style != t.style) {
+            t = tty_cell{(uint)p, s.style};
             cells.push_back(t);
             ccount++;
         }
@@ -571,7 +776,7 @@ tty_line tty_line_store::unpack(tty_packed_line &pline)
             p++;
         }
         utf32_code v = utf8_to_utf32_code(&text[j + o]);
-        uline.cells.push_back(tty_cell{(uint)v.code, t.flags, t.fg, t.bg});
+        uline.cells.push_back(tty_cell{(uint)v.code, t.style});
         o += v.len;
     }
 
@@ -625,6 +830,58 @@ llong tty_line_store::count_cells(llong lline)
     }
 }
 
+llong tty_line_store::text_size(llong lline)
+{
+    llong cl = lline & (line_cache_size - 1);
+
+    if (tty_int48_get(cache[cl].lline) == lline && cache[cl].dirty) {
+        return cache[cl].ldata.cells.size() * 4;
+    } else {
+        return tty_int48_get(lines[lline].text_count);
+    }
+}
+
+/*
+ * copy utf-8 text for cells start to end (exclusive) to emit, returning
+ * the offset of the cell following the last cell copied. packed lines are
+ * copied directly from the text store in spans without unpacking cells.
+ */
+llong tty_line_store::copy_text(llong lline, llong start, llong end,
+    std::function<void(const char*,size_t)> emit)
+{
+    llong cl = lline & (line_cache_size - 1);
+    llong i = 0;
+
+    if (tty_int48_get(cache[cl].lline) == lline && cache[cl].dirty) {
+        /* edited lines in the cache have not been packed yet */
+        std::vector<tty_cell> &cells = cache[cl].ldata.cells;
+        char buf[256];
+        size_t len = 0;
+        i = std::min(start, (llong)cells.size());
+        for (; i < end && i < (llong)cells.size(); i++) {
+            if (len + 8 > sizeof(buf)) {
+                emit(buf, len);
+                len = 0;
+            }
+            len += utf32_to_utf8(buf + len, 8, cells[i].codepoint);
+        }
+        if (len > 0) emit(buf, len);
+    } else {
+        tty_packed_line &pline = lines[lline];
+        const char *t = text.data() + tty_int48_get(pline.text_offset);
+        llong c = tty_int48_get(pline.text_count), o = 0, so;
+        for (; o < c && i < start; i++) {
+            o += utf8_codelen(t + o);
+        }
+        for (so = o; o < c && i < end; i++) {
+            o += utf8_codelen(t + o);
+        }
+        if (o > so) emit(t + so, o - so);
+    }
+
+    return i;
+}
+
 void tty_line_store::clear_line(llong lline)
 {
     llong cl = lline & (line_cache_size - 1);
@@ -739,12 +996,482 @@ void tty_line_store::dump_stats()
     Info("tty_line_store.total       = %14s (%9zu)\n", "", total);
 }
 
+/*
+ * history files hold the packed line store in four sections: lines,
+ * cells, text and the cell style table. style indices are remapped when
+ * loading as they are only valid within a process. sections start at aligned offsets after a fixed header
+ * so uncompressed sections are copied straight out of the file mapping,
+ * and compressed sections are decoded directly into the store vectors.
+ * cached lines are discarded and the wrap index is rebuilt on demand.
+ */
+
+static const char tty_history_magic[8] = { 'c','u','t','t','y','h','s','t' };
+static const uint tty_history_version = 2;
+static const uint tty_history_endian = 0x01020304;
+static const size_t tty_history_align = 16;
+
+enum tty_history_sect
+{
+    tty_sect_lines, tty_sect_cells, tty_sect_text, tty_sect_styles, tty_sect_count
+};
+
+struct tty_history_section
+{
+    ullong offset;
+    ullong count;
+    ullong size;
+};
+
+struct tty_history_header
+{
+    char magic[8];
+    uint version;
+    uint endian;
+    uint codec;
+    ushort line_size;
+    ushort cell_size;
+    tty_history_section sect[tty_sect_count];
+};
+
+static bool write_section(FILE *f, const void *buf, size_t len,
+    tty_history_codec codec, ullong *size)
+{
+    std::vector<uchar> out(io_buffer_size);
+    const uchar *in = (const uchar*)buf;
+    size_t written = 0;
+
+    switch (codec) {
+    case tty_history_none:
+        if (len > 0 && fwrite(in, 1, len, f) != len) return false;
+        written = len;
+        break;
+    case tty_history_zlib: {
+        z_stream zs = {};
+        if (deflateInit(&zs, Z_DEFAULT_COMPRESSION) != Z_OK) return false;
+        size_t rem = len;
+        int ret, flush;
+        do {
+            uInt chunk = (uInt)std::min(rem, (size_t)UINT_MAX);
+            zs.next_in = (Bytef*)in;
+            zs.avail_in = chunk;
+            in += chunk;
+            rem -= chunk;
+            flush = rem == 0 ? Z_FINISH : Z_NO_FLUSH;
+            do {
+                zs.next_out = out.data();
+                zs.avail_out = (uInt)out.size();
+                ret = deflate(&zs, flush);
+                size_t n = out.size() - zs.avail_out;
+                if (n > 0 && fwrite(out.data(), 1, n, f) != n) ret = Z_ERRNO;
+                written += n;
+            } while (ret == Z_OK && zs.avail_out == 0);
+        } while (ret == Z_OK && flush != Z_FINISH);
+        deflateEnd(&zs);
+        if (ret != Z_STREAM_END) return false;
+        break;
+    }
+    case tty_history_brotli: {
+        BrotliEncoderState *s = BrotliEncoderCreateInstance(NULL, NULL, NULL);
+        if (!s) return false;
+        BrotliEncoderSetParameter(s, BROTLI_PARAM_QUALITY, 5);
+        BrotliEncoderSetParameter(s, BROTLI_PARAM_SIZE_HINT, (uint32_t)
+            std::min(len, (size_t)(1u << 30)));
+        size_t avail_in = len;
+        const uint8_t *next_in = in;
+        bool ok = true;
+        do {
+            size_t avail_out = out.size();
+            uint8_t *next_out = out.data();
+            ok = BrotliEncoderCompressStream(s, BROTLI_OPERATION_FINISH,
+                &avail_in, &next_in, &avail_out, &next_out, NULL);
+            size_t n = out.size() - avail_out;
+            if (n > 0 && fwrite(out.data(), 1, n, f) != n) ok = false;
+            written += n;
+        } while (ok && !BrotliEncoderIsFinished(s));
+        BrotliEncoderDestroyInstance(s);
+        if (!ok) return false;
+        break;
+    }
+    }
+
+    /* pad so the following section starts aligned */
+    static const char zero[tty_history_align] = {};
+    size_t pad = -(size_t)ftell(f) & (tty_history_align - 1);
+    if (pad > 0 && fwrite(zero, 1, pad, f) != pad) return false;
+
+    *size = written;
+    return true;
+}
+
+/*
+ * sections are decoded straight into vectors sized from the section
+ * count. uncompressed sections must match that size exactly and are
+ * copied once out of the mapping. deflate can't expand data by more
+ * than 1032:1, so a zlib section declaring more is rejected before we
+ * allocate. brotli has no useful bound, so its vector grows with the
+ * decoded data up to the declared size.
+ */
+template <typename T>
+static bool read_section(const uchar *base, tty_history_section &sect,
+    tty_history_codec codec, std::vector<T> &out)
+{
+    const uchar *in = base + sect.offset;
+
+    if (sect.count > SIZE_MAX / sizeof(T)) return false;
+    size_t len = sect.count * sizeof(T);
+
+    switch (codec) {
+    case tty_history_none:
+        if (sect.size != len) return false;
+        out.resize(sect.count);
+        if (len > 0) memcpy(out.data(), in, len);
+        return true;
+    case tty_history_zlib: {
+        if (len / 1032 > sect.size) return false;
+        out.resize(sect.count);
+        uchar empty;
+        z_stream zs = {};
+        if (inflateInit(&zs) != Z_OK) return false;
+        size_t rem_in = sect.size, rem_out = len;
+        int ret;
+        zs.next_in = (Bytef*)in;
+        zs.next_out = len > 0 ? (Bytef*)out.data() : &empty;
+        do {
+            if (zs.avail_in == 0) {
+                zs.avail_in = (uInt)std::min(rem_in, (size_t)UINT_MAX);
+                rem_in -= zs.avail_in;
+            }
+            if (zs.avail_out == 0) {
+                zs.avail_out = (uInt)std::min(rem_out, (size_t)UINT_MAX);
+                rem_out -= zs.avail_out;
+            }
+            ret = inflate(&zs, Z_NO_FLUSH);
+        } while (ret == Z_OK);
+        inflateEnd(&zs);
+        return ret == Z_STREAM_END && rem_out == 0 && zs.avail_out == 0;
+    }
+    case tty_history_brotli: {
+        BrotliDecoderState *bs = BrotliDecoderCreateInstance(NULL, NULL, NULL);
+        if (!bs) return false;
+        size_t avail_in = sect.size, avail_out = 0, done = 0;
+        const uint8_t *next_in = in;
+        uint8_t *next_out = nullptr;
+        BrotliDecoderResult ret;
+        do {
+            if (avail_out == 0 && done < len) {
+                /* grow the output geometrically up to the declared size */
+                size_t count = std::min((size_t)sect.count, std::max(
+                    out.size() * 2, (io_buffer_size + sizeof(T) - 1) / sizeof(T)));
+                out.resize(count);
+                next_out = (uint8_t*)out.data() + done;
+                avail_out = count * sizeof(T) - done;
+            }
+            ret = BrotliDecoderDecompressStream(bs, &avail_in, &next_in,
+                &avail_out, &next_out, NULL);
+            done = next_out ? next_out - (uint8_t*)out.data() : 0;
+        } while (ret == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT && done < len);
+        BrotliDecoderDestroyInstance(bs);
+        return ret == BROTLI_DECODER_RESULT_SUCCESS && done == len;
+    }
+    }
+
+    return false;
+}
+
+bool tty_line_store::save(const char *path, tty_history_codec codec)
+{
+    FILE *f;
+    tty_history_header hdr = {};
+
+    /* pack edited lines so the store is complete */
+    invalidate_cache();
+
+    if ((f = fopen(path, "wb")) == nullptr) {
+        Error("tty_line_store::save: fopen: %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    memcpy(hdr.magic, tty_history_magic, sizeof(hdr.magic));
+    hdr.version = tty_history_version;
+    hdr.endian = tty_history_endian;
+    hdr.codec = codec;
+    hdr.line_size = sizeof(tty_packed_line);
+    hdr.cell_size = sizeof(tty_cell);
+    hdr.sect[tty_sect_lines].count = lines.size();
+    hdr.sect[tty_sect_cells].count = cells.size();
+    hdr.sect[tty_sect_text].count = text.size();
+
+    std::vector<tty_cell_style> &styles = tty_cell_styles().styles;
+    hdr.sect[tty_sect_styles].count = styles.size();
+
+    const void *data[tty_sect_count] = {
+        lines.data(), cells.data(), text.data(), styles.data()
+    };
+    size_t len[tty_sect_count] = {
+        lines.size() * sizeof(tty_packed_line),
+        cells.size() * sizeof(tty_cell),
+        text.size() * sizeof(char),
+        styles.size() * sizeof(tty_cell_style)
+    };
+
+    bool ok = fwrite(&hdr, 1, sizeof(hdr), f) == sizeof(hdr) &&
+        fseek(f, (sizeof(hdr) + tty_history_align - 1) &
+            ~(tty_history_align - 1), SEEK_SET) == 0;
+    for (size_t i = 0; ok && i < tty_sect_count; i++) {
+        hdr.sect[i].offset = ftell(f);
+        ok = write_section(f, data[i], len[i], codec, &hdr.sect[i].size);
+    }
+    ok = ok && fseek(f, 0, SEEK_SET) == 0 &&
+        fwrite(&hdr, 1, sizeof(hdr), f) == sizeof(hdr);
+    ok = (fclose(f) == 0) && ok;
+
+    if (!ok) {
+        Error("tty_line_store::save: %s: write failed\n", path);
+        return false;
+    }
+
+    Debug("tty_line_store::save: %s: lines=%zu cells=%zu text=%zu\n",
+        path, lines.size(), cells.size(), text.size());
+
+    return true;
+}
+
+bool tty_line_store::load(const char *path)
+{
+    int fd;
+    struct stat st;
+    void *addr;
+    tty_history_header hdr;
+
+    if ((fd = ::open(path, O_RDONLY)) < 0) {
+        Error("tty_line_store::load: open: %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(hdr)) {
+        Error("tty_line_store::load: %s: truncated header\n", path);
+        ::close(fd);
+        return false;
+    }
+    addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        Error("tty_line_store::load: mmap: %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    const uchar *base = (const uchar*)addr;
+    memcpy(&hdr, base, sizeof(hdr));
+
+    bool ok = memcmp(hdr.magic, tty_history_magic, sizeof(hdr.magic)) == 0 &&
+        hdr.version == tty_history_version &&
+        hdr.endian == tty_history_endian &&
+        hdr.codec <= tty_history_brotli &&
+        hdr.line_size == sizeof(tty_packed_line) &&
+        hdr.cell_size == sizeof(tty_cell) &&
+        hdr.sect[tty_sect_lines].count > 0;
+    for (size_t i = 0; ok && i < tty_sect_count; i++) {
+        ok = hdr.sect[i].offset <= (ullong)st.st_size &&
+             hdr.sect[i].size <= (ullong)st.st_size - hdr.sect[i].offset;
+    }
+    if (!ok) {
+        Error("tty_line_store::load: %s: invalid history file\n", path);
+        munmap(addr, st.st_size);
+        return false;
+    }
+
+    tty_history_codec codec = (tty_history_codec)hdr.codec;
+    std::vector<tty_packed_line> new_lines;
+    std::vector<tty_cell> new_cells;
+    std::vector<char> new_text;
+    std::vector<tty_cell_style> new_styles;
+    ok = read_section(base, hdr.sect[tty_sect_lines], codec, new_lines) &&
+         read_section(base, hdr.sect[tty_sect_cells], codec, new_cells) &&
+         read_section(base, hdr.sect[tty_sect_text], codec, new_text) &&
+         read_section(base, hdr.sect[tty_sect_styles], codec, new_styles);
+    munmap(addr, st.st_size);
+
+    /* reject lines that reference data outside the store */
+    for (size_t i = 0; ok && i < new_lines.size(); i++) {
+        tty_packed_line &pline = new_lines[i];
+        ok = tty_int48_get(pline.text_offset) >= 0 &&
+             tty_int48_get(pline.text_count) >= 0 &&
+             tty_int48_get(pline.cell_offset) >= 0 &&
+             tty_int48_get(pline.cell_count) >= 0 &&
+             tty_int48_get(pline.text_offset) +
+             tty_int48_get(pline.text_count) <= (llong)new_text.size() &&
+             tty_int48_get(pline.cell_offset) +
+             tty_int48_get(pline.cell_count) <= (llong)new_cells.size();
+    }
+
+    /* remap style indices to this process, interning only used styles */
+    std::vector<uint> remap(new_styles.size(), UINT_MAX);
+    for (size_t i = 0; ok && i < new_cells.size(); i++) {
+        uint style = new_cells[i].style;
+        ok = style < remap.size();
+        if (!ok) break;
+        if (remap[style] == UINT_MAX) {
+            remap[style] = tty_cell_style_intern(new_styles[style]);
+        }
+        new_cells[i].style = remap[style];
+    }
+
+    if (!ok) {
+        Error("tty_line_store::load: %s: corrupt history file\n", path);
+        return false;
+    }
+
+    lines = std::move(new_lines);
+    cells = std::move(new_cells);
+    text = std::move(new_text);
+    for (llong cl = 0; cl < line_cache_size; cl++) {
+        cache[cl] = tty_cached_line{ tty_int48_set(-1), false, tty_line{} };
+    }
+    voffsets.clear();
+    loffsets.clear();
+
+    Debug("tty_line_store::load: %s: lines=%zu cells=%zu text=%zu\n",
+        path, lines.size(), cells.size(), text.size());
+
+    return true;
+}
+
+/*
+ * alternate screen grid
+ *
+ * the alternate screen is a fixed size grid with the cells for all rows
+ * held in one contiguous block. rows are addressed through an index so
+ * that scrolling a region rotates row indices instead of moving cells.
+ * there is no packing and no wrap index, and rows are never committed
+ * to the line store, so full screen applications leave history intact.
+ */
+
+static const tty_cell tty_blank_cell = { ' ', tty_cell_style_dfl };
+
+tty_screen_grid::tty_screen_grid()
+    : rows(0), cols(0), cells(), index(), line() {}
+
+void tty_screen_grid::resize(llong new_rows, llong new_cols)
+{
+    std::vector<tty_cell> new_cells(new_rows * new_cols, tty_blank_cell);
+    llong copy_rows = std::min(rows, new_rows);
+    llong copy_cols = std::min(cols, new_cols);
+
+    for (llong r = 0; r < copy_rows; r++) {
+        tty_cell *src = row(r);
+        std::copy(src, src + copy_cols, new_cells.data() + r * new_cols);
+    }
+
+    rows = new_rows;
+    cols = new_cols;
+    cells = std::move(new_cells);
+    index.resize(rows);
+    for (llong r = 0; r < rows; r++) {
+        index[r] = r;
+    }
+}
+
+void tty_screen_grid::erase(llong r, llong start, llong end, tty_cell tmpl)
+{
+    start = std::max(0ll, start);
+    end = std::min(cols, end);
+    if (r < 0 || r >= rows || start >= end) return;
+    std::fill(row(r) + start, row(r) + end, tmpl);
+}
+
+void tty_screen_grid::scroll(llong top, llong bot, llong n, tty_cell tmpl)
+{
+    top = std::max(0ll, top);
+    bot = std::min(rows, bot);
+    if (top >= bot || n == 0) return;
+
+    /* positive n scrolls up and negative n scrolls down */
+    llong count = std::min(std::abs(n), bot - top);
+    if (n > 0) {
+        std::rotate(index.begin() + top, index.begin() + top + count,
+            index.begin() + bot);
+        for (llong r = bot - count; r < bot; r++) erase(r, 0, cols, tmpl);
+    } else {
+        std::rotate(index.begin() + top, index.begin() + bot - count,
+            index.begin() + bot);
+        for (llong r = top; r < top + count; r++) erase(r, 0, cols, tmpl);
+    }
+}
+
+void tty_screen_grid::insert_chars(llong r, llong col, llong n, tty_cell tmpl)
+{
+    if (r < 0 || r >= rows || col < 0 || col >= cols) return;
+    tty_cell *p = row(r);
+    n = std::min(n, cols - col);
+    std::copy_backward(p + col, p + cols - n, p + cols);
+    std::fill(p + col, p + col + n, tmpl);
+}
+
+void tty_screen_grid::delete_chars(llong r, llong col, llong n, tty_cell tmpl)
+{
+    if (r < 0 || r >= rows || col < 0 || col >= cols) return;
+    tty_cell *p = row(r);
+    n = std::min(n, cols - col);
+    std::copy(p + col + n, p + cols, p + col);
+    std::fill(p + cols - n, p + cols, tmpl);
+}
+
+llong tty_screen_grid::count_cells(llong r)
+{
+    if (r < 0 || r >= rows) return 0;
+
+    /* trailing blank cells are not part of the line */
+    tty_cell *p = row(r);
+    llong n = cols;
+    while (n > 0 && memcmp(&p[n - 1], &tty_blank_cell, sizeof(tty_cell)) == 0) {
+        n--;
+    }
+    return n;
+}
+
+llong tty_screen_grid::text_size(llong r)
+{
+    return count_cells(r) * 4;
+}
+
+llong tty_screen_grid::copy_text(llong r, llong start, llong end,
+    std::function<void(const char*,size_t)> emit)
+{
+    llong n = count_cells(r), i = std::max(0ll, std::min(start, n));
+    char buf[256];
+    size_t len = 0;
+
+    for (; i < end && i < n; i++) {
+        if (len + 8 > sizeof(buf)) {
+            emit(buf, len);
+            len = 0;
+        }
+        len += utf32_to_utf8(buf + len, 8, row(r)[i].codepoint);
+    }
+    if (len > 0) emit(buf, len);
+
+    return i;
+}
+
+tty_line& tty_screen_grid::get_line(llong r)
+{
+    llong n = count_cells(r);
+    if (n > 0) {
+        line.cells.assign(row(r), row(r) + n);
+    } else {
+        line.cells.clear();
+    }
+    return line;
+}
+
 void tty_teletype_impl::update_offsets()
 {
     bool wrap_enabled = (flags & tty_flag_DECAWM) > 0;
     size_t cols = ws.vis_cols;
     llong vlstart, vl;
 
+    /* the alternate screen has no wrap index */
+    if (alt_screen()) return;
+
     if (!wrap_enabled) {
         hist.voffsets.clear();
         hist.loffsets.clear();
@@ -794,7 +1521,9 @@ tty_log_loc tty_teletype_impl::visible_to_logical(llong vrow)
 {
     bool wrap_enabled = (flags & tty_flag_DECAWM) > 0;
 
-    if (wrap_enabled) {
+    if (alt_screen()) {
+        return tty_log_loc{ vrow, 0 };
+    } else if (wrap_enabled) {
         if (vrow < 0) {
             return tty_log_loc{ -1, 0 };
         }
@@ -818,7 +1547,9 @@ tty_vis_loc tty_teletype_impl::logical_to_visible(llong lline)
 {
     bool wrap_enabled = (flags & tty_flag_DECAWM) > 0;
 
-    if (wrap_enabled) {
+    if (alt_screen()) {
+        return tty_vis_loc{ lline, 1 };
+    } else if (wrap_enabled) {
         if (lline < 0) {
             return tty_vis_loc{ -1, 0 };
         }
@@ -839,7 +1570,9 @@ tty_vis_loc tty_teletype_impl::logical_to_visible(llong lline)
 
 tty_line& tty_teletype_impl::get_line(llong lline)
 {
-    if (lline >= 0 && lline < hist.lines.size()) {
+    if (alt_screen()) {
+        return lline >= 0 && lline < alt.rows ? alt.get_line(lline) : empty_line;
+    } else if (lline >= 0 && lline < hist.lines.size()) {
         return hist.get_line(lline, false);
     } else {
         return empty_line;
@@ -856,13 +1589,79 @@ tty_cell_span tty_teletype_impl::get_selection()
     return sel;
 }
 
-std::string tty_teletype_impl::get_selected_text()
+void tty_teletype_impl::set_selection_mode(tty_select_mode mode)
+{
+    sel_mode = mode;
+}
+
+tty_select_mode tty_teletype_impl::get_selection_mode()
+{
+    return sel_mode;
+}
+
+llong tty_teletype_impl::selection_size()
 {
     tty_cell_span span = sel;
-    std::string text;
+    llong size = 0;
 
     if (span.start == null_cell_ref && span.end == null_cell_ref) {
-        goto out;
+        return 0;
+    }
+
+    if (sel_mode == tty_select_block) {
+        llong rows = std::abs(span.end.row - span.start.row) + 1;
+        return rows * (std::abs(span.end.col - span.start.col) + 2);
+    }
+
+    if (span.start > span.end) {
+        std::swap(span.start, span.end);
+    }
+
+    llong start = std::max(0ll, span.start.row);
+    llong end = std::min(alt_screen() ? alt.rows - 1
+        : (llong)hist.lines.size() - 1, span.end.row);
+    for (llong lline = start; lline <= end; lline++) {
+        size += (alt_screen() ? alt.text_size(lline)
+            : hist.text_size(lline)) + 1;
+    }
+
+    return size;
+}
+
+void tty_teletype_impl::copy_selection(std::function<void(const char*,size_t)> emit)
+{
+    tty_cell_span span = sel;
+
+    if (span.start == null_cell_ref && span.end == null_cell_ref) {
+        return;
+    }
+
+    llong count = alt_screen() ? alt.rows : (llong)hist.lines.size();
+    auto copy_text = [&](llong lline, llong start, llong end) -> llong {
+        return alt_screen() ? alt.copy_text(lline, start, end, emit)
+            : hist.copy_text(lline, start, end, emit);
+    };
+
+    /*
+     * block selections hold visible rows and columns, so each row is
+     * mapped to its line and the offset of its wrapped segment, with
+     * the columns clipped to the width of the segment when wrapping.
+     */
+    if (sel_mode == tty_select_block) {
+        bool wrapped = !alt_screen() && (flags & tty_flag_DECAWM) > 0;
+        llong row0 = std::min(span.start.row, span.end.row);
+        llong row1 = std::max(span.start.row, span.end.row);
+        llong cols = wrapped ? std::max(1ll, ws.vis_cols) : LLONG_MAX - 1;
+        llong col0 = std::min(cols, std::max(0ll, std::min(span.start.col, span.end.col)));
+        llong col1 = std::min(cols, std::max(span.start.col, span.end.col) + 1);
+        for (llong vrow = row0; vrow <= row1; vrow++) {
+            tty_log_loc loc = visible_to_logical(vrow);
+            if (loc.lline >= 0 && loc.lline < count) {
+                copy_text(loc.lline, loc.loff + col0, loc.loff + col1);
+            }
+            if (vrow != row1) emit("\n", 1);
+        }
+        return;
     }
 
     if (span.start > span.end) {
@@ -870,27 +1669,137 @@ std::string tty_teletype_impl::get_selected_text()
     }
 
     for (llong lline = span.start.row; lline <= span.end.row; lline++) {
-        tty_line line = get_line(lline);
-        llong count = (llong)line.cells.size();
+        if (lline < 0 || lline >= count) continue;
         llong s = std::max(0ll, lline == span.start.row ? span.start.col : 0ll);
-        llong e = std::min(count-1ll, lline == span.end.row ? span.end.col : count-1ll);
-        for (; s <= e; s++) {
-            char u[8];
-            llong o = text.size();
-            llong l = utf32_to_utf8(u, sizeof(u), line.cells[s].codepoint);
-            text.append(u);
+        llong e = lline == span.end.row ? span.end.col + 1 : LLONG_MAX;
+        llong o = copy_text(lline, s, e);
+        if (o >= s && lline != span.end.row) emit("\n", 1);
+    }
+}
+
+bool tty_teletype_impl::alt_screen()
+{
+    return (flags & tty_flag_XTAS) > 0;
+}
+
+/*
+ * switching screens stashes the primary cursor and swaps the active
+ * screen. the alternate grid stays allocated between uses and is only
+ * reallocated when the window size changes.
+ */
+void tty_teletype_impl::switch_screen(bool enable)
+{
+    Trace("switch_screen: %s\n", enable ? "alternate" : "primary");
+
+    if (enable) {
+        update_offsets();
+        llong row = cursor_row() - top_row(), col = cursor_col();
+        llong rows = std::max(1ll, ws.vis_rows), cols = std::max(1ll, ws.vis_cols);
+        if (alt.rows != rows || alt.cols != cols) {
+            alt.resize(rows, cols);
+        }
+        for (llong r = 0; r < alt.rows; r++) {
+            alt.erase(r, 0, alt.cols, tty_blank_cell);
         }
-        if (s == count && lline != span.end.row) text.append("\n");
+        sav_line = cur_line;
+        sav_offset = cur_offset;
+        sav_overflow = cur_overflow;
+        flags |= tty_flag_XTAS;
+        cur_line = std::max(0ll, std::min(row, alt.rows - 1));
+        cur_offset = std::max(0ll, std::min(col, alt.cols - 1));
+        cur_overflow = false;
+    } else {
+        flags &= ~tty_flag_XTAS;
+        cur_line = sav_line;
+        cur_offset = sav_offset;
+        cur_overflow = sav_overflow;
     }
 
-out:
+    sel = { null_cell_ref, null_cell_ref };
+    scr_row = 0;
+    needs_update = 1;
+}
+
+std::string tty_teletype_impl::get_selected_text()
+{
+    std::string text;
+
+    text.reserve(selection_size());
+    copy_selection([&](const char *buf, size_t len) {
+        text.append(buf, len);
+    });
+
     return text;
 }
 
+ssize_t tty_teletype_impl::write_selected_text(int fd)
+{
+    /* stream the selection through a fixed buffer, large or not */
+    std::vector<char> buf(io_buffer_size);
+    size_t len = 0;
+    ssize_t total = 0, ret = 0;
+
+    auto flush = [&]() {
+        size_t off = 0;
+        while (ret >= 0 && off < len) {
+            ssize_t nbytes = ::write(fd, &buf[off], len - off);
+            if (nbytes < 0 && errno == EINTR) continue;
+            if (nbytes < 0) {
+                Error("write_selected_text: write: %s\n", strerror(errno));
+                ret = -1;
+                break;
+            }
+            off += nbytes;
+            total += nbytes;
+        }
+        len = 0;
+    };
+
+    copy_selection([&](const char *data, size_t count) {
+        while (count > 0 && ret >= 0) {
+            size_t ncopy = std::min(count, buf.size() - len);
+            memcpy(&buf[len], data, ncopy);
+            len += ncopy;
+            data += ncopy;
+            count -= ncopy;
+            if (len == buf.size()) flush();
+        }
+    });
+    flush();
+
+    return ret < 0 ? ret : total;
+}
+
+bool tty_teletype_impl::save_history(const char *path, tty_history_codec codec)
+{
+    return hist.save(path, codec);
+}
+
+bool tty_teletype_impl::load_history(const char *path)
+{
+    if (!hist.load(path)) {
+        return false;
+    }
+
+    /* continue on a new line following the restored history */
+    hist.lines.push_back(tty_packed_line{});
+    cur_line = hist.lines.size() - 1;
+    cur_offset = 0;
+    cur_overflow = false;
+    sel = { null_cell_ref, null_cell_ref };
+    min_line = 0;
+    needs_update = 1;
+    tty_cell_styles().compact();
+
+    return true;
+}
+
 llong tty_teletype_impl::total_rows()
 {
     bool wrap_enabled = (flags & tty_flag_DECAWM) > 0;
 
+    if (alt_screen()) return alt.rows;
+
     return wrap_enabled ? hist.voffsets.size() : hist.lines.size();
 }
 
@@ -898,6 +1807,8 @@ llong tty_teletype_impl::total_cols()
 {
     bool wrap_enabled = (flags & tty_flag_DECAWM) > 0;
 
+    if (alt_screen()) return alt.cols;
+
     return wrap_enabled ? ws.vis_cols : std::max(ws.vis_cols, max_cols);
 }
 
@@ -973,11 +1884,15 @@ void tty_teletype_impl::set_scroll_col(llong col)
 
 llong tty_teletype_impl::top_row()
 {
+    if (alt_screen()) return 0;
+
     return (llong)std::max(size_t(ws.vis_rows), hist.voffsets.size()) - ws.vis_rows;
 }
 
 llong tty_teletype_impl::cursor_row()
 {
+    if (alt_screen()) return cur_line;
+
     tty_vis_loc vloc = logical_to_visible(cur_line);
     return vloc.vrow + std::min(vloc.count,
         cur_offset / ws.vis_cols - cur_overflow);
@@ -985,6 +1900,8 @@ llong tty_teletype_impl::cursor_row()
 
 llong tty_teletype_impl::cursor_col()
 {
+    if (alt_screen()) return std::min(cur_offset, alt.cols - 1);
+
     return cur_offset % ws.vis_cols;
 }
 
@@ -995,6 +1912,8 @@ llong tty_teletype_impl::cursor_line()
 
 llong tty_teletype_impl::cursor_offset()
 {
+    if (alt_screen()) return cursor_col();
+
     return cur_offset;
 }
 
@@ -1022,6 +1941,11 @@ void tty_teletype_impl::set_winsize(tty_winsize d)
     if (ws != d) {
         ws = d;
         min_line = 0;
+        if (alt_screen()) {
+            alt.resize(std::max(1ll, ws.vis_rows), std::max(1ll, ws.vis_cols));
+            cur_line = std::min(cur_line, alt.rows - 1);
+            cur_offset = std::min(cur_offset, alt.cols - 1);
+        }
     }
 }
 
@@ -1053,6 +1977,36 @@ void tty_teletype_impl::move(tty_coord row, tty_coord col)
     llong trow;
     llong tcol;
 
+    /*
+     * the alternate screen addresses rows directly, and scrolling at the
+     * bottom of the scroll region rotates rows within the grid
+     */
+    if (alt_screen()) {
+        if (cur_line == scroll_bottom() - 1 &&
+            row.type == coord_type_rel && row.val == 1)
+        {
+            tty_cell blank = { ' ', tmpl_style };
+            alt.scroll(scroll_top() - 1, scroll_bottom(), 1, blank);
+            row = coord_none();
+        }
+        trow = cur_line;
+        tcol = std::min(cur_offset, alt.cols - 1);
+        switch (row.type) {
+        case coord_type_none: break;
+        case coord_type_rel: trow += row.val; break;
+        case coord_type_abs: trow = row.val - 1; break;
+        }
+        switch (col.type) {
+        case coord_type_none: break;
+        case coord_type_rel: tcol += col.val; break;
+        case coord_type_abs: tcol = col.val - 1; break;
+        }
+        cur_line = std::max(0ll, std::min(trow, alt.rows - 1));
+        cur_offset = std::max(0ll, std::min(tcol, alt.cols - 1));
+        cur_overflow = false;
+        return;
+    }
+
     update_offsets();
 
     /*
@@ -1069,12 +2023,19 @@ void tty_teletype_impl::move(tty_coord row, tty_coord col)
         /* as scrolling invalidates the cursor position */
         hist.invalidate_cache();
         if (scroll_top_enabled()) {
+            /* the top line is discarded so rotate within the region */
             tty_log_loc tloc = visible_to_logical(top_row() + scroll_top() - 1);
             tty_log_loc bloc = visible_to_logical(top_row() + scroll_bottom() - 1);
-            hist.lines.insert(hist.lines.begin() + bloc.lline + 1, tty_packed_line{});
-            hist.lines.erase(hist.lines.begin() + tloc.lline);
+            if (bloc.lline >= hist.lines.size()) {
+                hist.lines.resize(bloc.lline + 1);
+            }
+            auto first = hist.lines.begin() + tloc.lline;
+            auto last = hist.lines.begin() + bloc.lline + 1;
+            std::rotate(first, first + 1, last);
+            *(last - 1) = tty_packed_line{};
             min_line = std::min(min_line, tloc.lline);
         } else {
+            /* the top line scrolls into history so only lines below move */
             tty_log_loc bloc = visible_to_logical(top_row() + scroll_bottom() - 1);
             hist.lines.insert(hist.lines.begin() + bloc.lline + 1, tty_packed_line{});
         }
@@ -1155,6 +2116,7 @@ void tty_teletype_impl::reset_style()
     tmpl.flags = 0;
     tmpl.fg = tty_cell_color_fg_dfl;
     tmpl.bg = tty_cell_color_bg_dfl;
+    tmpl_style = tty_cell_style_dfl;
 }
 
 void tty_teletype_impl::set_fd(int fd)
@@ -1175,6 +2137,31 @@ void tty_teletype_impl::erase_screen(uint arg)
 
     llong start, end;
 
+    if (alt_screen()) {
+        tty_cell blank = { ' ', tmpl_style };
+        llong col = cursor_col();
+        switch (arg) {
+        case tty_clear_end:
+            alt.erase(cur_line, col, alt.cols, blank);
+            for (llong r = cur_line + 1; r < alt.rows; r++) {
+                alt.erase(r, 0, alt.cols, blank);
+            }
+            break;
+        case tty_clear_start:
+            for (llong r = 0; r < cur_line; r++) {
+                alt.erase(r, 0, alt.cols, blank);
+            }
+            alt.erase(cur_line, 0, col + 1, blank);
+            break;
+        case tty_clear_all:
+            for (llong r = 0; r < alt.rows; r++) {
+                alt.erase(r, 0, alt.cols, blank);
+            }
+            break;
+        }
+        return;
+    }
+
     switch (arg) {
     case tty_clear_end:
         start = cursor_row();
@@ -1194,7 +2181,7 @@ void tty_teletype_impl::erase_screen(uint arg)
     {
         tty_log_loc lloc = visible_to_logical(row);
         hist.erase_line(lloc.lline, lloc.loff, lloc.loff + ws.vis_cols,
-            ws.vis_cols, tmpl);
+            ws.vis_cols, tty_cell{ 0, tmpl_style });
     }
 }
 
@@ -1204,6 +2191,16 @@ void tty_teletype_impl::erase_line(uint arg)
 
     llong row = cursor_row(), col = cursor_col();
 
+    if (alt_screen()) {
+        tty_cell blank = { ' ', tmpl_style };
+        switch (arg) {
+        case tty_clear_end: alt.erase(row, col, alt.cols, blank); break;
+        case tty_clear_start: alt.erase(row, 0, col + 1, blank); break;
+        case tty_clear_all: alt.erase(row, 0, alt.cols, blank); break;
+        }
+        return;
+    }
+
     if (cur_overflow) return;
 
     auto round_offset = [&](llong offset, llong addend) -> llong {
@@ -1213,15 +2210,15 @@ void tty_teletype_impl::erase_line(uint arg)
     switch (arg) {
     case tty_clear_end:
         hist.erase_line(cur_line, cur_offset,
-            round_offset(cur_offset, ws.vis_cols), ws.vis_cols, tmpl);
+            round_offset(cur_offset, ws.vis_cols), ws.vis_cols, tty_cell{ 0, tmpl_style });
         break;
     case tty_clear_start:
         hist.erase_line(cur_line, round_offset(cur_offset, 0),
-            cur_offset, ws.vis_cols, tmpl);
+            cur_offset, ws.vis_cols, tty_cell{ 0, tmpl_style });
         break;
     case tty_clear_all:
         hist.erase_line(cur_line, round_offset(cur_offset, 0),
-            round_offset(cur_offset, ws.vis_cols), ws.vis_cols, tmpl);
+            round_offset(cur_offset, ws.vis_cols), ws.vis_cols, tty_cell{ 0, tmpl_style });
         break;
     }
 
@@ -1236,16 +2233,29 @@ void tty_teletype_impl::insert_lines(uint arg)
 {
     Trace("insert_lines: %d\n", arg);
     if (arg == 0) return;
+    if (alt_screen()) {
+        if (cur_line < scroll_top() - 1 || cur_line > scroll_bottom() - 1) return;
+        tty_cell blank = { ' ', tmpl_style };
+        alt.scroll(cur_line, scroll_bottom(), -(llong)arg, blank);
+        cur_offset = 0;
+        return;
+    }
     // todo: consider line editing mode: *following*, or preceding
     // todo: handle case where lines are wrapping (parial insert and erase)
     tty_log_loc tloc = visible_to_logical(top_row() + scroll_top() - 1);
     tty_log_loc bloc = visible_to_logical(top_row() + scroll_bottom() - 1);
     if (cur_line < tloc.lline || cur_line > bloc.lline) return;
     hist.invalidate_cache();
-    for (uint i = 0; i < arg; i++) {
-        hist.lines.erase(hist.lines.begin() + bloc.lline);
-        hist.lines.insert(hist.lines.begin() + cur_line, tty_packed_line{});
-    }
+    if (bloc.lline >= hist.lines.size()) {
+        hist.lines.resize(bloc.lline + 1);
+    }
+    /* rotate the region down and clear the lines rotated to the top */
+    llong count = std::min((llong)arg, bloc.lline + 1 - cur_line);
+    auto first = hist.lines.begin() + cur_line;
+    auto last = hist.lines.begin() + bloc.lline + 1;
+    std::rotate(first, last - count, last);
+    std::fill(first, first + count, tty_packed_line{});
+    min_line = std::min(min_line, cur_line);
     cur_offset = 0;
 }
 
@@ -1253,24 +2263,40 @@ void tty_teletype_impl::delete_lines(uint arg)
 {
     Trace("delete_lines: %d\n", arg);
     if (arg == 0) return;
+    if (alt_screen()) {
+        if (cur_line < scroll_top() - 1 || cur_line > scroll_bottom() - 1) return;
+        tty_cell blank = { ' ', tmpl_style };
+        alt.scroll(cur_line, scroll_bottom(), arg, blank);
+        cur_offset = 0;
+        return;
+    }
     // todo: consider line editing mode: *following*, or preceding
     // todo: handle case where lines are wrapping (parial insert and erase)
     tty_log_loc tloc = visible_to_logical(top_row() + scroll_top() - 1);
     tty_log_loc bloc = visible_to_logical(top_row() + scroll_bottom() - 1);
     if (cur_line < tloc.lline || cur_line > bloc.lline) return;
     hist.invalidate_cache();
-    for (uint i = 0; i < arg; i++) {
-        if (cur_line < hist.lines.size()) {
-            hist.lines.erase(hist.lines.begin() + cur_line);
-            hist.lines.insert(hist.lines.begin() + bloc.lline, tty_packed_line{});
-        }
-    }
+    if (bloc.lline >= hist.lines.size()) {
+        hist.lines.resize(bloc.lline + 1);
+    }
+    /* rotate the region up and clear the lines rotated to the bottom */
+    llong count = std::min((llong)arg, bloc.lline + 1 - cur_line);
+    auto first = hist.lines.begin() + cur_line;
+    auto last = hist.lines.begin() + bloc.lline + 1;
+    std::rotate(first, first + count, last);
+    std::fill(last - count, last, tty_packed_line{});
+    min_line = std::min(min_line, cur_line);
     cur_offset = 0;
 }
 
 void tty_teletype_impl::delete_chars(uint arg)
 {
     Trace("delete_chars: %d\n", arg);
+    if (alt_screen()) {
+        tty_cell blank = { ' ', tmpl_style };
+        alt.delete_chars(cur_line, cursor_col(), arg, blank);
+        return;
+    }
     for (size_t i = 0; i < arg; i++) {
         if (cur_offset < hist.count_cells(cur_line)) {
             tty_line &line = hist.get_line(cur_line, true);
@@ -1284,6 +2310,11 @@ void tty_teletype_impl::delete_chars(uint arg)
 void tty_teletype_impl::handle_scroll()
 {
     Trace("handle_scroll\n");
+    if (alt_screen() && cur_line == scroll_top() - 1) {
+        tty_cell blank = { ' ', tmpl_style };
+        alt.scroll(scroll_top() - 1, scroll_bottom(), -1, blank);
+        return;
+    }
     if (cursor_row() == top_row())
     {
         llong row = cursor_row(), col = cursor_col();
@@ -1308,16 +2339,26 @@ void tty_teletype_impl::handle_scroll_region(llong line0, llong line1)
 void tty_teletype_impl::handle_save_cursor()
 {
     Trace("handle_save_cursor\n");
-    sav_row = cursor_row();
-    sav_col = cursor_col();
+    /* each screen has its own position, relative to the top of the screen */
+    llong s = alt_screen();
+    sav_row[s] = cursor_row() - top_row();
+    sav_col[s] = cursor_col();
 }
 
 void tty_teletype_impl::handle_restore_cursor()
 {
     Trace("handle_restore_cursor\n");
-    tty_log_loc lloc = visible_to_logical(sav_row);
+    if (alt_screen()) {
+        cur_line = std::max(0ll, std::min(sav_row[1], alt.rows - 1));
+        cur_offset = std::max(0ll, std::min(sav_col[1], alt.cols - 1));
+        cur_overflow = false;
+        return;
+    }
+    llong row = std::max(0ll, std::min(sav_row[0], ws.vis_rows - 1));
+    llong col = std::max(0ll, std::min(sav_col[0], ws.vis_cols - 1));
+    tty_log_loc lloc = visible_to_logical(top_row() + row);
     cur_line = lloc.lline;
-    cur_offset = lloc.loff + sav_col;
+    cur_offset = lloc.loff + col;
     min_line = std::min(min_line, cur_line);
 }
 
@@ -1352,6 +2393,20 @@ void tty_teletype_impl::handle_carriage_return()
 
 void tty_teletype_impl::handle_bare(uint c)
 {
+    /* wrap or overwrite the last column on the alternate screen */
+    if (alt_screen()) {
+        if (cur_offset >= alt.cols) {
+            if ((flags & tty_flag_DECAWM) > 0) {
+                move(coord_rel(1), coord_abs(1));
+            } else {
+                cur_offset = alt.cols - 1;
+            }
+        }
+        alt.row(cur_line)[cur_offset++] =
+            tty_cell{c, tmpl_style};
+        return;
+    }
+
     /* join with next line if we wrap */
     if (cur_offset >= ws.vis_cols &&
         cur_offset % ws.vis_cols == 0 &&
@@ -1375,7 +2430,7 @@ void tty_teletype_impl::handle_bare(uint c)
         line.cells.resize(cur_offset + 1);
     }
     line.cells[cur_offset++] =
-        tty_cell{c, tmpl.flags, tmpl.fg, tmpl.bg};
+        tty_cell{c, tmpl_style};
 
     cur_overflow = cur_offset % ws.vis_cols == 0;
 }
@@ -1452,10 +2507,22 @@ void tty_teletype_impl::handle_csi_private_mode(uint code, uint set)
     } else {
         Trace("handle_csi_private_mode: flag %d: %s = %s\n",
             code, rec->name, set ? "enabled" : "disabled");
+        uint flag = rec->flag & ~tty_flag_XTAS;
+        /* 1049 keeps the primary cursor in switch_screen, apart from DECSC */
+        bool save = (flag & tty_flag_XTSC) && !(rec->flag & tty_flag_XTAS);
+        if (set && save) {
+            handle_save_cursor();
+        }
+        if ((rec->flag & tty_flag_XTAS) && alt_screen() != (set != 0)) {
+            switch_screen(set);
+        }
         if (set) {
-            flags |= rec->flag;
+            flags |= flag;
         } else {
-            flags &= ~rec->flag;
+            flags &= ~flag;
+        }
+        if (!set && save) {
+            handle_restore_cursor();
         }
     }
 }
@@ -1499,7 +2566,7 @@ void tty_teletype_impl::handle_csi_dsr()
     case 6: { /* report cursor position */
         char buf[32];
         update_offsets();
-        llong col = (cur_offset % ws.vis_cols) + 1;
+        llong col = cursor_col() + 1;
         llong row = (cursor_row() - top_row()) + 1;
         row = std::max(1ll, std::min(row, (llong)ws.vis_rows));
         col = std::max(1ll, std::min(col, (llong)ws.vis_cols));
@@ -1521,11 +2588,14 @@ void tty_teletype_impl::handle_csi(uint c)
     switch (c) {
     case '@': /* insert blanks */
     {
-        tty_line &line = hist.get_line(cur_line, true);
         int n = opt_arg(0, 0);
+        tty_cell cell = { ' ', tmpl_style };
+        if (alt_screen()) {
+            alt.insert_chars(cur_line, cursor_col(), n, cell);
+            break;
+        }
+        tty_line &line = hist.get_line(cur_line, true);
         if (cur_offset < line.cells.size()) {
-            tty_cell cell = tmpl;
-            cell.codepoint = ' ';
             for (size_t i = 0; i < n; i++) {
                 line.cells.insert(line.cells.begin() + cur_offset, cell);
             }
@@ -1690,6 +2760,7 @@ void tty_teletype_impl::handle_csi(uint c)
                 break;
             }
         }
+        tmpl_style = tty_cell_style_intern(tmpl);
         break;
     case 'n': /* device status report */
         handle_csi_dsr();
@@ -1732,8 +2803,10 @@ restart:
             } else {
                 handle_bare(c);
             }
-            tty_line &line = hist.get_line(cur_line, true);
-            memcpy(&line.tv, &tv, sizeof(tv));
+            if (!alt_screen()) {
+                tty_line &line = hist.get_line(cur_line, true);
+                memcpy(&line.tv, &tv, sizeof(tv));
+            }
         }
         break;
     case tty_state_utf4:
@@ -2111,6 +3184,7 @@ ssize_t tty_teletype_impl::proc()
         if (debug_io) {
             Trace("proc: absorbed %zu bytes of input\n", count);
         }
+        tty_cell_styles().compact();
     }
     return count;
 }
@@ -2181,6 +3255,20 @@ static std::string translate_string(tty_translate_result r)
         return std::string("copy");
     case tty_oper_paste:
         return std::string("paste");
+    case tty_oper_new_window:
+        return std::string("new_window");
+    case tty_oper_new_tab:
+        return std::string("new_tab");
+    case tty_oper_next_tab:
+        return std::string("next_tab");
+    case tty_oper_split_right:
+        return std::string("split_right");
+    case tty_oper_split_down:
+        return std::string("split_down");
+    case tty_oper_next_pane:
+        return std::string("next_pane");
+    case tty_oper_pipe:
+        return std::string("pipe");
     }
 
     return "invalid";
@@ -2212,6 +3300,15 @@ bool tty_teletype_impl::keyboard(int key, int scancode, int action, int mods)
             emit_loop(str, strlen(str));
             if (has_flag(tty_flag_XTBP)) emit("\x1b[200~", 6);
             return true;
+        case tty_oper_new_window:
+        case tty_oper_new_tab:
+        case tty_oper_next_tab:
+        case tty_oper_split_right:
+        case tty_oper_split_down:
+        case tty_oper_next_pane:
+        case tty_oper_pipe:
+            app_window_oper(r.oper);
+            return false;
         }
         break;
     }
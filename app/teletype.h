@@ -51,14 +51,32 @@ enum tty_charset
     tty_charset_iso8859_1    = 1,
 };
 
-struct tty_cell
+enum tty_cell_style_id
+{
+    tty_cell_style_none       = 0,
+    tty_cell_style_dfl        = 1,
+};
+
+struct tty_cell_style
 {
-    uint codepoint;
     uint flags;
     uint fg;
     uint bg;
 };
 
+/*
+ * cells hold a codepoint and an index into the interned style table.
+ * style 0 has zero flags and colors and style 1 is the default style.
+ */
+struct tty_cell
+{
+    uint codepoint;
+    uint style;
+};
+
+uint tty_cell_style_intern(tty_cell_style s);
+tty_cell_style tty_cell_style_get(uint style);
+
 struct tty_line
 {
     std::vector<tty_cell> cells;
@@ -68,6 +86,19 @@ struct tty_line
 struct tty_cell_ref { llong row; llong col; };
 struct tty_cell_span { tty_cell_ref start, end; };
 
+enum tty_select_mode
+{
+    tty_select_linear,
+    tty_select_block
+};
+
+enum tty_history_codec
+{
+    tty_history_none,
+    tty_history_zlib,
+    tty_history_brotli
+};
+
 static const tty_cell_ref null_cell_ref = { INT_MIN, INT_MIN };
 
 inline bool operator< (const tty_cell_ref &a, const tty_cell_ref &b)
@@ -154,8 +185,8 @@ enum tty_flag
     tty_flag_DECBKM   = (1 << 4),   // [X] DEC Backarrow Sends Delete Mode
     tty_flag_ATTBC    = (1 << 5),   // [ ] AT&T Blinking Cursor
     tty_flag_XT8BM    = (1 << 6),   // [ ] XTerm 8-Bit Mode
-    tty_flag_XTAS     = (1 << 7),   // [ ] XTerm Alt Screen
-    tty_flag_XTSC     = (1 << 8),   // [ ] XTerm Save Cursor
+    tty_flag_XTAS     = (1 << 7),   // [X] XTerm Alt Screen
+    tty_flag_XTSC     = (1 << 8),   // [X] XTerm Save Cursor
     tty_flag_XTBP     = (1 << 9),   // [X] XTerm Bracketed Paste
     tty_flag_CUTSC    = (1 << 10),  // [X] Cutty Screen Capture
 };
@@ -208,7 +239,12 @@ struct tty_teletype
     virtual tty_line& get_line(llong lline) = 0;
     virtual void set_selection(tty_cell_span selection) = 0;
     virtual tty_cell_span get_selection() = 0;
+    virtual void set_selection_mode(tty_select_mode mode) = 0;
+    virtual tty_select_mode get_selection_mode() = 0;
     virtual std::string get_selected_text() = 0;
+    virtual ssize_t write_selected_text(int fd) = 0;
+    virtual bool save_history(const char *path, tty_history_codec codec) = 0;
+    virtual bool load_history(const char *path) = 0;
     virtual llong total_rows() = 0;
     virtual llong total_cols() = 0;
     virtual llong visible_rows() = 0;
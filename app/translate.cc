@@ -60,6 +60,13 @@ static tty_symbol static_symbol_table[] =
     { tty_sym_oper,  tty_oper_emit,         "emit"                      },
     { tty_sym_oper,  tty_oper_copy,         "copy"                      },
     { tty_sym_oper,  tty_oper_paste,        "paste"                     },
+    { tty_sym_oper,  tty_oper_new_window,   "new_window"                },
+    { tty_sym_oper,  tty_oper_new_tab,      "new_tab"                   },
+    { tty_sym_oper,  tty_oper_next_tab,     "next_tab"                  },
+    { tty_sym_oper,  tty_oper_split_right,  "split_right"               },
+    { tty_sym_oper,  tty_oper_split_down,   "split_down"                },
+    { tty_sym_oper,  tty_oper_next_pane,    "next_pane"                 },
+    { tty_sym_oper,  tty_oper_pipe,         "pipe"                      },
 
     /* modifers */
     { tty_sym_mod,   tty_mod_shift,         "shift"                     },
@@ -643,6 +650,8 @@ bool tty_keymap::check(size_t idx, std::vector<tty_keypress> seq, int flags)
                 s = s_done;
             } else if (sym.type == tty_sym_oper && sym.symbol == tty_oper_paste) {
                 s = s_done;
+            } else if (sym.type == tty_sym_oper && tty_oper_window(sym.symbol)) {
+                s = s_done;
             } else {
                 Error("keymap check clause=%zu state=%s unexpected symbol %s\n",
                     idx, state_names[s], sym.qualified_name().c_str());
@@ -701,6 +710,8 @@ tty_translate_result tty_keymap::translate(size_t clause_idx)
             return { tty_oper_copy, std::string() };
         } else if (sym.type == tty_sym_oper && sym.symbol == tty_oper_paste) {
             return { tty_oper_paste, std::string() };
+        } else if (sym.type == tty_sym_oper && tty_oper_window(sym.symbol)) {
+            return { (tty_oper)sym.symbol, std::string() };
         } else if (sym.type == tty_sym_oper && sym.symbol == tty_oper_emit) {
             found_emit = true;
         } else if (found_emit) {
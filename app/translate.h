@@ -31,8 +31,21 @@ enum tty_oper
     tty_oper_emit              = 4,
     tty_oper_copy              = 5,
     tty_oper_paste             = 6,
+    tty_oper_new_window        = 7,
+    tty_oper_new_tab           = 8,
+    tty_oper_next_tab          = 9,
+    tty_oper_split_right       = 10,
+    tty_oper_split_down        = 11,
+    tty_oper_next_pane         = 12,
+    tty_oper_pipe              = 13,
 };
 
+/* operators handled by the window rather than the terminal */
+inline bool tty_oper_window(uint oper)
+{
+    return oper >= tty_oper_new_window && oper <= tty_oper_pipe;
+}
+
 enum tty_mod
 {
     tty_mod_shift              = 0x1,
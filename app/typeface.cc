@@ -2,6 +2,7 @@
 #include <cstring>
 #include <cerrno>
 #include <climits>
+#include <cmath>
 
 #include <functional>
 #include <algorithm>
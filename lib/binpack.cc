@@ -429,8 +429,8 @@ std::vector<bin_rect> bin_rect::disjoint_subset(bin_rect o)
  * bin_packer
  */
 
-bin_packer::bin_packer(bin_point sz) :
-    total(bin_rect(bin_point(),sz))
+bin_packer::bin_packer(bin_point sz, bool shelf_enabled) :
+    total(bin_rect(bin_point(),sz)), shelf_enabled(shelf_enabled)
 {
     reset();
 }
@@ -439,6 +439,7 @@ void bin_packer::reset()
 {
     contained_min = 0;
     alloc_map.clear();
+    shelf_map.clear();
     free_list.clear();
     free_list.push_back(total);
 }
@@ -455,46 +456,52 @@ void bin_packer::split_intersecting_nodes(bin_rect b)
      * split nodes that overlap found rectangle
      *
      * checks every free rectangle against the chosen rectangle and
-     * split it up if it intersects. this pass has O(n) complexity
+     * split it up if it intersects. this pass has O(n) complexity.
+     * split nodes are appended at the end and contained_min is set
+     * to the first one so only these need containment tests.
      */
+    std::vector<bin_rect> split;
     for (size_t i = 0; i < free_list.size();) {
         bin_rect c = free_list[i];
         if (c.intersects(b)) {
             std::vector<bin_rect> l = c.disjoint_subset(b);
-            free_list.erase(free_list.begin() + i);
-            std::copy(l.begin(), l.end(), std::back_inserter(free_list));
-            /* invalidate learned lower bound on contained tests */
-            contained_min = std::min(contained_min,i);
+            std::copy(l.begin(), l.end(), std::back_inserter(split));
+            free_list[i] = free_list.back();
+            free_list.pop_back();
         } else {
             i++;
         }
-    }    
+    }
+    contained_min = free_list.size();
+    std::copy(split.begin(), split.end(), std::back_inserter(free_list));
 }
 
 void bin_packer::remove_containing_nodes()
 {
-    /* remove nodes contained by other nodes */
+    /*
+     * remove nodes contained by other nodes
+     *
+     * nodes below contained_min are maximal and can't contain each
+     * other, and a split node can't contain one of them because it is
+     * a subset of the node it was split from, so we only test the split
+     * nodes against every node. this pass has O(n*k) complexity.
+     */
     size_t i = contained_min;
-    size_t first_hit = free_list.size()-1;
-    while(i < free_list.size()) {
-        /* we skip contained comparison below the learned lower bound */
-        size_t j = contained_min;
-        while(j < free_list.size()) {
-            if (i != j && free_list[i].contains(free_list[j])) {
-                free_list.erase(free_list.begin() + j);
-                if (i > j) {
-                    i--; /* adjust outer loop iterator */
-                }
-                /* save lower bound where we will start on next pass */
-                first_hit = std::min(first_hit,std::min(j,i));
-            } else {
-                j++;
+    while (i < free_list.size()) {
+        bool contained = false;
+        for (size_t j = 0; j < free_list.size(); j++) {
+            if (i != j && free_list[j].contains(free_list[i])) {
+                contained = true;
+                break;
             }
         }
-        i++;
+        if (contained) {
+            free_list.erase(free_list.begin() + i);
+        } else {
+            i++;
+        }
     }
-    /* set lower bound to skip past on the next pass  */
-    contained_min = first_hit;
+    contained_min = free_list.size();
 }
 
 std::pair<size_t,bin_rect> bin_packer::scan_bins(bin_point sz)
@@ -503,24 +510,21 @@ std::pair<size_t,bin_rect> bin_packer::scan_bins(bin_point sz)
     int best_ssz = -1;
     size_t best_idx = -1;
     bin_rect b(bin_point(0,0),bin_point(0,0));
-    std::vector<bin_rect> best_list;
     for (size_t i = 0; i < free_list.size(); i++) {
-        bin_rect c = free_list[i], d(c.a, c.a + sz);
+        const bin_rect &c = free_list[i];
         if (c.width() < sz.x || c.height() < sz.y) continue;
-        std::vector<bin_rect> l = c.disjoint_subset(d);
-        if (l.size() == 0) continue;
         int ssz = std::min(c.width() - sz.x, c.height() - sz.y);
         if (best_idx == size_t(-1) || ssz < best_ssz) {
             best_ssz = ssz;
             best_idx = i;
-            best_list = l;
-            b = d;
+            b = bin_rect(c.a, c.a + sz);
+            if (ssz == 0) break;
         }
     }
     return std::pair<size_t,bin_rect>(best_idx,b);
 }
 
-std::pair<bool,bin_rect> bin_packer::find_region(int idx, bin_point sz)
+std::pair<bool,bin_rect> bin_packer::find_free(bin_point sz)
 {
     /*
      * The MAXRECTS-BSSF algorithm has three major steps:
@@ -530,18 +534,15 @@ std::pair<bool,bin_rect> bin_packer::find_region(int idx, bin_point sz)
      * - 'split_intersecting_nodes' performs intersection tests
      *   between  all free rectangles and the chosen rectangle,
      *   spliting any that intersect. This has O(n) complexity.
-     * - 'remove_containing_nodes' performs contains tests on all
-     *   ordered pairs of rectangles, removing any contained
-     *   rectangles. This pass has O(n^2) complexity.
-      */
+     * - 'remove_containing_nodes' performs contains tests between
+     *   the split rectangles and all rectangles, removing any
+     *   contained rectangles. This has O(n*k) complexity.
+     */
 
     /* find best fit from free list */
     auto r = scan_bins(sz);
     if (r.first == size_t(-1)) return std::pair<bool,bin_rect>(false,bin_rect());
 
-    /* insert found rectangle into the index */
-    alloc_map[idx] = r.second;
-
     /* split nodes that overlap found rectangle */
     split_intersecting_nodes(r.second);
 
@@ -551,6 +552,62 @@ std::pair<bool,bin_rect> bin_packer::find_region(int idx, bin_point sz)
     return std::pair<bool,bin_rect>(true,r.second);
 }
 
+std::pair<bool,bin_rect> bin_packer::find_shelf(bin_point sz)
+{
+    /*
+     * glyphs in a terminal mostly share a handful of heights, so small
+     * rectangles are placed left to right on shelves, one open shelf per
+     * height class. shelves are allocated from the free list, so the
+     * free list only grows with the number of shelves, not glyphs. when
+     * a shelf is full its remainder is returned to the free list.
+     */
+    if (!shelf_enabled || sz.x > shelf_width || sz.y > total.height() / 8) {
+        return std::pair<bool,bin_rect>(false,bin_rect());
+    }
+
+    int class_height = (sz.y + shelf_align - 1) & ~(shelf_align - 1);
+    auto si = shelf_map.find(class_height);
+    if (si != shelf_map.end() && si->second.width() < sz.x) {
+        add_rect(free_list, si->second);
+        shelf_map.erase(si);
+        si = shelf_map.end();
+    }
+    if (si == shelf_map.end()) {
+        int w = std::min(shelf_width, total.width());
+        auto r = find_free(bin_point(w, class_height));
+        if (!r.first) return std::pair<bool,bin_rect>(false,bin_rect());
+        si = shelf_map.insert(shelf_map.end(),
+            std::pair<int,bin_rect>(class_height, r.second));
+    }
+
+    bin_rect b(si->second.a, si->second.a + sz);
+    si->second.a.x += sz.x;
+    return std::pair<bool,bin_rect>(true,b);
+}
+
+std::pair<bool,bin_rect> bin_packer::find_region(int idx, bin_point sz)
+{
+    /* try a shelf first, then fall back to the free list */
+    auto r = find_shelf(sz);
+    if (!r.first) r = find_free(sz);
+    if (!r.first) return std::pair<bool,bin_rect>(false,bin_rect());
+
+    /* insert found rectangle into the index */
+    alloc_map[idx] = r.second;
+
+    return r;
+}
+
+std::vector<bin_rect> bin_packer::free_rects()
+{
+    /* free list including the unused space on open shelves */
+    std::vector<bin_rect> l = free_list;
+    for (auto &s : shelf_map) {
+        add_rect(l, s.second);
+    }
+    return l;
+}
+
 void bin_packer::create_explicit(int idx, bin_rect rect)
 {
     /*
@@ -562,6 +619,19 @@ void bin_packer::create_explicit(int idx, bin_rect rect)
     remove_containing_nodes();
 }
 
+void bin_packer::free_region(int idx)
+{
+    /*
+     * return an allocated node to the free list. the node can't overlap
+     * or be contained by any free node so it is simply appended. adjacent
+     * free space is not merged, so the packer fragments until reset.
+     */
+    auto ai = alloc_map.find(idx);
+    if (ai == alloc_map.end()) return;
+    free_list.push_back(ai->second);
+    alloc_map.erase(ai);
+}
+
 void bin_packer::dump()
 {
     for (size_t i = 0; i < free_list.size(); i++) {
@@ -5,7 +5,8 @@
 /*
  * bin_packer
  *
- * 2D bin packer implementing the MAXRECTS-BSSF algorithm
+ * 2D bin packer implementing the MAXRECTS-BSSF algorithm, with shelves
+ * for small rectangles that are grouped into classes by height.
  */
 
 struct bin_point
@@ -74,18 +75,27 @@ struct bin_packer
     bin_rect total;
     std::vector<bin_rect> free_list;
     std::map<size_t,bin_rect> alloc_map;
+    std::map<int,bin_rect> shelf_map;
     size_t contained_min;
+    bool shelf_enabled;
+
+    static constexpr int shelf_width = 256;
+    static constexpr int shelf_align = 2;
 
     bin_packer() = delete;
-    bin_packer(bin_point sz);
+    bin_packer(bin_point sz, bool shelf_enabled = true);
 
     void reset();
     void set_bin_size(bin_point sz);
     void split_intersecting_nodes(bin_rect b);
     void remove_containing_nodes();
     std::pair<size_t,bin_rect>  scan_bins(bin_point sz);
+    std::pair<bool,bin_rect> find_free(bin_point sz);
+    std::pair<bool,bin_rect> find_shelf(bin_point sz);
     std::pair<bool,bin_rect> find_region(int idx, bin_point sz);
+    std::vector<bin_rect> free_rects();
     void create_explicit(int idx, bin_rect rect);
+    void free_region(int idx);
     size_t verify();
     void dump();
 };
\ No newline at end of file
@@ -28,6 +28,11 @@ typedef struct {
     uint8_t *pixels;
 } draw_image;
 
+typedef struct {
+    int iid;
+    int rect[4];
+} draw_image_rect;
+
 enum {
     image_none = 0
 };
@@ -42,6 +47,16 @@ enum {
     shader_texture  = 2,
     shader_msdf     = 3,
     shader_canvas   = 4,
+    shader_lcd      = 5,
+};
+
+/* commands are drawn in layer order, so later layers paint over earlier */
+enum {
+    layer_underlay   = 0,
+    layer_background = 1,
+    layer_text       = 2,
+    layer_decoration = 3,
+    layer_overlay    = 4,
 };
 
 typedef struct {
@@ -51,21 +66,31 @@ typedef struct {
     uint shader;
     uint offset;
     uint count;
+    uint layer;
 } draw_cmd;
 
 typedef struct {
     std::vector<draw_image> images;
+    std::vector<draw_image_rect> rects;
     std::vector<draw_cmd> cmds;
     std::vector<draw_vertex> vertices;
     std::vector<uint> indices;
+    uint layer;
 } draw_list;
 
 inline void draw_list_clear(draw_list &batch)
 {
     batch.images.clear();
+    batch.rects.clear();
     batch.cmds.clear();
     batch.vertices.clear();
     batch.indices.clear();
+    batch.layer = 0;
+}
+
+inline void draw_list_layer(draw_list &batch, uint layer)
+{
+    batch.layer = layer;
 }
 
 inline void draw_list_viewport(draw_list &batch, uint x, uint y, uint w, uint h)
@@ -84,7 +109,7 @@ inline void draw_list_viewport(draw_list &batch, uint x, uint y, uint w, uint h)
             !empty ? last.mode : 0,
             !empty ? last.shader : 0,
             !empty ? last.offset + last.count : 0,
-            0
+            0, batch.layer
         });
     }
 }
@@ -110,7 +135,8 @@ inline void draw_list_indices(draw_list &batch, uint iid, uint mode, uint shader
     if (empty ||
         last.iid != iid ||
         last.mode != mode ||
-        last.shader != shader)
+        last.shader != shader ||
+        last.layer != batch.layer)
     {
         uint vp[4];
         if (empty) {
@@ -118,12 +144,53 @@ inline void draw_list_indices(draw_list &batch, uint iid, uint mode, uint shader
         } else {
             memcpy(vp, last.viewport, sizeof(vp));
         }
-        batch.cmds.push_back({{ vp[0], vp[1], vp[2], vp[3] }, iid, mode, shader, start, end - start });
+        batch.cmds.push_back({{ vp[0], vp[1], vp[2], vp[3] }, iid, mode, shader, start, end - start, batch.layer });
     } else {
         last.count += (end - start);
     }
 }
 
+inline bool draw_cmd_compatible(const draw_cmd &l, const draw_cmd &r)
+{
+    return memcmp(l.viewport, r.viewport, sizeof(l.viewport)) == 0 &&
+        l.iid == r.iid && l.mode == r.mode && l.shader == r.shader;
+}
+
+inline void draw_list_sort(draw_list &batch)
+{
+    /*
+     * order commands by layer then by shader and image so that each
+     * layer needs one draw per atlas. submission order is kept within
+     * a state, then indices are copied in the new order so compatible
+     * neighbours become one contiguous range.
+     */
+    std::vector<draw_cmd> cmds(batch.cmds);
+    std::stable_sort(cmds.begin(), cmds.end(),
+        [](const draw_cmd &l, const draw_cmd &r) {
+            if (l.layer != r.layer) return l.layer < r.layer;
+            if (l.shader != r.shader) return l.shader < r.shader;
+            if (l.iid != r.iid) return l.iid < r.iid;
+            return l.mode < r.mode;
+        });
+
+    std::vector<uint> indices;
+    indices.reserve(batch.indices.size());
+    batch.cmds.clear();
+    for (auto &cmd : cmds) {
+        if (cmd.count == 0) continue;
+        auto i = batch.indices.begin() + cmd.offset;
+        uint start = (uint)indices.size();
+        indices.insert(indices.end(), i, i + cmd.count);
+        if (batch.cmds.size() > 0 && draw_cmd_compatible(batch.cmds.back(), cmd)) {
+            batch.cmds.back().count += cmd.count;
+        } else {
+            cmd.offset = start;
+            batch.cmds.push_back(cmd);
+        }
+    }
+    batch.indices.swap(indices);
+}
+
 inline void draw_list_image_delta(draw_list &batch, image *img, bin_rect delta, int flags)
 {
     int w = img->getWidth(), h = img->getHeight(), d = img->getBytesPerPixel();
@@ -135,6 +202,12 @@ inline void draw_list_image_delta(draw_list &batch, image *img, bin_rect delta,
     auto i = std::lower_bound(batch.images.begin(), batch.images.end(), drim,
         [](const draw_image &l, const draw_image &r) { return l.iid < r.iid; });
 
+    /* keep each modified rectangle so only those regions are uploaded */
+    if (delta.b.x > delta.a.x && delta.b.y > delta.a.y) {
+        batch.rects.push_back({img->iid, { delta.a.x, delta.a.y,
+            (delta.b.x - delta.a.x), (delta.b.y - delta.a.y) }});
+    }
+
     if (i == batch.images.end() || i->iid != drim.iid) {
         i = batch.images.insert(i, drim);
     } else {
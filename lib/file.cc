@@ -760,6 +760,11 @@ std::string file::getHomeDir()
     return std::string(getenv("HOME"));
 }
 
+std::string file::getCacheDir()
+{
+    return getHomeDir() + "/Library/Caches";
+}
+
 typedef Boolean (*funcptr_CFURLSetfilePropertyForKey)(CFURLRef url,
     CFStringRef key, CFTypeRef propertyValue, CFErrorRef *error);
 
@@ -854,6 +859,12 @@ std::string file::getHomeDir()
     return std::string(path);
 }
 
+std::string file::getCacheDir()
+{
+    const char *dir = getenv("LOCALAPPDATA");
+    return dir ? std::string(dir) : getHomeDir();
+}
+
 #else
 
 std::string file::getExecutablePath()
@@ -898,6 +909,12 @@ std::string file::getHomeDir()
 {
     return std::string(getenv("HOME"));
 }
+
+std::string file::getCacheDir()
+{
+    const char *dir = getenv("XDG_CACHE_HOME");
+    return dir && *dir ? std::string(dir) : getHomeDir() + "/.cache";
+}
         
 #endif
           
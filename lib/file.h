@@ -54,6 +54,7 @@ struct file
     static std::string getExecutableDirectory();
     static std::string getTempDir();
     static std::string getHomeDir();
+    static std::string getCacheDir();
     static std::string getTempFile(std::string filename, std::string suffix);
 };
 
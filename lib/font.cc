@@ -17,12 +17,15 @@
 #include <algorithm>
 #include <atomic>
 #include <mutex>
+#include <thread>
+#include <condition_variable>
 
 #include <ft2build.h>
 #include FT_FREETYPE_H
 #include FT_MODULE_H
 #include FT_GLYPH_H
 #include FT_OUTLINE_H
+#include FT_SIZES_H
 
 #include <hb.h>
 #include <hb-ft.h>
@@ -33,6 +36,8 @@
 #include "font.h"
 #include "glyph.h"
 #include "msdf.h"
+#include "taskpool.h"
+#include "multi.h"
 #include "file.h"
 #include "logger.h"
 
@@ -428,8 +433,13 @@ std::string font_spec::toString() const
 /* Font Manager (FreeType) */
 
 font_manager_ft::font_manager_ft(std::string fontDir) : font_manager(),
-    msdf_enabled(false), msdf_autoload(false)
+    msdf_enabled(false), msdf_autoload(false),
+    msdf_min_size(default_msdf_min_size), lcd_enabled(false), glyph_stats(),
+    frame(1), glyph_epoch(0), commit_epoch(0), atlas_budget(default_atlas_budget)
 {
+    for (auto &ce : glyph_front) {
+        ce.key.opaque = glyph_hash_map<glyph_entry>::empty_key;
+    }
     FT_Error fterr;
     if ((fterr = FT_Init_FreeType(&ftlib))) {
         Error("error: FT_Init_FreeType failed: fterr=%d\n", fterr);
@@ -442,6 +452,7 @@ font_manager_ft::font_manager_ft(std::string fontDir) : font_manager(),
 
 font_manager_ft::~font_manager_ft()
 {
+    multi.reset();
     faces.clear();
     FT_Done_Library(ftlib);
 }
@@ -530,7 +541,45 @@ void font_manager_ft::importAtlas(font_atlas *atlas)
     }
 }
 
-font_atlas* font_manager_ft::getNewAtlas(font_face *face)
+bool font_manager_ft::use_msdf(font_face *face, int font_size)
+{
+    /*
+     * with MSDF enabled, small sizes use coverage bitmaps which are
+     * hinted and a quarter of the size, while large sizes share one
+     * distance field per glyph that is scaled to every size. the choice
+     * is made per glyph key.
+     */
+    bool color_enabled = face && (face->flags & font_face_color) > 0;
+    return msdf_enabled && !color_enabled &&
+        (font_size == 0 || font_size >= msdf_min_size);
+}
+
+bool font_manager_ft::use_subpixel(font_face *face, int font_size)
+{
+    /* distance fields and color bitmaps are filtered, not positioned */
+    bool color_enabled = face && (face->flags & font_face_color) > 0;
+    return !color_enabled && !use_msdf(face, font_size);
+}
+
+size_t font_manager_ft::atlas_depth(font_face *face, int font_size)
+{
+    bool color_enabled = face && (face->flags & font_face_color) > 0;
+    return color_enabled ? font_atlas::COLOR_DEPTH :
+           use_msdf(face, font_size) ? font_atlas::MSDF_DEPTH :
+           lcd_enabled ?  font_atlas::LCD_DEPTH :
+                          font_atlas::GRAY_DEPTH;
+}
+
+size_t font_manager_ft::atlas_bytes()
+{
+    size_t bytes = 0;
+    for (auto &atlas : everyAtlas) {
+        bytes += atlas->width * atlas->height * atlas->depth;
+    }
+    return bytes;
+}
+
+font_atlas* font_manager_ft::getNewAtlas(font_face *face, size_t depth)
 {
     auto atlas = std::unique_ptr<font_atlas>(new font_atlas(0, 0, 0));
 
@@ -541,21 +590,21 @@ font_atlas* font_manager_ft::getNewAtlas(font_face *face)
             std::make_pair(face,std::vector<font_atlas*>()));
     }
 
-    /* if this is the first atlas for this face, then we attempt to load
-     * the atlas; if unsuccessful we allocate backing store manually. */
-    if (face && msdf_enabled && msdf_autoload && ai->second.size() == 0) {
-        atlas->load(this, face);
+    /* if this is the first MSDF atlas for this face, then we attempt to
+     * load the atlas; if unsuccessful we allocate backing store manually. */
+    bool first = std::none_of(ai->second.begin(), ai->second.end(),
+        [&](font_atlas *a) { return a->depth == depth; });
+    if (face && depth == font_atlas::MSDF_DEPTH && msdf_autoload && first) {
+        atlas->load(this, face, depth);
         importAtlas(atlas.get());
     }
     /* if load failed, allocate backing store using default size */
     if (!atlas->pixels) {
-        bool color_enabled = (face->flags & font_face_color) > 0;
         atlas->reset(font_atlas::DEFAULT_WIDTH, font_atlas::DEFAULT_HEIGHT,
-            color_enabled ? font_atlas::COLOR_DEPTH :
-            msdf_enabled ? font_atlas::MSDF_DEPTH :
-                           font_atlas::GRAY_DEPTH);
+            depth);
     }
     /* add to index and retain pointer */
+    atlas->frame = frame;
     auto atlasp = atlas.get();
     if (face) {
         ai->second.insert(ai->second.end(),atlasp);
@@ -565,78 +614,357 @@ font_atlas* font_manager_ft::getNewAtlas(font_face *face)
     return atlasp;
 }
 
-font_atlas* font_manager_ft::getCurrentAtlas(font_face *face)
+font_atlas* font_manager_ft::getCurrentAtlas(font_face *face, int font_size)
 {
+    return getCurrentAtlasDepth(face, atlas_depth(face, font_size));
+}
+
+font_atlas* font_manager_ft::getCurrentAtlasDepth(font_face *face, size_t depth)
+{
+    /* a face has a list of atlases for each depth it is rendered with */
     if (face != nullptr) {
         auto ai = faceAtlasMap.find(face);
-        if (ai == faceAtlasMap.end()) {
-            ai = faceAtlasMap.insert(faceAtlasMap.end(),
-                std::make_pair(face,std::vector<font_atlas*>()));
-        }
-        if (ai->second.size() == 0) {
-            return getNewAtlas(face);
-        } else {
-            return ai->second.back();
+        if (ai != faceAtlasMap.end()) {
+            for (auto li = ai->second.rbegin(); li != ai->second.rend(); li++) {
+                if ((*li)->depth == depth) return *li;
+            }
         }
+        return getNewAtlas(face, depth);
     }
     if (!defaulAtlas) {
-        defaulAtlas = getNewAtlas(nullptr);
+        defaulAtlas = getNewAtlas(nullptr, depth);
     }
     return defaulAtlas;
 }
 
-glyph_renderer* font_manager_ft::getGlyphRenderer(font_face *face, int glyph)
+static glyph_renderer_factory_impl<glyph_renderer_color_ft> color_factory;
+static glyph_renderer_factory_impl<glyph_renderer_outline_ft> outline_factory;
+static glyph_renderer_factory_impl<glyph_renderer_msdf> msdf_factory;
+static glyph_renderer_factory_impl<glyph_renderer_lcd_ft> lcd_factory;
+
+glyph_renderer_factory* font_manager_ft::getGlyphRendererFactory(font_face *face,
+    int font_size, int glyph)
+{
+    bool color_enabled = (face->flags & font_face_color) > 0;
+    return color_enabled ? static_cast<glyph_renderer_factory*>(&color_factory) :
+           use_msdf(face, font_size) ?
+                           static_cast<glyph_renderer_factory*>(&msdf_factory) :
+           lcd_enabled   ? static_cast<glyph_renderer_factory*>(&lcd_factory) :
+                           static_cast<glyph_renderer_factory*>(&outline_factory);
+}
+
+glyph_renderer* font_manager_ft::getGlyphRenderer(font_face *face, int font_size,
+    int glyph)
 {
     static glyph_renderer_color_ft color;
     static glyph_renderer_outline_ft outline;
     static glyph_renderer_msdf msdf;
+    static glyph_renderer_lcd_ft lcd;
 
     /* emoji - 0x1F000 - 0x1FFFF */
 
     bool color_enabled = (face->flags & font_face_color) > 0;
     return color_enabled ? static_cast<glyph_renderer*>(&color) :
-           msdf_enabled  ? static_cast<glyph_renderer*>(&msdf) :
+           use_msdf(face, font_size) ? static_cast<glyph_renderer*>(&msdf) :
+           lcd_enabled   ? static_cast<glyph_renderer*>(&lcd) :
                            static_cast<glyph_renderer*>(&outline);
 }
 
-glyph_entry* font_manager_ft::lookup(font_face *face, int font_size, int glyph)
+glyph_entry* font_manager_ft::lookup(font_face *face, int font_size, int glyph,
+    int phase)
 {
-    atlas_entry ae;
+    if (!use_subpixel(face, font_size)) phase = 0;
+    glyph_key key(face->font_id, font_size, glyph, phase);
+
+    /* lookup in the front cache */
+    glyph_cache_entry *ce = glyph_front +
+        (glyph_hash_map<glyph_entry>::hash(key.opaque) & (glyph_front_size-1));
+    if (ce->key.opaque == key.opaque) {
+        glyph_stats.front_hits++;
+        touch(&ce->entry);
+        return &ce->entry;
+    }
 
     /* lookup up in our glyph map */
-    auto gi = glyph_map.find({face->font_id, font_size, glyph});
+    auto gi = glyph_map.find(key);
     if (gi != glyph_map.end()) {
-        return &gi->second;
+        glyph_stats.map_hits++;
+        ce->key = key;
+        ce->entry = gi->second;
+        touch(&ce->entry);
+        return &ce->entry;
     }
+    glyph_stats.misses++;
 
-    /* lookup in the current atlas */
-    auto atlas = getCurrentAtlas(face);
-    ae = atlas->lookup(face, font_size, glyph, getGlyphRenderer(face, glyph));
+    /* queue for the renderer workers and leave the glyph blank */
+    if (multi) {
+        request_async(face, font_size, glyph, phase);
+        return nullptr;
+    }
+
+    glyph_entry *ge = lookup_atlas(face, font_size, glyph, phase);
+    if (!ge) {
+        return nullptr;
+    }
+    ce->key = key;
+    ce->entry = *ge;
+    return &ce->entry;
+}
+
+glyph_entry* font_manager_ft::lookup_atlas(font_face *face, int font_size,
+    int glyph, int phase)
+{
+    atlas_entry ae;
+    glyph_renderer *renderer = getGlyphRenderer(face, font_size, glyph);
+    size_t depth = atlas_depth(face, font_size);
+
+    /*
+     * texture memory is bounded by atlas_budget. when the current atlas
+     * is full we try the other atlases for this face, then a new atlas if
+     * it fits in the budget, then evict bins not used in the last frame,
+     * and finally reuse a cold atlas from another face.
+     */
+    auto atlas = getCurrentAtlasDepth(face, depth);
+    ae = atlas->lookup(face, font_size, glyph, renderer, phase);
     if (ae.bin_id == -1) {
-        /* if full, make a new atlas (fixme: we don't search all atlases) */
-        atlas = getNewAtlas(face);
-        ae = atlas->lookup(face, font_size, glyph, getGlyphRenderer(face, glyph));
-        if (ae.bin_id == -1) {
-            /* glyph size is too big */
-            return nullptr;
+        auto &list = faceAtlasMap[face];
+        for (auto a : list) {
+            if (a == atlas || a->depth != depth) continue;
+            ae = a->lookup(face, font_size, glyph, renderer, phase);
+            if (ae.bin_id != -1) { atlas = a; break; }
         }
     }
+    if (ae.bin_id == -1) {
+        size_t size = font_atlas::DEFAULT_WIDTH * font_atlas::DEFAULT_HEIGHT *
+            depth;
+        if (atlas_bytes() + size <= atlas_budget) {
+            atlas = getNewAtlas(face, depth);
+            ae = atlas->lookup(face, font_size, glyph, renderer, phase);
+        }
+    }
+    if (ae.bin_id == -1) {
+        auto list = faceAtlasMap[face];
+        for (auto a : list) {
+            if (a->depth != depth || evict_atlas(a) == 0) continue;
+            ae = a->lookup(face, font_size, glyph, renderer, phase);
+            if (ae.bin_id != -1) { atlas = a; break; }
+            /* freed space is too fragmented so repack at end of frame */
+            a->repack_pending = true;
+        }
+    }
+    if (ae.bin_id == -1 && (atlas = steal_atlas(face, depth))) {
+        ae = atlas->lookup(face, font_size, glyph, renderer, phase);
+    }
+    if (ae.bin_id == -1) {
+        /* glyph size is too big or every glyph is in use */
+        return nullptr;
+    }
+    atlas->touch(ae.bin_id, frame);
 
     /* create entry in our map and return pointer */
-    gi = glyph_map.insert(glyph_map.end(),
-        std::pair<glyph_key,glyph_entry>({face->font_id, font_size, glyph},
+    auto gi = glyph_map.insert(glyph_map.end(),
+        std::pair<glyph_key,glyph_entry>({face->font_id, font_size, glyph, phase},
             glyph_entry(atlas, ae.bin_id, ae.font_size,
                 ae.ox, ae.oy, ae.w, ae.h, ae.uv )));
 
     return &gi->second;
 }
 
+size_t font_manager_ft::evict_atlas(font_atlas *atlas)
+{
+    /* keep glyphs used in this frame or the last */
+    size_t count = atlas->evict(frame > 1 ? frame - 1 : 0);
+    if (count > 0) {
+        glyph_stats.evictions += count;
+        sync_atlas(atlas);
+    }
+    return count;
+}
+
+font_atlas* font_manager_ft::steal_atlas(font_face *face, size_t depth)
+{
+    /* find an atlas of the same depth where every bin is cold */
+    uint32_t before = frame > 1 ? frame - 1 : 0;
+    for (auto &fa : faceAtlasMap) {
+        if (fa.first == face) continue;
+        for (auto ai = fa.second.begin(); ai != fa.second.end(); ai++) {
+            font_atlas *atlas = *ai;
+            if (atlas->depth != depth) continue;
+            bool cold = true;
+            for (size_t i = 1; i < atlas->bin_stamp.size() && cold; i++) {
+                cold = atlas->bin_stamp[i] < before;
+            }
+            if (!cold) continue;
+            glyph_stats.evictions += atlas->glyph_map.size();
+            fa.second.erase(ai);
+            atlas->clear();
+            sync_atlas(atlas);
+            faceAtlasMap[face].push_back(atlas);
+            return atlas;
+        }
+    }
+    return nullptr;
+}
+
+void font_manager_ft::sync_atlas(font_atlas *atlas)
+{
+    /*
+     * drop manager entries for glyphs the atlas no longer holds and pick
+     * up new positions for repacked glyphs. entries copied out of the map
+     * are stale, so we clear the front cache and bump the epoch.
+     */
+    std::vector<glyph_key> stale;
+    for (auto &gi : glyph_map) {
+        glyph_entry &ge = gi.second;
+        if (ge.atlas != atlas) continue;
+        auto ai = atlas->glyph_map.find(gi.first);
+        if (ai == atlas->glyph_map.end()) {
+            stale.push_back(gi.first);
+        } else {
+            ge.bin_id = ai->second.bin_id;
+            memcpy(ge.uv, ai->second.uv, sizeof(ge.uv));
+        }
+    }
+    for (auto &key : stale) {
+        glyph_map.erase(key);
+    }
+    for (auto &ce : glyph_front) {
+        ce.key.opaque = glyph_hash_map<glyph_entry>::empty_key;
+    }
+    glyph_epoch++;
+}
+
+void font_manager_ft::touch(glyph_entry *ge)
+{
+    if (ge->atlas) {
+        ge->atlas->touch(ge->bin_id, frame);
+    }
+}
+
+bool font_manager_ft::repack_pending()
+{
+    for (auto &atlas : everyAtlas) {
+        if (atlas->repack_pending) return true;
+    }
+    return false;
+}
+
+void font_manager_ft::next_frame()
+{
+    /* repack fragmented atlases between frames while workers are idle */
+    if (!async_pending()) {
+        for (auto &atlas : everyAtlas) {
+            if (!atlas->repack_pending) continue;
+            if (atlas->repack()) {
+                glyph_stats.repacks++;
+                sync_atlas(atlas.get());
+            }
+            atlas->repack_pending = false;
+        }
+    }
+    frame++;
+    for (auto &atlas : everyAtlas) {
+        std::lock_guard<std::mutex> lock(atlas->mutex);
+        atlas->frame = frame;
+    }
+}
+
+void font_manager_ft::set_async(size_t num_threads)
+{
+    if (num_threads == 0) {
+        multi.reset();
+        return;
+    }
+    multi = std::make_unique<glyph_renderer_multi>(this,
+        outline_factory, num_threads);
+}
+
+void font_manager_ft::request_async(font_face *face, int font_size, int glyph,
+    int phase)
+{
+    glyph_key key(face->font_id, font_size, glyph, phase);
+    if (!glyph_pending_map.insert({key, true}).second) {
+        return;
+    }
+
+    /*
+     * the render thread must not touch an atlas while workers are adding
+     * to it, so every miss is deferred until the batch is committed.
+     */
+    glyph_renderer_factory *factory = getGlyphRendererFactory(face,
+        font_size, glyph);
+    glyph_render_request r{getCurrentAtlas(face, font_size),
+        static_cast<font_face_ft*>(face), (unsigned)glyph,
+        factory == &msdf_factory ? 0 : font_size, phase, factory};
+    glyph_pending.push_back({key, face, multi->submit(r)});
+}
+
+bool font_manager_ft::update_async()
+{
+    if (!multi || glyph_pending.size() == 0) {
+        return false;
+    }
+    if (!multi->done()) {
+        return false;
+    }
+    multi->reset();
+
+    /* entries are now in the atlas so lookups are cheap; requeue overflow */
+    std::vector<glyph_pending_entry> overflow;
+    for (auto &p : glyph_pending) {
+        if (p.queued) {
+            if (lookup_atlas(p.face, p.key.font_size(), p.key.glyph(),
+                p.key.phase())) continue;
+            /* glyph can't be rendered, so cache a blank entry */
+            const float uv[4] = { 0, 0, 0, 0 };
+            glyph_map.insert({p.key, glyph_entry(nullptr, -1,
+                p.key.font_size(), 0, 0, 0, 0, uv)});
+        } else {
+            overflow.push_back(p);
+        }
+    }
+    glyph_pending.clear();
+    glyph_pending_map.clear();
+    for (auto &p : overflow) {
+        request_async(p.face, p.key.font_size(), p.key.glyph(),
+            p.key.phase());
+    }
+
+    /* renderers that didn't make this call see the commit by the epoch */
+    commit_epoch++;
+
+    return true;
+}
+
+bool font_manager_ft::async_pending()
+{
+    return glyph_pending.size() > 0;
+}
+
+void font_manager_ft::prewarm(font_face *face, int font_size, uint first,
+    uint last, int phase)
+{
+    /* queue a codepoint range for the renderer workers */
+    if (!multi) {
+        return;
+    }
+    if (!use_subpixel(face, font_size)) phase = 0;
+    FT_Face ftface = static_cast<font_face_ft*>(face)->ftface;
+    for (uint c = first; c <= last; c++) {
+        int glyph = (int)FT_Get_Char_Index(ftface, c);
+        if (glyph == 0) continue;
+        auto gi = glyph_map.find({face->font_id, font_size, glyph, phase});
+        if (gi != glyph_map.end()) continue;
+        request_async(face, font_size, glyph, phase);
+    }
+}
+
 
 /* Font Face (FreeType) */
 
 font_face_ft::font_face_ft(font_manager_ft* manager, FT_Face ftface, int font_id, std::string path) :
     font_face(font_id, path, FT_Get_Postscript_Name(ftface)), manager(manager),
-    ftface(ftface), hbfont_cache(nullptr), hbfont_size(0)
+    ftface(ftface), sizes(), size_clock(0)
 {
     fontData = font_manager::createFontRecord(name,
         ftface->family_name, ftface->style_name);
@@ -644,39 +972,85 @@ font_face_ft::font_face_ft(font_manager_ft* manager, FT_Face ftface, int font_id
 
 font_face_ft::~font_face_ft()
 {
-    if (hbfont_cache) {
-        hb_font_destroy(hbfont_cache);
-        hbfont_cache = nullptr;
+    /* size objects belong to the face and are freed with it */
+    for (auto &s : sizes) {
+        if (s.hbfont) {
+            hb_font_destroy(s.hbfont);
+        }
     }
+    sizes.clear();
     FT_Done_Face(ftface);
 }
 
-FT_Size_Metrics* font_face_ft::get_metrics(int font_size)
+font_face_size* font_face_ft::get_size(int font_size)
 {
-    /* get metrics for our point size */
-    int font_dpi = font_manager::dpi;
-    FT_Size_Metrics *metrics = &ftface->size->metrics;
-    if (ftface->units_per_EM) {
-        int points = (int)(font_size * metrics->x_scale) / ftface->units_per_EM;
-        if (metrics->x_scale != metrics->y_scale || font_size != points) {
-            FT_Set_Char_Size(ftface, 0, font_size, font_dpi, font_dpi);
+    FT_Error fterr;
+    font_face_size *s = nullptr, *lru = nullptr;
+
+    for (auto &e : sizes) {
+        if (e.font_size == font_size) {
+            s = &e;
+            break;
         }
-    } else {
+        if (!lru || e.last_used < lru->last_used) {
+            lru = &e;
+        }
+    }
+
+    /* a new size takes a free slot or the least recently used one */
+    if (!s) {
+        if (sizes.size() < max_sizes) {
+            sizes.push_back(font_face_size());
+            s = &sizes.back();
+        } else {
+            s = lru;
+            if (s->hbfont) {
+                hb_font_destroy(s->hbfont);
+            }
+            FT_Done_Size(s->ftsize);
+        }
+        if ((fterr = FT_New_Size(ftface, &s->ftsize))) {
+            Panic("error: FT_New_Size failed: fterr=%d\n", fterr);
+        }
+        s->font_size = font_size;
+        s->hbfont = nullptr;
+        s->x_scale = s->y_scale = -1;
+    }
+
+    if (ftface->size != s->ftsize) {
+        FT_Activate_Size(s->ftsize);
+    }
+
+    /* set the char size when new or changed by a strike or MSDF render */
+    FT_Size_Metrics *metrics = &s->ftsize->metrics;
+    if (metrics->x_scale != s->x_scale || metrics->y_scale != s->y_scale) {
+        int font_dpi = font_manager::dpi;
         FT_Set_Char_Size(ftface, 0, font_size, font_dpi, font_dpi);
+        s->x_scale = metrics->x_scale;
+        s->y_scale = metrics->y_scale;
+        if (s->hbfont) {
+            hb_ft_font_changed(s->hbfont);
+        }
     }
-    return &ftface->size->metrics;
+
+    s->last_used = ++size_clock;
+    return s;
+}
+
+FT_Size_Metrics* font_face_ft::get_metrics(int font_size)
+{
+    /* get metrics for our point size */
+    return &get_size(font_size)->ftsize->metrics;
 }
 
 hb_font_t* font_face_ft::get_hbfont(int font_size)
 {
-    if (hbfont_cache && hbfont_size == font_size) {
-        return hbfont_cache;
-    } else if (hbfont_cache) {
-        hb_font_destroy(hbfont_cache);
+    /* the HarfBuzz font takes its scale from the active size */
+    font_face_size *s = get_size(font_size);
+    if (!s->hbfont) {
+        s->hbfont = hb_ft_font_create(ftface, NULL);
     }
-    hbfont_cache  = hb_ft_font_create(ftface, NULL);
-    hbfont_size = font_size;
-    return hbfont_cache;
+    return s->hbfont;
 }
 
 int font_face_ft::get_height(int font_size)
@@ -704,5 +1078,7 @@ font_face_ft* font_face_ft::dup_thread()
         break;
     }
 
-    return new font_face_ft(manager, ftface, font_id, path);
+    font_face_ft *dup = new font_face_ft(manager, ftface, font_id, path);
+    dup->flags = flags;
+    return dup;
 }
\ No newline at end of file
@@ -10,6 +10,7 @@ typedef struct FT_LibraryRec_* FT_Library;
 typedef struct FT_GlyphSlotRec_* FT_GlyphSlot;
 typedef struct FT_Span_ FT_Span;
 typedef struct FT_Size_Metrics_ FT_Size_Metrics;
+typedef struct FT_SizeRec_* FT_Size;
 
 struct font_face;
 struct font_manager;
@@ -191,6 +192,7 @@ struct font_face
     std::string name;
     font_data fontData;
     int flags;
+    uint64_t content_hash;
 
     font_face() = default;
     font_face(int font_id, std::string path, std::string name);
@@ -202,7 +204,8 @@ struct font_face
 };
 
 inline font_face::font_face(int font_id, std::string path, std::string name) :
-    font_id(font_id), path(path), name(name), fontData(), flags(0) {}
+    font_id(font_id), path(path), name(name), fontData(), flags(0),
+    content_hash(0) {}
 
 
 /*
@@ -216,21 +219,162 @@ struct glyph_key
     uint64_t opaque;
 
     glyph_key() = default;
-    glyph_key(int64_t font_id, int64_t font_size, int64_t glyph);
+    glyph_key(int64_t font_id, int64_t font_size, int64_t glyph,
+        int64_t phase = 0);
 
     bool operator<(const glyph_key &o) const { return opaque < o.opaque; }
 
     int font_id() const;
     int font_size() const;
     int glyph() const;
+    int phase() const;
 };
 
-inline glyph_key::glyph_key(int64_t font_id, int64_t font_size, int64_t glyph) :
-    opaque(glyph | (font_size << 20) | (font_id << 40)) {}
+inline glyph_key::glyph_key(int64_t font_id, int64_t font_size, int64_t glyph,
+    int64_t phase) :
+    opaque(glyph | (font_size << 20) | (font_id << 40) | (phase << 60)) {}
 
 inline int glyph_key::font_id() const { return (opaque >> 40) & ((1 << 20)-1); }
 inline int glyph_key::font_size() const { return (opaque >> 20) & ((1 << 20)-1); }
 inline int glyph_key::glyph() const { return opaque & ((1 << 20)-1); }
+inline int glyph_key::phase() const { return (opaque >> 60) & 3; }
+
+/*
+ * bitmap glyphs are rasterized at quarter pixel x offsets so text can be
+ * placed at fractional positions without blurring. this splits a device
+ * x coordinate into whole pixels and the phase of the nearest variant.
+ */
+
+static const int glyph_subpixel_phases = 4;
+
+inline int glyph_subpixel_split(float x, float *xi)
+{
+    float q = floorf(x * glyph_subpixel_phases + 0.5f);
+    *xi = floorf(q / glyph_subpixel_phases);
+    return (int)(q - *xi * glyph_subpixel_phases);
+}
+
+
+/*
+ * Glyph Hash Map
+ *
+ * Open addressing hash map keyed on glyph_key with linear probing.
+ * Entries are stored inline and a key with all bits set marks an empty
+ * slot. Pointers to entries are invalidated when the map grows.
+ */
+
+template <typename V>
+struct glyph_hash_map
+{
+    typedef std::pair<glyph_key,V> value_type;
+
+    static const uint64_t empty_key = ~0ull;
+
+    struct iterator
+    {
+        value_type *p, *e;
+
+        iterator(value_type *p, value_type *e) : p(p), e(e) { skip(); }
+
+        void skip() { while (p != e && p->first.opaque == empty_key) p++; }
+        iterator& operator++() { p++; skip(); return *this; }
+        iterator operator++(int) { iterator i = *this; ++*this; return i; }
+        value_type& operator*() const { return *p; }
+        value_type* operator->() const { return p; }
+        bool operator==(const iterator &o) const { return p == o.p; }
+        bool operator!=(const iterator &o) const { return p != o.p; }
+    };
+
+    std::vector<value_type> slots;
+    size_t count;
+
+    glyph_hash_map() : slots(), count(0) {}
+
+    static size_t hash(uint64_t k)
+    {
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdull;
+        k ^= k >> 33;
+        return (size_t)k;
+    }
+
+    iterator begin() { return iterator(slots.data(), slots.data() + slots.size()); }
+    iterator end() { return iterator(slots.data() + slots.size(), slots.data() + slots.size()); }
+    size_t size() const { return count; }
+    void clear() { slots.clear(); count = 0; }
+
+    value_type* probe(glyph_key key)
+    {
+        size_t mask = slots.size() - 1, i = hash(key.opaque) & mask;
+        while (slots[i].first.opaque != key.opaque &&
+               slots[i].first.opaque != empty_key) {
+            i = (i + 1) & mask;
+        }
+        return &slots[i];
+    }
+
+    void grow()
+    {
+        std::vector<value_type> old(std::max(size_t(64), slots.size() * 2));
+        for (auto &v : old) v.first.opaque = empty_key;
+        std::swap(slots, old);
+        for (auto &v : old) {
+            if (v.first.opaque != empty_key) *probe(v.first) = v;
+        }
+    }
+
+    iterator find(glyph_key key)
+    {
+        if (count == 0) return end();
+        value_type *v = probe(key);
+        if (v->first.opaque == empty_key) return end();
+        return iterator(v, slots.data() + slots.size());
+    }
+
+    std::pair<iterator,bool> insert(const value_type &val)
+    {
+        if ((count + 1) * 2 > slots.size()) grow();
+        value_type *v = probe(val.first);
+        bool inserted = v->first.opaque == empty_key;
+        if (inserted) {
+            *v = val;
+            count++;
+        }
+        return std::make_pair(iterator(v, slots.data() + slots.size()), inserted);
+    }
+
+    iterator insert(iterator hint, const value_type &val)
+    {
+        return insert(val).first;
+    }
+
+    V& operator[](glyph_key key)
+    {
+        return insert(value_type(key, V())).first->second;
+    }
+
+    size_t erase(glyph_key key)
+    {
+        if (count == 0) return 0;
+        value_type *v = probe(key);
+        if (v->first.opaque == empty_key) return 0;
+
+        /* backward shift deletion keeps probe sequences intact */
+        size_t mask = slots.size() - 1, i = v - slots.data(), j = i;
+        for (;;) {
+            j = (j + 1) & mask;
+            if (slots[j].first.opaque == empty_key) break;
+            size_t k = hash(slots[j].first.opaque) & mask;
+            if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j)) {
+                slots[i] = slots[j];
+                i = j;
+            }
+        }
+        slots[i].first.opaque = empty_key;
+        count--;
+        return 1;
+    }
+};
 
 
 /*
@@ -303,25 +447,46 @@ struct font_manager
     virtual font_face* findFontByData(font_data fontRec);
     virtual font_face* findFontBySpec(font_spec fontSpec);
     virtual void importAtlas(font_atlas *atlas) = 0;
-    virtual font_atlas* getCurrentAtlas(font_face *face) = 0;
-    virtual glyph_renderer* getGlyphRenderer(font_face *face, int glyph) = 0;
-    virtual glyph_entry* lookup(font_face *face, int font_size, int glyph) = 0;
+    virtual font_atlas* getCurrentAtlas(font_face *face, int font_size) = 0;
+    virtual glyph_renderer* getGlyphRenderer(font_face *face, int font_size,
+        int glyph) = 0;
+    virtual glyph_entry* lookup(font_face *face, int font_size, int glyph,
+        int phase = 0) = 0;
 };
 
 
 /* Font Face (FreeType) */
 
+/*
+ * sized instance of a face with its own FreeType size object and
+ * HarfBuzz font. faces keep a few of these so that alternating between
+ * sizes only activates a size instead of rescaling the face. the scale
+ * is kept to notice renderers that set a char size on the active size.
+ */
+
+struct font_face_size
+{
+    int font_size;
+    FT_Size ftsize;
+    hb_font_t *hbfont;
+    long x_scale, y_scale;
+    uint64_t last_used;
+};
+
 struct font_face_ft : font_face
 {
+    static const size_t max_sizes = 8;
+
     FT_Face ftface;
-    hb_font_t *hbfont_cache;
-    int hbfont_size;
+    std::vector<font_face_size> sizes;
+    uint64_t size_clock;
     font_manager_ft* manager;
 
     font_face_ft() = default;
     font_face_ft(font_manager_ft* manager, FT_Face ftface, int font_id, std::string path);
     virtual ~font_face_ft();
 
+    font_face_size* get_size(int font_size);
     FT_Size_Metrics* get_metrics(int font_size);
     hb_font_t* get_hbfont(int font_size);
     int get_height(int font_size);
@@ -330,17 +495,68 @@ struct font_face_ft : font_face
 
 /* Font Manager (FreeType) */
 
+/*
+ * small direct mapped cache checked before the glyph hash map. the hot
+ * working set of a terminal (mostly ASCII) stays resident here.
+ */
+
+static const size_t glyph_front_size = 256;
+
+struct glyph_cache_entry
+{
+    glyph_key key;
+    glyph_entry entry;
+};
+
+struct glyph_cache_stats
+{
+    size_t front_hits;
+    size_t map_hits;
+    size_t misses;
+    size_t evictions;
+    size_t repacks;
+};
+
+/*
+ * glyph waiting on the renderer workers. misses are queued while a frame
+ * is drawn and the glyph is left blank until the batch is committed.
+ */
+
+struct glyph_renderer_factory;
+struct glyph_renderer_multi;
+
+struct glyph_pending_entry
+{
+    glyph_key key;
+    font_face *face;
+    bool queued;
+};
+
 struct font_manager_ft : font_manager
 {
     FT_Library ftlib;
     bool msdf_enabled;
     bool msdf_autoload;
+    int msdf_min_size;
+    bool lcd_enabled;
 
     std::vector<std::unique_ptr<font_face_ft>> faces;
     std::vector<std::unique_ptr<font_atlas>> everyAtlas;
     std::map<font_face*,std::vector<font_atlas*>> faceAtlasMap;
     font_atlas* defaulAtlas;
-    std::map<glyph_key,glyph_entry> glyph_map;
+    glyph_hash_map<glyph_entry> glyph_map;
+    glyph_cache_entry glyph_front[glyph_front_size];
+    glyph_cache_stats glyph_stats;
+    std::unique_ptr<glyph_renderer_multi> multi;
+    std::vector<glyph_pending_entry> glyph_pending;
+    glyph_hash_map<bool> glyph_pending_map;
+    uint32_t frame;
+    uint32_t glyph_epoch;
+    uint32_t commit_epoch;
+    size_t atlas_budget;
+
+    static const size_t default_atlas_budget = 64 << 20;
+    static const int default_msdf_min_size = 32 << 6;
 
     font_manager_ft(std::string fontDir = "");
     virtual ~font_manager_ft();
@@ -351,10 +567,34 @@ struct font_manager_ft : font_manager
     virtual font_face* findFontById(size_t font_id);
     virtual font_face* findFontByPath(std::string path);
     virtual void importAtlas(font_atlas *atlas);
-    virtual font_atlas* getNewAtlas(font_face *face);
-    virtual font_atlas* getCurrentAtlas(font_face *face);
-    virtual glyph_renderer* getGlyphRenderer(font_face *face, int glyph);
-    virtual glyph_entry* lookup(font_face *face, int font_size, int glyph);
+    virtual font_atlas* getNewAtlas(font_face *face, size_t depth);
+    virtual font_atlas* getCurrentAtlas(font_face *face, int font_size);
+    virtual glyph_renderer* getGlyphRenderer(font_face *face, int font_size,
+        int glyph);
+    virtual glyph_entry* lookup(font_face *face, int font_size, int glyph,
+        int phase = 0);
+
+    glyph_renderer_factory* getGlyphRendererFactory(font_face *face,
+        int font_size, int glyph);
+    font_atlas* getCurrentAtlasDepth(font_face *face, size_t depth);
+    glyph_entry* lookup_atlas(font_face *face, int font_size, int glyph,
+        int phase);
+    void set_async(size_t num_threads);
+    void request_async(font_face *face, int font_size, int glyph, int phase);
+    bool update_async();
+    bool async_pending();
+    void prewarm(font_face *face, int font_size, uint first, uint last,
+        int phase = 0);
+    bool use_msdf(font_face *face, int font_size);
+    bool use_subpixel(font_face *face, int font_size);
+    size_t atlas_depth(font_face *face, int font_size);
+    size_t atlas_bytes();
+    size_t evict_atlas(font_atlas *atlas);
+    font_atlas* steal_atlas(font_face *face, size_t depth);
+    void sync_atlas(font_atlas *atlas);
+    void touch(glyph_entry *ge);
+    bool repack_pending();
+    void next_frame();
 
     const std::vector<std::unique_ptr<font_face_ft>>& getFontList() { return faces; }
 };
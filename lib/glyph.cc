@@ -18,6 +18,15 @@
 #include <atomic>
 #include <mutex>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+#include <zlib.h>
+
 #include <ft2build.h>
 #include FT_FREETYPE_H
 #include FT_MODULE_H
@@ -56,6 +65,20 @@ void span_vector::reset(int width, int height)
 {
     pixels.clear();
     pixels.resize(width * height);
+    dst = pixels.data();
+    pitch = width;
+    w = width;
+    h = height;
+}
+
+void span_vector::target(uint8_t *dst, int pitch, int width, int height)
+{
+    /* spans are written straight into the region, which may hold stale pixels */
+    for (int i = 0; i < height; i++) {
+        memset(dst + i * pitch, 0, width);
+    }
+    this->dst = dst;
+    this->pitch = pitch;
     w = width;
     h = height;
 }
@@ -72,7 +95,7 @@ void span_vector::fn(int y, int count, const FT_Span* spans, void *user)
         int dx = std::max(std::min(s->gx + s->ox + spans[i].x, s->w), 0);
         int dl = std::max(std::min((int)spans[i].len, s->w - dx), 0);
         if (dl > 0) {
-            memset(&s->pixels[dy * s->w + dx], spans[i].coverage, dl);
+            memset(&s->dst[dy * s->pitch + dx], spans[i].coverage, dl);
         }
     }
 }
@@ -88,10 +111,12 @@ font_atlas::font_atlas() :
 
 font_atlas::font_atlas(size_t width, size_t height, size_t depth) :
     width(width), height(height), depth(depth),
-    glyph_map(), pixels(nullptr), uv1x1(1.0f / (float)width),
+    glyph_map(), pixels(nullptr), map_addr(nullptr), map_size(0),
+    uv1x1(1.0f / (float)width),
     bp(bin_point((int)width, (int)height)),
-    delta(bin_point((int)width,(int)height),bin_point(0,0)),
-    multithreading(false), mutex()
+    dirty(),
+    next_bin(1), bin_stamp(), frame(0), repack_pending(false), mutex(), img(),
+    dpi(font_manager::dpi), range(MSDF_RANGE)
 {
     if (width && height && depth) {
         create_pixels();
@@ -102,10 +127,7 @@ font_atlas::font_atlas(size_t width, size_t height, size_t depth) :
 
 font_atlas::~font_atlas()
 {
-    if (pixels) {
-        delete [] pixels;
-        pixels = nullptr;
-    }
+    free_pixels();
 }
 
 image* font_atlas::get_image()
@@ -119,20 +141,35 @@ void font_atlas::create_pixels()
     bp.find_region(0, bin_point(2,2));
 
     /* clear bitmap */
-    if (pixels) {
-        delete [] pixels;
-    }
+    free_pixels();
     pixels = new uint8_t[width * height * depth];
 
     /* create image handle */
     switch (depth) {
     case 1: img = std::shared_ptr<image>(new image(file_ptr(),
         (uint)width, (uint)height, pixel_format_alpha, pixels)); break;
+    case 3: img = std::shared_ptr<image>(new image(file_ptr(),
+        (uint)width, (uint)height, pixel_format_rgb, pixels)); break;
     case 4: img = std::shared_ptr<image>(new image(file_ptr(),
         (uint)width, (uint)height, pixel_format_rgba, pixels)); break;
     }
 }
 
+static void atlas_cache_unmap(uint8_t *addr, size_t size);
+
+void font_atlas::free_pixels()
+{
+    /* pixels are either allocated or point into a mapped cache file */
+    if (map_addr) {
+        atlas_cache_unmap(map_addr, map_size);
+        map_addr = nullptr;
+        map_size = 0;
+    } else if (pixels) {
+        delete [] pixels;
+    }
+    pixels = nullptr;
+}
+
 void font_atlas::clear_pixels()
 {
     switch (depth) {
@@ -157,6 +194,11 @@ void font_atlas::uv_pixel()
     case 1:
         pixels[0] = 0xff;
         break;
+    case 3:
+        pixels[0] = 0xff;
+        pixels[1] = 0xff;
+        pixels[2] = 0xff;
+        break;
     case 4:
         pixels[0] = 0xff;
         pixels[1] = 0xff;
@@ -169,8 +211,11 @@ void font_atlas::uv_pixel()
 void font_atlas::reset_bins()
 {
     bp.set_bin_size(bin_point((int)width,(int)height));
-    delta = bin_rect(bin_point((int)width,(int)height),bin_point(0,0));
+    dirty.clear();
     glyph_map.clear();
+    next_bin = 1;
+    bin_stamp.clear();
+    repack_pending = false;
 }
 
 void font_atlas::reset(size_t width, size_t height, size_t depth)
@@ -192,26 +237,26 @@ void font_atlas::reset(size_t width, size_t height, size_t depth)
 }
 
 atlas_entry font_atlas::create(font_face *face, int font_size, int glyph,
-    int entry_font_size, int ox, int oy, int w, int h)
+    int entry_font_size, int ox, int oy, int w, int h, int phase)
 {
     float uv[4];
     atlas_entry ae;
 
-    if (multithreading) {
-        mutex.lock();
-    }
+    /* workers may be adding glyphs to the same atlas */
+    std::lock_guard<std::mutex> lock(mutex);
 
-    int bin_id = (int)glyph_map.size();
+    /* bin 0 is the reserved white pixel */
+    int bin_id = next_bin++;
     auto r = bp.find_region(bin_id, bin_point(w + PADDING , h + PADDING));
     if (!r.first) {
-        if (multithreading) {
-            mutex.unlock();
-        }
         return atlas_entry(-1); /* atlas full */
     }
 
-    /* track minimum update rectangle */
-    expand_delta(r.second);
+    /* new bins are in use this frame so eviction can't take them */
+    touch(bin_id, frame);
+
+    /* track rectangles to upload */
+    add_dirty(r.second);
 
     /* create uv coordinates */
     create_uvs(uv, r.second);
@@ -219,18 +264,31 @@ atlas_entry font_atlas::create(font_face *face, int font_size, int glyph,
     /* insert into glyph_map */
     auto a = r.second.a;
     auto gi = glyph_map.insert(glyph_map.end(),
-        std::pair<glyph_key,atlas_entry>({face->font_id, font_size, glyph},
+        std::pair<glyph_key,atlas_entry>({face->font_id, font_size, glyph, phase},
             {bin_id, entry_font_size, a.x, a.y, ox, oy, w, h, uv}));
 
     ae = gi->second;
 
-    if (multithreading) {
-        mutex.unlock();
-    }
-
     return ae;
 }
 
+void font_atlas::release(font_face *face, int font_size, int glyph, int phase)
+{
+    /* undo create for a glyph that failed to render */
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto gi = glyph_map.find({face->font_id, font_size, glyph, phase});
+    if (gi == glyph_map.end()) {
+        return;
+    }
+    int bin_id = gi->second.bin_id;
+    glyph_map.erase(gi->first);
+    bp.free_region(bin_id);
+    if ((size_t)bin_id < bin_stamp.size()) {
+        bin_stamp[bin_id] = 0;
+    }
+}
+
 void font_atlas::create_uvs(float uv[4], bin_rect r)
 {
     float x1 = (float)r.a.x,        y1 = (float)r.a.y;
@@ -242,31 +300,59 @@ void font_atlas::create_uvs(float uv[4], bin_rect r)
     uv[3] = y1/width;
 }
 
-void font_atlas::expand_delta(bin_rect b)
+void font_atlas::add_dirty(bin_rect b)
 {
     /*
-     * expand the delta rectangle.
+     * add a rectangle to the dirty list.
      *
      * This interface is called after find_region with each newly
-     * allocated region, to keep track of the minimum update rectangle.
+     * allocated region. glyphs on the same shelf are allocated left
+     * to right, so a rectangle adjoining a recent one is merged.
      */
-    delta.a.x = std::min(delta.a.x,b.a.x);
-    delta.a.y = std::min(delta.a.y,b.a.y);
-    delta.b.x = std::max(delta.b.x,b.b.x);
-    delta.b.y = std::max(delta.b.y,b.b.y);
+    size_t recent = std::min(dirty.size(), (size_t)16);
+    for (size_t i = dirty.size(); i > dirty.size() - recent; i--) {
+        bin_rect &l = dirty[i - 1];
+        if (l.contains(b)) {
+            return;
+        }
+        if (l.a.y == b.a.y && l.b.x == b.a.x) {
+            l.b.x = b.b.x;
+            l.b.y = std::max(l.b.y, b.b.y);
+            return;
+        }
+    }
+    if (dirty.size() >= MAX_DIRTY) {
+        /* too many to upload separately so upload the bounding box */
+        bin_rect u = b;
+        for (auto &r : dirty) {
+            u = bin_rect(bin_point(std::min(u.a.x, r.a.x), std::min(u.a.y, r.a.y)),
+                bin_point(std::max(u.b.x, r.b.x), std::max(u.b.y, r.b.y)));
+        }
+        dirty.clear();
+        b = u;
+    }
+    dirty.push_back(b);
 }
 
-bin_rect font_atlas::get_delta()
+void font_atlas::all_dirty()
+{
+    dirty.clear();
+    dirty.push_back(bin_rect(bin_point(0,0),bin_point((int)width,(int)height)));
+}
+
+size_t font_atlas::get_dirty(std::vector<bin_rect> &rects)
 {
     /*
-     * return the dela rectangle, and reset it to its smallest value.
+     * append the dirty rectangles to rects and clear the dirty list.
      *
-     * This interface is called to get the smalled possible update
-     * rectangle to use with APIs such as glTexSubImage2D.
+     * This interface is called to get the regions that need to be
+     * uploaded with APIs such as glTexSubImage2D.
      */
-    bin_rect r = delta;
-    delta = bin_rect(bin_point((int)width,(int)height),bin_point(0,0));
-    return r;
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t count = dirty.size();
+    rects.insert(rects.end(), dirty.begin(), dirty.end());
+    dirty.clear();
+    return count;
 }
 
 atlas_entry font_atlas::resize(font_face *face, int font_size, int glyph,
@@ -286,14 +372,14 @@ atlas_entry font_atlas::resize(font_face *face, int font_size, int glyph,
 }
 
 atlas_entry font_atlas::lookup(font_face *face, int font_size, int glyph,
-    glyph_renderer *renderer)
+    glyph_renderer *renderer, int phase)
 {
     atlas_entry ae;
 
     /*
      * lookup atlas to see if the glyph is in the atlas
      */
-    auto gi = glyph_map.find({face->font_id, font_size, glyph});
+    auto gi = glyph_map.find({face->font_id, font_size, glyph, phase});
     if (gi != glyph_map.end()) {
         return gi->second;
     }
@@ -304,7 +390,9 @@ atlas_entry font_atlas::lookup(font_face *face, int font_size, int glyph,
      */
     gi = glyph_map.find({face->font_id, 0, glyph});
     if (gi != glyph_map.end()) {
-        return resize(face, font_size, glyph, &gi->second);
+        /* copy the template as inserting may grow the map */
+        ae = gi->second;
+        return resize(face, font_size, glyph, &ae);
     }
 
     /*
@@ -312,7 +400,7 @@ atlas_entry font_atlas::lookup(font_face *face, int font_size, int glyph,
      * we check that we got the font size that we requested.
      */
     ae = renderer->render(this, static_cast<font_face_ft*>(face),
-        font_size, glyph);
+        font_size, glyph, phase);
     if (ae.font_size != font_size) {
         return resize(face, font_size, glyph, &ae);
     } else {
@@ -320,6 +408,140 @@ atlas_entry font_atlas::lookup(font_face *face, int font_size, int glyph,
     }
 }
 
+size_t font_atlas::evict(uint32_t frame)
+{
+    /*
+     * evict bins that have not been touched since frame.
+     *
+     * Variable sized entries share the bin of their template, so we
+     * collect the cold bins first and then drop every key that uses them.
+     * The caller is responsible for removing stale manager entries.
+     */
+    std::vector<glyph_key> keys;
+    std::vector<int> bins;
+    for (auto &gi : glyph_map) {
+        int bin_id = gi.second.bin_id;
+        if (bin_id <= 0) continue;
+        uint32_t stamp = (size_t)bin_id < bin_stamp.size() ? bin_stamp[bin_id] : 0;
+        if (stamp >= frame) continue;
+        keys.push_back(gi.first);
+        bins.push_back(bin_id);
+    }
+    for (auto &key : keys) {
+        glyph_map.erase(key);
+    }
+    std::sort(bins.begin(), bins.end());
+    bins.erase(std::unique(bins.begin(), bins.end()), bins.end());
+    for (int bin_id : bins) {
+        bp.free_region(bin_id);
+        if ((size_t)bin_id < bin_stamp.size()) {
+            bin_stamp[bin_id] = 0;
+        }
+    }
+    return bins.size();
+}
+
+bool font_atlas::repack()
+{
+    /*
+     * repack live bins into a fresh bin packer to reclaim the space
+     * fragmented by eviction. bins are placed tallest first, which packs
+     * well with the maximal rectangles packer. if the bins don't fit we
+     * leave the atlas untouched. bins are renumbered so bin ids and
+     * stamps stay dense.
+     */
+    std::map<int,std::pair<bin_rect,bin_rect>> moves;
+    for (auto &gi : glyph_map) {
+        int bin_id = gi.second.bin_id;
+        if (bin_id <= 0 || moves.find(bin_id) != moves.end()) continue;
+        auto ai = bp.alloc_map.find((size_t)bin_id);
+        if (ai == bp.alloc_map.end()) continue;
+        moves[bin_id] = std::make_pair(ai->second, bin_rect());
+    }
+
+    std::vector<int> order;
+    for (auto &m : moves) {
+        order.push_back(m.first);
+    }
+    std::sort(order.begin(), order.end(), [&](int a, int b) {
+        bin_point sa = moves[a].first.size(), sb = moves[b].first.size();
+        if (sa.y != sb.y) return sa.y > sb.y;
+        if (sa.x != sb.x) return sa.x > sb.x;
+        return a < b;
+    });
+
+    bin_packer np(bin_point((int)width,(int)height));
+    np.find_region(0, bin_point(2,2));
+    std::map<int,int> renumber;
+    int bin_id = 1;
+    for (int old_id : order) {
+        auto r = np.find_region(bin_id, moves[old_id].first.size());
+        if (!r.first) {
+            return false;
+        }
+        moves[old_id].second = r.second;
+        renumber[old_id] = bin_id++;
+    }
+
+    /* copy live bins into place from a snapshot of the old pixels */
+    std::vector<uint8_t> old(pixels, pixels + width * height * depth);
+    clear_pixels();
+    uv_pixel();
+    for (auto &m : moves) {
+        bin_rect from = m.second.first, to = m.second.second;
+        size_t row = (size_t)from.width() * depth;
+        for (int y = 0; y < from.height(); y++) {
+            memcpy(pixels + ((to.a.y + y) * width + to.a.x) * depth,
+                &old[((from.a.y + y) * width + from.a.x) * depth], row);
+        }
+    }
+
+    /*
+     * move entries and stamps to their new bins. entries whose bin is not
+     * in the packer, such as those from a stale cache map, were not copied
+     * so they are dropped and the manager drops them when it syncs.
+     */
+    std::vector<glyph_key> lost;
+    std::vector<uint32_t> stamp(bin_id);
+    for (auto &gi : glyph_map) {
+        atlas_entry &ae = gi.second;
+        if (ae.bin_id <= 0) continue;
+        auto mi = moves.find(ae.bin_id);
+        if (mi == moves.end()) {
+            lost.push_back(gi.first);
+            continue;
+        }
+        bin_rect to = mi->second.second;
+        int new_id = renumber[ae.bin_id];
+        stamp[new_id] = (size_t)ae.bin_id < bin_stamp.size() ?
+            bin_stamp[ae.bin_id] : 0;
+        ae.bin_id = new_id;
+        ae.x = (short)to.a.x;
+        ae.y = (short)to.a.y;
+        create_uvs(ae.uv, to);
+    }
+    for (auto &key : lost) {
+        glyph_map.erase(key);
+    }
+
+    bp = np;
+    bin_stamp = stamp;
+    next_bin = bin_id;
+    repack_pending = false;
+    all_dirty();
+    return true;
+}
+
+void font_atlas::clear()
+{
+    /* drop every glyph so the backing store can be reused */
+    reset_bins();
+    bp.find_region(0, bin_point(2,2));
+    clear_pixels();
+    uv_pixel();
+    all_dirty();
+}
+
 std::string font_atlas::get_path(font_face *face, file_type type)
 {
     switch (type) {
@@ -339,7 +561,10 @@ void font_atlas::save_map(font_manager *manager, font_face *face, FILE *out)
         v.push_back(i->first);
     }
     sort(v.begin(), v.end(), [&](const glyph_key &a, const glyph_key &b)
-        -> bool { return glyph_map[a].bin_id < glyph_map[b].bin_id; });
+        -> bool {
+            int ab = glyph_map[a].bin_id, bb = glyph_map[b].bin_id;
+            return ab < bb || (ab == bb && a < b);
+        });
     for (auto &k : v) {
         auto i = glyph_map.find(k);
         const glyph_key &key = i->first;
@@ -365,28 +590,386 @@ void font_atlas::load_map(font_manager *manager, font_face *face, FILE *in)
                 bin_point(ent.x+ent.w+1,ent.y+ent.h+1));
             create_uvs(ent.uv, r);
             bp.create_explicit(ent.bin_id, r);
+            next_bin = std::max(next_bin, ent.bin_id + 1);
             auto gi = glyph_map.insert(glyph_map.end(),
                 std::pair<glyph_key,atlas_entry>({face->font_id, 0, glyph}, ent));
         }
     } while (ret == num_fields);
 }
 
-void font_atlas::save(font_manager *manager, font_face *face)
+/*
+ * atlas cache
+ *
+ * The binary atlas cache lives in the user cache directory and is keyed
+ * by a hash of the font file and a hash of the atlas depth and renderer
+ * parameters, which are both checked in the header. It holds a header, the
+ * bin packer state, the glyph entries and the pixels. Raw pixels are
+ * mapped copy-on-write straight into the atlas, zlib pixels are inflated.
+ */
+
+struct atlas_cache_header
 {
-    std::string img_path = get_path(face, png_file);
-    std::string csv_path = get_path(face, csv_file);
-    FILE *fcsv = fopen(csv_path.c_str(), "w");
-    if (fcsv == nullptr) {
-        Error("error: fopen: %s: %s\n", csv_path.c_str(), strerror(errno));
-        exit(1);
+    char magic[8];
+    uint32_t version;
+    uint32_t endian;
+    uint64_t font_hash;
+    uint64_t param_hash;
+    uint32_t width, height, depth, codec;
+    uint64_t contained_min;
+    uint64_t free_offset, free_count;
+    uint64_t alloc_offset, alloc_count;
+    uint64_t entry_offset, entry_count;
+    uint64_t pixel_offset, pixel_size;
+};
+
+struct atlas_cache_rect
+{
+    int32_t x1, y1, x2, y2;
+};
+
+struct atlas_cache_alloc
+{
+    int64_t idx;
+    atlas_cache_rect rect;
+};
+
+struct atlas_cache_entry
+{
+    int32_t glyph, font_size, phase;
+    atlas_entry ent;
+};
+
+static const char atlas_cache_magic[8] = { 'c','u','t','t','y','a','t','l' };
+static const uint32_t atlas_cache_endian = 0x01020304;
+static const size_t atlas_cache_page = 4096;
+static const uint32_t max_cache_dim = 1 << 16;
+
+static uint64_t atlas_cache_fnv(uint64_t h, const void *buf, size_t len)
+{
+    const uint8_t *data = (const uint8_t*)buf;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ data[i]) * 0x100000001b3ull;
     }
-    save_map(manager, face, fcsv);
-    fclose(fcsv);
-    image::saveToFile(img_path, img);
+    return h;
+}
+
+static uint64_t atlas_cache_hash(font_face *face)
+{
+    /* FNV-1a over the font file contents, once per face */
+    if (face->content_hash != 0) {
+        return face->content_hash;
+    }
+    file_ptr fp = file::getFile(face->path);
+    const uint8_t *data = (const uint8_t*)fp->getBuffer();
+    ssize_t len = fp->getLength();
+    if (!data || len <= 0) {
+        return 0;
+    }
+    face->content_hash = atlas_cache_fnv(0xcbf29ce484222325ull, data, len);
+    return face->content_hash;
+}
+
+static uint64_t atlas_cache_params(font_face *face, size_t depth, int dpi,
+    double range)
+{
+    /* glyphs drawn with another distance range or resolution differ */
+    uint64_t h = 0xcbf29ce484222325ull;
+    uint32_t color = (face->flags & font_face_color) != 0;
+    uint32_t d = (uint32_t)depth;
+    h = atlas_cache_fnv(h, &d, sizeof(d));
+    h = atlas_cache_fnv(h, &color, sizeof(color));
+    h = atlas_cache_fnv(h, &dpi, sizeof(dpi));
+    h = atlas_cache_fnv(h, &range, sizeof(range));
+    return h;
+}
+
+static uint8_t* atlas_cache_map(std::string path, size_t *size)
+{
+#ifndef _WIN32
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat st;
+    void *addr = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        addr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (addr == MAP_FAILED) {
+        return nullptr;
+    }
+    *size = st.st_size;
+    return (uint8_t*)addr;
+#else
+    FILE *f = fopen(path.c_str(), "rb");
+    if (f == nullptr) {
+        return nullptr;
+    }
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *addr = len > 0 ? new uint8_t[len] : nullptr;
+    if (addr && fread(addr, 1, len, f) != (size_t)len) {
+        delete [] addr;
+        addr = nullptr;
+    }
+    fclose(f);
+    *size = len;
+    return addr;
+#endif
+}
+
+static void atlas_cache_unmap(uint8_t *addr, size_t size)
+{
+#ifndef _WIN32
+    munmap(addr, size);
+#else
+    delete [] addr;
+#endif
+}
+
+static bool atlas_cache_write(FILE *f, const void *buf, size_t len, size_t *offset)
+{
+    size_t pad = (atlas_cache_page - (*offset % atlas_cache_page)) % atlas_cache_page;
+    static const char zero[atlas_cache_page] = {};
+    if (fwrite(zero, 1, pad, f) != pad || fwrite(buf, 1, len, f) != len) {
+        return false;
+    }
+    *offset += pad + len;
+    return true;
+}
+
+std::string font_atlas::get_cache_path(font_face *face, size_t depth)
+{
+    uint64_t hash = atlas_cache_hash(face);
+    if (hash == 0) {
+        return std::string();
+    }
+    std::string dir = file::getCacheDir();
+    if (!file::makeDir(dir) || !file::makeDir(dir + "/cutty")) {
+        return std::string();
+    }
+    char name[64];
+    snprintf(name, sizeof(name), "/cutty/%016llx-%016llx.atlas",
+        (unsigned long long)hash,
+        (unsigned long long)atlas_cache_params(face, depth, dpi, range));
+    return dir + name;
 }
 
-void font_atlas::load(font_manager *manager, font_face *face)
+bool font_atlas::save_cache(font_face *face, cache_codec codec)
 {
+    std::string path = get_cache_path(face, depth);
+    if (path.size() == 0 || !pixels) {
+        return false;
+    }
+
+    std::vector<atlas_cache_rect> free_rects;
+    for (auto &r : bp.free_rects()) {
+        free_rects.push_back({r.a.x, r.a.y, r.b.x, r.b.y});
+    }
+    std::vector<atlas_cache_alloc> allocs;
+    for (auto &a : bp.alloc_map) {
+        allocs.push_back({(int64_t)a.first,
+            {a.second.a.x, a.second.a.y, a.second.b.x, a.second.b.y}});
+    }
+    std::vector<atlas_cache_entry> entries;
+    for (auto &e : glyph_map) {
+        entries.push_back({e.first.glyph(), e.first.font_size(),
+            e.first.phase(), e.second});
+    }
+
+    size_t pixel_size = width * height * depth;
+    std::vector<uint8_t> zbuf;
+    const uint8_t *pixel_data = pixels;
+    if (codec == cache_zlib) {
+        uLongf zlen = compressBound((uLong)pixel_size);
+        zbuf.resize(zlen);
+        if (compress2(zbuf.data(), &zlen, pixels, (uLong)pixel_size,
+            Z_BEST_SPEED) != Z_OK) {
+            Error("error: compress2 failed: %s\n", path.c_str());
+            return false;
+        }
+        zbuf.resize(zlen);
+        pixel_data = zbuf.data();
+        pixel_size = zlen;
+    }
+
+    atlas_cache_header hdr = {};
+    memcpy(hdr.magic, atlas_cache_magic, sizeof(hdr.magic));
+    hdr.version = CACHE_VERSION;
+    hdr.endian = atlas_cache_endian;
+    hdr.font_hash = atlas_cache_hash(face);
+    hdr.param_hash = atlas_cache_params(face, depth, dpi, range);
+    hdr.width = (uint32_t)width;
+    hdr.height = (uint32_t)height;
+    hdr.depth = (uint32_t)depth;
+    hdr.codec = codec;
+    hdr.contained_min = bp.contained_min;
+
+    /* sections are page aligned so the pixel block can be mapped */
+    size_t offset = sizeof(hdr);
+    auto place = [&](uint64_t &sect_offset, size_t len) {
+        offset += (atlas_cache_page - (offset % atlas_cache_page)) % atlas_cache_page;
+        sect_offset = offset;
+        offset += len;
+    };
+    place(hdr.free_offset, free_rects.size() * sizeof(atlas_cache_rect));
+    hdr.free_count = free_rects.size();
+    place(hdr.alloc_offset, allocs.size() * sizeof(atlas_cache_alloc));
+    hdr.alloc_count = allocs.size();
+    place(hdr.entry_offset, entries.size() * sizeof(atlas_cache_entry));
+    hdr.entry_count = entries.size();
+    place(hdr.pixel_offset, pixel_size);
+    hdr.pixel_size = pixel_size;
+
+    /* write to a temporary file and rename it into place */
+    std::string tmp_path = path + ".tmp";
+    FILE *f = fopen(tmp_path.c_str(), "wb");
+    if (f == nullptr) {
+        Error("error: fopen: %s: %s\n", tmp_path.c_str(), strerror(errno));
+        return false;
+    }
+    offset = 0;
+    bool ok = fwrite(&hdr, 1, sizeof(hdr), f) == sizeof(hdr);
+    offset += sizeof(hdr);
+    ok = ok && atlas_cache_write(f, free_rects.data(),
+        free_rects.size() * sizeof(atlas_cache_rect), &offset);
+    ok = ok && atlas_cache_write(f, allocs.data(),
+        allocs.size() * sizeof(atlas_cache_alloc), &offset);
+    ok = ok && atlas_cache_write(f, entries.data(),
+        entries.size() * sizeof(atlas_cache_entry), &offset);
+    ok = ok && atlas_cache_write(f, pixel_data, pixel_size, &offset);
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        Error("error: failed to write atlas cache: %s\n", path.c_str());
+        remove(tmp_path.c_str());
+        return false;
+    }
+
+    Debug("font_atlas: saved cache %s\n", path.c_str());
+    return true;
+}
+
+bool font_atlas::load_cache(font_face *face, size_t depth)
+{
+    std::string path = get_cache_path(face, depth);
+    if (path.size() == 0 || !file::fileExists(path)) {
+        return false;
+    }
+
+    size_t size = 0;
+    uint8_t *addr = atlas_cache_map(path, &size);
+    if (!addr) {
+        return false;
+    }
+
+    /* validate header and section bounds */
+    auto in_bounds = [&](uint64_t offset, uint64_t count, size_t elem) {
+        return offset <= size && count <= (size - offset) / elem;
+    };
+    atlas_cache_header *hdr = (atlas_cache_header*)addr;
+    bool valid = size >= sizeof(atlas_cache_header) &&
+        memcmp(hdr->magic, atlas_cache_magic, sizeof(hdr->magic)) == 0 &&
+        hdr->version == CACHE_VERSION &&
+        hdr->endian == atlas_cache_endian &&
+        hdr->depth == depth &&
+        hdr->width <= max_cache_dim && hdr->height <= max_cache_dim;
+    size_t pixel_size = valid ?
+        (size_t)hdr->width * hdr->height * hdr->depth : 0;
+    valid = valid &&
+        hdr->font_hash == atlas_cache_hash(face) &&
+        hdr->param_hash == atlas_cache_params(face, depth, dpi, range) &&
+        (hdr->codec == cache_raw || hdr->codec == cache_zlib) &&
+        in_bounds(hdr->free_offset, hdr->free_count, sizeof(atlas_cache_rect)) &&
+        in_bounds(hdr->alloc_offset, hdr->alloc_count, sizeof(atlas_cache_alloc)) &&
+        in_bounds(hdr->entry_offset, hdr->entry_count, sizeof(atlas_cache_entry)) &&
+        in_bounds(hdr->pixel_offset, hdr->pixel_size, 1) &&
+        (hdr->codec != cache_raw || hdr->pixel_size == pixel_size);
+    if (!valid) {
+        Debug("font_atlas: stale or invalid cache %s\n", path.c_str());
+        atlas_cache_unmap(addr, size);
+        return false;
+    }
+
+    /* raw pixels point into the private mapping, zlib pixels are inflated */
+    uint8_t *new_pixels;
+    if (hdr->codec == cache_raw) {
+        new_pixels = addr + hdr->pixel_offset;
+    } else {
+        new_pixels = new uint8_t[pixel_size];
+        uLongf len = (uLongf)pixel_size;
+        if (uncompress(new_pixels, &len, addr + hdr->pixel_offset,
+            (uLong)hdr->pixel_size) != Z_OK || len != pixel_size) {
+            Error("error: uncompress failed: %s\n", path.c_str());
+            delete [] new_pixels;
+            atlas_cache_unmap(addr, size);
+            return false;
+        }
+    }
+
+    free_pixels();
+    width = hdr->width;
+    height = hdr->height;
+    this->depth = hdr->depth;
+    pixels = new_pixels;
+    if (hdr->codec == cache_raw) {
+        map_addr = addr;
+        map_size = size;
+    }
+    switch (this->depth) {
+    case 1: img = std::shared_ptr<image>(new image(file_ptr(),
+        (uint)width, (uint)height, pixel_format_alpha, pixels)); break;
+    case 3: img = std::shared_ptr<image>(new image(file_ptr(),
+        (uint)width, (uint)height, pixel_format_rgb, pixels)); break;
+    case 4: img = std::shared_ptr<image>(new image(file_ptr(),
+        (uint)width, (uint)height, pixel_format_rgba, pixels)); break;
+    }
+    uv1x1 = 1.0f / (float)width;
+
+    /* restore bin packer state and glyph entries without replaying */
+    reset_bins();
+    atlas_cache_rect *fr = (atlas_cache_rect*)(addr + hdr->free_offset);
+    bp.free_list.clear();
+    for (size_t i = 0; i < hdr->free_count; i++) {
+        bp.free_list.push_back(bin_rect(bin_point(fr[i].x1, fr[i].y1),
+            bin_point(fr[i].x2, fr[i].y2)));
+    }
+    atlas_cache_alloc *al = (atlas_cache_alloc*)(addr + hdr->alloc_offset);
+    bp.alloc_map.clear();
+    for (size_t i = 0; i < hdr->alloc_count; i++) {
+        bp.alloc_map[(size_t)al[i].idx] = bin_rect(
+            bin_point(al[i].rect.x1, al[i].rect.y1),
+            bin_point(al[i].rect.x2, al[i].rect.y2));
+    }
+    bp.contained_min = hdr->contained_min;
+    atlas_cache_entry *en = (atlas_cache_entry*)(addr + hdr->entry_offset);
+    for (size_t i = 0; i < hdr->entry_count; i++) {
+        glyph_map.insert({{face->font_id, en[i].font_size, en[i].glyph,
+            en[i].phase}, en[i].ent});
+        next_bin = std::max(next_bin, en[i].ent.bin_id + 1);
+    }
+
+    if (hdr->codec != cache_raw) {
+        atlas_cache_unmap(addr, size);
+    }
+
+    Debug("font_atlas: loaded cache %s\n", path.c_str());
+    return true;
+}
+
+void font_atlas::save(font_manager *manager, font_face *face)
+{
+    save_cache(face);
+}
+
+void font_atlas::load(font_manager *manager, font_face *face, size_t depth)
+{
+    if (load_cache(face, depth)) {
+        return;
+    }
+
+    /* fall back to the PNG and CSV next to the font and convert it */
     std::string img_path = get_path(face, png_file);
     std::string csv_path = get_path(face, csv_file);
     if (!file::fileExists(img_path) || !file::fileExists(csv_path)) {
@@ -399,17 +982,23 @@ void font_atlas::load(font_manager *manager, font_face *face)
     }
     image_ptr load_img = image::createFromFile(img_path);
     if (!load_img) {
+        fclose(fcsv);
         return;
     }
+    free_pixels();
     img = load_img;
     pixels = img->move();
     width = img->getWidth();
     height = img->getHeight();
-    depth = img->getBytesPerPixel();
+    this->depth = img->getBytesPerPixel();
     reset_bins();
     uv_pixel();
     load_map(manager, face, fcsv);
     fclose(fcsv);
+
+    if (this->depth == depth) {
+        save_cache(face);
+    }
 }
 
 
@@ -507,11 +1096,12 @@ void text_shaper_hb::shape(std::vector<glyph_shape> &shapes, text_segment &segme
 
     /* create text buffers */
     hb_buffer_t *buf = hb_buffer_create();
-    hb_buffer_set_direction(buf, HB_DIRECTION_LTR);
-    hb_buffer_set_script(buf, HB_SCRIPT_LATIN);
     hb_buffer_set_language(buf, hblang);
     hb_buffer_add_utf8(buf, text, (int)text_len, 0, (int)text_len);
 
+    /* script and direction come from the text so complex scripts shape */
+    hb_buffer_guess_segment_properties(buf);
+
     /* shape text with HarfBuzz */
     hb_shape(hbfont, buf, NULL, 0);
     glyph_info = hb_buffer_get_glyph_infos(buf, &glyph_count);
@@ -533,7 +1123,7 @@ void text_shaper_hb::shape(std::vector<glyph_shape> &shapes, text_segment &segme
  */
 
 atlas_entry glyph_renderer_outline_ft::render(font_atlas *atlas, font_face_ft *face,
-    int font_size, int glyph)
+    int font_size, int glyph, int phase)
 {
     FT_Library ftlib;
     FT_Face ftface;
@@ -541,6 +1131,7 @@ atlas_entry glyph_renderer_outline_ft::render(font_atlas *atlas, font_face_ft *f
     FT_GlyphSlot ftglyph;
     FT_Raster_Params rp;
     int ox, oy, w, h;
+    int shift = phase * (64 / glyph_subpixel_phases);
     atlas_entry ae;
 
     /* freetype library and glyph pointers */
@@ -572,14 +1163,38 @@ atlas_entry glyph_renderer_outline_ft::render(font_atlas *atlas, font_face_ft *f
     rp.bit_test = 0;
     rp.gray_spans = span_vector::fn;
 
+    /*
+     * shift the outline right for subpixel positioned variants. the
+     * horizontal extent comes from the shifted outline as the shift can
+     * carry coverage into the next pixel column.
+     */
+    FT_BBox cbox;
+    if (shift > 0) {
+        FT_Outline_Translate(&ftglyph->outline, shift, 0);
+    }
+    FT_Outline_Get_CBox(&ftglyph->outline, &cbox);
+
     /* font dimensions */
-    ox = (int)floorf((float)ftglyph->metrics.horiBearingX / 64.0f) - 1;
+    ox = (int)floorf((float)cbox.xMin / 64.0f) - 1;
     oy = (int)floorf((float)(ftglyph->metrics.horiBearingY -
         ftglyph->metrics.height) / 64.0f) - 1;
-    w = (int)ceilf(ftglyph->metrics.width / 64.0f) + 2;
+    w = (int)ceilf((float)cbox.xMax / 64.0f) + 1 - ox;
     h = (int)ceilf(ftglyph->metrics.height / 64.0f) + 2;
 
-    /* set up span vector dimensions */
+    if (ftglyph->outline.n_contours == 0) {
+        /* create atlas entry for white space glyph with zero dimensions */
+        return atlas->create(face, font_size, glyph, font_size, 0, 0, 0, 0,
+            phase);
+    }
+
+    /* create atlas entry for glyph using dimensions from outline */
+    ae = atlas->create(face, font_size, glyph, font_size, ox, oy, w, h,
+        phase);
+    if (ae.bin_id < 0) {
+        return ae;
+    }
+
+    /* set up span vector to write directly into the atlas region */
     span.gx = 0;
     span.gy = 0;
     span.ox = -ox;
@@ -588,7 +1203,122 @@ atlas_entry glyph_renderer_outline_ft::render(font_atlas *atlas, font_face_ft *f
     span.min_y = INT_MAX;
     span.max_x = INT_MIN;
     span.max_y = INT_MIN;
-    span.reset(w, h);
+    span.target(&atlas->pixels[ae.y * atlas->width + ae.x],
+        (int)atlas->width, w, h);
+
+    /* rasterize glyph, giving the region back if it fails */
+    if ((fterr = FT_Outline_Render(ftlib, &ftface->glyph->outline, &rp))) {
+        printf("error: FT_Outline_Render failed: fterr=%d\n", fterr);
+        atlas->release(face, font_size, glyph, phase);
+        return atlas_entry(-1);
+    }
+
+    return ae;
+}
+
+/*
+ * glyph renderer (LCD)
+ */
+
+/* FreeType default FIR filter, the taps sum to 256 */
+static const uint8_t lcd_filter[5] = { 0x08, 0x4d, 0x56, 0x4d, 0x08 };
+
+static inline uint8_t lcd_filter_edge(const uint8_t *src, int n, int x)
+{
+    uint sum = 0;
+    for (int k = 0; k < 5; k++) {
+        int sx = x + k - 2;
+        if (sx < 0 || sx >= n) continue;
+        sum += lcd_filter[k] * src[sx];
+    }
+    return (uint8_t)std::min(sum >> 8, 255u);
+}
+
+static void lcd_filter_row(uint8_t *dst, const uint8_t *src, int n)
+{
+    /* the interior has no bounds checks so the compiler can vectorize it */
+    int e = std::min(2, n);
+    for (int x = 0; x < e; x++) {
+        dst[x] = lcd_filter_edge(src, n, x);
+    }
+    for (int x = 2; x < n - 2; x++) {
+        uint sum = lcd_filter[0] * src[x-2] + lcd_filter[1] * src[x-1] +
+                   lcd_filter[2] * src[x]   + lcd_filter[3] * src[x+1] +
+                   lcd_filter[4] * src[x+2];
+        dst[x] = (uint8_t)(sum >> 8);
+    }
+    for (int x = std::max(e, n - 2); x < n; x++) {
+        dst[x] = lcd_filter_edge(src, n, x);
+    }
+}
+
+atlas_entry glyph_renderer_lcd_ft::render(font_atlas *atlas, font_face_ft *face,
+    int font_size, int glyph, int phase)
+{
+    FT_Library ftlib;
+    FT_Face ftface;
+    FT_Error fterr;
+    FT_GlyphSlot ftglyph;
+    FT_Raster_Params rp;
+    FT_Matrix oversample = { 3 << 16, 0, 0, 1 << 16 };
+    FT_BBox cbox;
+    int ox, oy, w, h;
+    int shift = phase * (64 / glyph_subpixel_phases);
+    atlas_entry ae;
+
+    /* freetype library and glyph pointers */
+    ftface = face->ftface;
+    ftglyph = ftface->glyph;
+    ftlib = ftglyph->library;
+
+    /* we need to set up our font metrics */
+    face->get_metrics(font_size);
+
+    /* load glyph */
+    if ((fterr = FT_Load_Glyph(ftface, glyph, FT_LOAD_NO_BITMAP | FT_LOAD_NO_HINTING))) {
+        Error("error: FT_Load_Glyph failed: glyph=%d fterr=%d\n",
+            glyph, fterr);
+        return atlas_entry(-1);
+    }
+    if (ftface->glyph->format != FT_GLYPH_FORMAT_OUTLINE) {
+        Error("error: FT_Load_Glyph format is not outline: format=\n",
+            ftface->glyph->format);
+        return atlas_entry(-1);
+    }
+
+    /* set up render parameters */
+    rp.target = 0;
+    rp.flags = FT_RASTER_FLAG_DIRECT | FT_RASTER_FLAG_AA;
+    rp.user = &span;
+    rp.black_spans = 0;
+    rp.bit_set = 0;
+    rp.bit_test = 0;
+    rp.gray_spans = span_vector::fn;
+
+    /* shift for the subpixel phase then measure in whole pixels */
+    if (shift > 0) {
+        FT_Outline_Translate(&ftglyph->outline, shift, 0);
+    }
+    FT_Outline_Get_CBox(&ftglyph->outline, &cbox);
+
+    /* font dimensions, the margin holds the spread of the filter */
+    ox = (int)floorf((float)cbox.xMin / 64.0f) - 1;
+    oy = (int)floorf((float)(ftglyph->metrics.horiBearingY -
+        ftglyph->metrics.height) / 64.0f) - 1;
+    w = (int)ceilf((float)cbox.xMax / 64.0f) + 1 - ox;
+    h = (int)ceilf(ftglyph->metrics.height / 64.0f) + 2;
+
+    /* rasterize with three horizontal samples per pixel, one per subpixel */
+    FT_Outline_Transform(&ftglyph->outline, &oversample);
+    span.gx = 0;
+    span.gy = 0;
+    span.ox = -ox * 3;
+    span.oy = -oy;
+    span.min_x = INT_MAX;
+    span.min_y = INT_MAX;
+    span.max_x = INT_MIN;
+    span.max_y = INT_MIN;
+    span.reset(w * 3, h);
 
     /* rasterize glyph */
     if ((fterr = FT_Outline_Render(ftlib, &ftface->glyph->outline, &rp))) {
@@ -598,17 +1328,19 @@ atlas_entry glyph_renderer_outline_ft::render(font_atlas *atlas, font_face_ft *f
 
     if (span.min_x == INT_MAX && span.min_y == INT_MAX) {
         /* create atlas entry for white space glyph with zero dimensions */
-        ae = atlas->create(face, font_size, glyph, font_size, 0, 0, 0, 0);
+        ae = atlas->create(face, font_size, glyph, font_size, 0, 0, 0, 0,
+            phase);
     } else {
         /* create atlas entry for glyph using dimensions from span */
-        ae = atlas->create(face, font_size, glyph, font_size, ox, oy, w, h);
+        ae = atlas->create(face, font_size, glyph, font_size, ox, oy, w, h,
+            phase);
 
-        /* copy pixels from span to atlas */
+        /* filter subpixel samples into RGB coverage to reduce fringing */
         if (ae.bin_id >= 0) {
             for (int i = 0; i < span.h; i++) {
-                size_t src = i * span.w;
-                size_t dst = (ae.y + i) * atlas->width + ae.x;
-                memcpy(&atlas->pixels[dst], &span.pixels[src], span.w);
+                lcd_filter_row(&atlas->pixels[((ae.y + i) * atlas->width +
+                    ae.x) * font_atlas::LCD_DEPTH], &span.pixels[i * span.w],
+                    span.w);
             }
         }
     }
@@ -618,10 +1350,79 @@ atlas_entry glyph_renderer_outline_ft::render(font_atlas *atlas, font_face_ft *f
 
 /*
  * glyph renderer (bitmap)
+ *
+ * row kernels convert one row of a FreeType bitmap into atlas pixels.
+ * a kernel is chosen once per glyph for the bitmap pixel mode and the
+ * atlas depth, so the inner loops are free of per pixel branches.
  */
 
+typedef void (*blit_row_fn)(uint8_t *dst, const uint8_t *src, int w);
+
+static inline void store_u32(uint8_t *p, uint32_t v) { memcpy(p, &v, 4); }
+static inline uint32_t load_u32(const uint8_t *p) { uint32_t v; memcpy(&v, p, 4); return v; }
+
+static void blit_mono_alpha(uint8_t *dst, const uint8_t *src, int w)
+{
+    /* 1-bit pixels are packed most significant bit first */
+    for (int j = 0; j < w; j++) {
+        dst[j] = ((src[j >> 3] >> (7 - (j & 7))) & 1) ? 0xff : 0x00;
+    }
+}
+
+static void blit_mono_rgba(uint8_t *dst, const uint8_t *src, int w)
+{
+    for (int j = 0; j < w; j++) {
+        store_u32(dst + j * 4, ((src[j >> 3] >> (7 - (j & 7))) & 1) ?
+            0xffffffff : 0x00000000);
+    }
+}
+
+static void blit_gray_alpha(uint8_t *dst, const uint8_t *src, int w)
+{
+    memcpy(dst, src, w);
+}
+
+static void blit_gray_rgba(uint8_t *dst, const uint8_t *src, int w)
+{
+    for (int j = 0; j < w; j++) {
+        store_u32(dst + j * 4, (uint32_t)src[j] * 0x01010101u);
+    }
+}
+
+static void blit_bgra_alpha(uint8_t *dst, const uint8_t *src, int w)
+{
+    for (int j = 0; j < w; j++) {
+        dst[j] = src[j * 4 + 3];
+    }
+}
+
+static void blit_bgra_rgba(uint8_t *dst, const uint8_t *src, int w)
+{
+    /* FreeType BGRA is premultiplied so only red and blue are swapped */
+    for (int j = 0; j < w; j++) {
+        uint32_t v = load_u32(src + j * 4);
+        store_u32(dst + j * 4, (v & 0xff00ff00u) | ((v >> 16) & 0xffu) |
+            ((v & 0xffu) << 16));
+    }
+}
+
+static blit_row_fn blit_select(int pixel_mode, size_t depth)
+{
+    bool rgba = depth == font_atlas::COLOR_DEPTH;
+    if (depth != font_atlas::GRAY_DEPTH && !rgba) {
+        return nullptr;
+    }
+    switch (pixel_mode) {
+    case FT_PIXEL_MODE_MONO: return rgba ? blit_mono_rgba : blit_mono_alpha;
+    case FT_PIXEL_MODE_GRAY:
+    case FT_PIXEL_MODE_LCD: return rgba ? blit_gray_rgba : blit_gray_alpha;
+    case FT_PIXEL_MODE_BGRA: return rgba ? blit_bgra_rgba : blit_bgra_alpha;
+    default: return nullptr;
+    }
+}
+
 atlas_entry glyph_renderer_color_ft::render(font_atlas *atlas, font_face_ft *face,
-    int font_size, int glyph)
+    int font_size, int glyph, int phase)
 {
     FT_Library ftlib;
     FT_Face ftface;
@@ -683,44 +1484,17 @@ atlas_entry glyph_renderer_color_ft::render(font_atlas *atlas, font_face_ft *fac
         ae = atlas->create(face, font_size, glyph, font_size, ox, oy-h, w, h);
     }
 
-    /* copy pixels from bitmap to atlas  */
+    /* copy pixels from bitmap to atlas, flipping rows */
     if (ae.bin_id >= 0) {
-        int bit_depth;
-        switch (bitmap->pixel_mode) {
-        case FT_PIXEL_MODE_MONO: bit_depth = 1; break;
-        case FT_PIXEL_MODE_GRAY:
-        case FT_PIXEL_MODE_LCD: bit_depth = 8; break;
-        case FT_PIXEL_MODE_BGRA: bit_depth = 32; break;
-        default: abort();
+        blit_row_fn blit = blit_select(bitmap->pixel_mode, atlas->depth);
+        if (!blit) {
+            Error("error: unsupported pixel mode: pixel_mode=%d depth=%zu\n",
+                bitmap->pixel_mode, atlas->depth);
+            abort();
         }
         for (int i = 0; i < h; i++) {
-            for (int j = 0; j < w; j++) {
-                size_t src = (h-i-1) * bitmap->pitch + j * (bit_depth>>3);
-                size_t dst = (ae.y + i) * atlas->width * atlas->depth + (ae.x + j) * atlas->depth;
-                uint32_t rgba = 0xffffffff;
-                switch (bit_depth) {
-                case 1:
-                    rgba = ((bitmap->buffer[src] >> (j & 7)) & 1)
-                            ? 0xffffffff : 0x00000000;
-                    break;
-                case 8:
-                    rgba = ((uint32_t)bitmap->buffer[src] << 24) |
-                           ((uint32_t)bitmap->buffer[src] << 16) |
-                           ((uint32_t)bitmap->buffer[src] << 8) |
-                           (uint32_t)bitmap->buffer[src];
-                    break;
-                case 32:
-                    rgba = ((uint32_t)bitmap->buffer[src+2]) |
-                           ((uint32_t)bitmap->buffer[src+1] << 8) |
-                           ((uint32_t)bitmap->buffer[src+0] << 16) |
-                           ((uint32_t)bitmap->buffer[src+3] << 24);
-                    break;
-                }
-                switch (atlas->depth) {
-                case 1: atlas->pixels[dst] = (uint8_t)rgba; break;
-                case 4: *(uint32_t*)&atlas->pixels[dst] = rgba; break;
-                }
-            }
+            blit(&atlas->pixels[((ae.y + i) * atlas->width + ae.x) * atlas->depth],
+                &bitmap->buffer[(h-i-1) * bitmap->pitch], w);
         }
     }
 
@@ -748,37 +1522,27 @@ void text_renderer_ft::render(draw_list &batch,
     /* lookup glyphs in font atlas, creating them if they don't exist */
     float dx = 0, dy = 0;
     for (auto &shape : shapes) {
-        glyph_entry *ge = manager->lookup(face, font_size/rs, shape.glyph);
+        glm::vec3 v = glm::vec3(segment.x, segment.y, 1.0f) * m;
+        float x = v.x / v.z + dx + shape.x_offset/64.0f, xi;
+        int phase = glyph_subpixel_split(x / rs, &xi);
+        glyph_entry *ge = manager->lookup(face, font_size/rs, shape.glyph, phase);
         if (!ge) continue;
+        /* bitmaps hold the phase so they go on whole device pixels */
+        if (ge->atlas && atlas_subpixel(ge->atlas)) {
+            x = xi * rs;
+        }
         /* create polygons in vertex array */
-        glm::vec3 v = glm::vec3(segment.x, segment.y, 1.0f) * m;
-        float x1 = v.x / v.z + ge->ox * rs + dx + shape.x_offset/64.0f;
+        float x1 = x + ge->ox * rs;
         float x2 = x1 + ge->w * rs;
         float y1 = v.y / v.z - ge->oy * rs + dy + shape.y_offset/64.0f -
             ge->h * rs - baseline_shift;
         float y2 = y1 + ge->h * rs;
         if (ge->w > 0 && ge->h > 0) {
-            float u1 = ge->uv[0], v1 = ge->uv[1];
-            float u2 = ge->uv[2], v2 = ge->uv[3];
-            uint o = (int)batch.vertices.size();
-            // emoji textures need the color to be white
-            uint c = color_enabled ? 0xffffffff :
-                        shape.color ? shape.color : segment.color;
+            uint c = shape.color ? shape.color : segment.color;
             shape.pos[0] = {x1, y1, 0};
             shape.pos[1] = {x2, y2, 0};
-            uint o0 = draw_list_vertex(batch, {{x1, y1, 0}, {u1, v1}, c});
-            uint o1 = draw_list_vertex(batch, {{x2, y1, 0}, {u2, v1}, c});
-            uint o2 = draw_list_vertex(batch, {{x2, y2, 0}, {u2, v2}, c});
-            uint o3 = draw_list_vertex(batch, {{x1, y2, 0}, {u1, v2}, c});
-            // msdf textures are color but font color flag is not set
-            uint shader = ge->atlas->depth == 4 && !color_enabled ?
-                shader_msdf : shader_texture;
-            draw_list_indices(batch, ge->atlas->get_image()->iid, mode_triangles,
-                shader, {o0, o3, o1, o1, o3, o2});
-            draw_list_image_delta(batch, ge->atlas->get_image(), ge->atlas->get_delta(),
-                st_clamp | atlas_image_filter(ge->atlas));
+            render_quad(batch, ge, x1, y1, x2, y2, c, color_enabled);
         }
-        /* TODO - 1/4th pixel glyph caching and sub-pixel advance precision */
         dx += shape.x_advance/64.0f * scale + tracking;
         dy += shape.y_advance/64.0f * scale;
 
@@ -790,4 +1554,32 @@ void text_renderer_ft::render(draw_list &batch,
                 shape.pos[0].x, shape.pos[0].y, shape.pos[1].x, shape.pos[1].y);
         }
     }
-}
\ No newline at end of file
+}
+
+void text_renderer_ft::render_quad(draw_list &batch, glyph_entry *ge,
+    float x1, float y1, float x2, float y2, uint c, bool color_enabled)
+{
+    float u1 = ge->uv[0], v1 = ge->uv[1];
+    float u2 = ge->uv[2], v2 = ge->uv[3];
+    // emoji textures need the color to be white
+    if (color_enabled) c = 0xffffffff;
+    uint o0 = draw_list_vertex(batch, {{x1, y1, 0}, {u1, v1}, c});
+    uint o1 = draw_list_vertex(batch, {{x2, y1, 0}, {u2, v1}, c});
+    uint o2 = draw_list_vertex(batch, {{x2, y2, 0}, {u2, v2}, c});
+    uint o3 = draw_list_vertex(batch, {{x1, y2, 0}, {u1, v2}, c});
+    // msdf textures are color but font color flag is not set
+    uint shader = ge->atlas->depth == 4 && !color_enabled ? shader_msdf :
+        ge->atlas->depth == font_atlas::LCD_DEPTH ? shader_lcd : shader_texture;
+    draw_list_indices(batch, ge->atlas->get_image()->iid, mode_triangles,
+        shader, {o0, o3, o1, o1, o3, o2});
+    /* register the atlas image with any regions that need uploading */
+    image *img = ge->atlas->get_image();
+    int flags = st_clamp | atlas_image_filter(ge->atlas);
+    dirty.clear();
+    if (ge->atlas->get_dirty(dirty) == 0) {
+        draw_list_image(batch, img, flags);
+    }
+    for (auto &r : dirty) {
+        draw_list_image_delta(batch, img, r, flags);
+    }
+}
@@ -29,7 +29,8 @@ inline span_measure::span_measure() :
  * FreeType Span Recorder
  *
  * Collects the output of span coverage into an 8-bit grayscale bitmap.
- * Used as a callback to FT_Outline_Render. 
+ * Used as a callback to FT_Outline_Render. The bitmap is either the
+ * internal pixel vector or a region of an atlas chosen with target().
  */
 
 struct span_vector : span_measure
@@ -37,16 +38,19 @@ struct span_vector : span_measure
     int gx, gy, ox, oy, w, h;
 
     std::vector<uint8_t> pixels;
+    uint8_t *dst;
+    int pitch;
 
     span_vector();
 
     void reset(int width, int height);
+    void target(uint8_t *dst, int pitch, int width, int height);
 
     static void fn(int y, int count, const FT_Span* spans, void *user);
 };
 
 inline span_vector::span_vector() :
-    gx(0), gy(0), ox(0), oy(0), w(0), h(0), pixels() {}
+    gx(0), gy(0), ox(0), oy(0), w(0), h(0), pixels(), dst(nullptr), pitch(0) {}
 
 
 /*
@@ -89,21 +93,31 @@ struct glyph_renderer;
 struct font_atlas
 {
     size_t width, height, depth;
-    std::map<glyph_key,atlas_entry> glyph_map;
+    glyph_hash_map<atlas_entry> glyph_map;
     uint8_t *pixels;
+    uint8_t *map_addr;
+    size_t map_size;
     float uv1x1;
     bin_packer bp;
-    bin_rect delta;
-    std::atomic<bool> multithreading;
+    std::vector<bin_rect> dirty;
+    int next_bin;
+    std::vector<uint32_t> bin_stamp;
+    uint32_t frame;
+    bool repack_pending;
     std::mutex mutex;
     std::shared_ptr<image> img;
+    int dpi;
+    double range;
 
     static const int PADDING = 1;
     static const int DEFAULT_WIDTH = 1024;
     static const int DEFAULT_HEIGHT = 1024;
     static const int GRAY_DEPTH = 1;
+    static const int LCD_DEPTH = 3;
     static const int COLOR_DEPTH = 4;
     static const int MSDF_DEPTH = 4;
+    static constexpr double MSDF_RANGE = 8;
+    static const size_t MAX_DIRTY = 1024;
 
     font_atlas();
     font_atlas(size_t width, size_t height, size_t depth);
@@ -115,6 +129,7 @@ struct font_atlas
     /* internal interfaces */
     void init();
     void create_pixels();
+    void free_pixels();
     void clear_pixels();
     void uv_pixel();
     void reset_bins();
@@ -124,16 +139,24 @@ struct font_atlas
     atlas_entry resize(font_face *face, int font_size, int glyph,
         atlas_entry *tmpl);
     atlas_entry lookup(font_face *face, int font_size, int glyph,
-        glyph_renderer *renderer);
+        glyph_renderer *renderer, int phase = 0);
     atlas_entry create(font_face *face, int font_size, int glyph,
-        int entry_font_size, int ox, int oy, int w, int h);
+        int entry_font_size, int ox, int oy, int w, int h, int phase = 0);
+    void release(font_face *face, int font_size, int glyph, int phase = 0);
 
     /* create entry uvs */
     void create_uvs(float uv[4], bin_rect r);
 
-    /* tracking minimum required update rectangle */
-    bin_rect get_delta();
-    void expand_delta(bin_rect b);
+    /* tracking rectangles that need to be uploaded */
+    size_t get_dirty(std::vector<bin_rect> &rects);
+    void add_dirty(bin_rect b);
+    void all_dirty();
+
+    /* least recently used tracking and reclaiming space */
+    void touch(int bin_id, uint32_t frame);
+    size_t evict(uint32_t frame);
+    bool repack();
+    void clear();
 
     /* persistance */
     enum file_type {
@@ -141,13 +164,30 @@ struct font_atlas
         csv_file,
         png_file,
     };
+    enum cache_codec {
+        cache_raw,
+        cache_zlib,
+    };
+    static const int CACHE_VERSION = 3;
     std::string get_path(font_face *face, file_type type);
+    std::string get_cache_path(font_face *face, size_t depth);
     void save_map(font_manager *manager, font_face *face, FILE *out);
     void load_map(font_manager *manager, font_face *face, FILE *in);
+    bool save_cache(font_face *face, cache_codec codec = cache_raw);
+    bool load_cache(font_face *face, size_t depth);
     void save(font_manager *manager, font_face *face);
-    void load(font_manager *manager, font_face *face);
+    void load(font_manager *manager, font_face *face, size_t depth);
 };
 
+inline void font_atlas::touch(int bin_id, uint32_t frame)
+{
+    if (bin_id < 0) return;
+    if ((size_t)bin_id >= bin_stamp.size()) {
+        bin_stamp.resize(bin_id + 1);
+    }
+    bin_stamp[bin_id] = frame;
+}
+
 inline int atlas_image_filter(font_atlas *atlas)
 {
     /*
@@ -162,6 +202,13 @@ inline int atlas_image_filter(font_atlas *atlas)
     return filter_linear;
 }
 
+inline bool atlas_subpixel(font_atlas *atlas)
+{
+    /* coverage bitmaps hold a subpixel phase so go on whole pixels */
+    return atlas->depth == font_atlas::GRAY_DEPTH ||
+           atlas->depth == font_atlas::LCD_DEPTH;
+}
+
 /*
  * Text Segment
  *
@@ -254,6 +301,9 @@ struct text_shaper_hb : text_shaper
  *
  * Implementation of a simple freetype based glyph renderer. The output
  * of the glyph renderer is a bitmap which is stored in a font atlas.
+ * The outline renderer shifts the outline right by phase quarter pixels,
+ * while the scaled color and MSDF renderers only accept phase zero. The
+ * LCD renderer samples each subpixel and stores filtered RGB coverage.
  */
 
 struct glyph_renderer
@@ -261,7 +311,7 @@ struct glyph_renderer
     virtual ~glyph_renderer() = default;
 
     virtual atlas_entry render(font_atlas* atlas, font_face_ft *face,
-        int font_size, int glyph) = 0;
+        int font_size, int glyph, int phase) = 0;
 };
 
 struct glyph_renderer_outline_ft : glyph_renderer
@@ -272,7 +322,18 @@ struct glyph_renderer_outline_ft : glyph_renderer
     virtual ~glyph_renderer_outline_ft() = default;
 
     atlas_entry render(font_atlas* atlas, font_face_ft *face,
-        int font_size, int glyph);
+        int font_size, int glyph, int phase);
+};
+
+struct glyph_renderer_lcd_ft : glyph_renderer
+{
+    span_vector span;
+
+    glyph_renderer_lcd_ft() = default;
+    virtual ~glyph_renderer_lcd_ft() = default;
+
+    atlas_entry render(font_atlas* atlas, font_face_ft *face,
+        int font_size, int glyph, int phase);
 };
 
 struct glyph_renderer_color_ft : glyph_renderer
@@ -283,7 +344,7 @@ struct glyph_renderer_color_ft : glyph_renderer
     virtual ~glyph_renderer_color_ft() = default;
 
     atlas_entry render(font_atlas* atlas, font_face_ft *face,
-        int font_size, int glyph);
+        int font_size, int glyph, int phase);
 };
 
 
@@ -311,6 +372,7 @@ struct text_renderer_ft : text_renderer
 {
     font_manager* manager;
     std::unique_ptr<glyph_renderer> renderer;
+    std::vector<bin_rect> dirty;
     float rs;
 
     text_renderer_ft(font_manager* manager);
@@ -320,6 +382,8 @@ struct text_renderer_ft : text_renderer
     void render(draw_list &batch,
         std::vector<glyph_shape> &shapes,
         text_segment &segment, glm::mat3 m = glm::mat3(1));
+    void render_quad(draw_list &batch, glyph_entry *ge,
+        float x1, float y1, float x2, float y2, uint c, bool color_enabled);
 };
 
 inline text_renderer_ft::text_renderer_ft(font_manager* manager) :
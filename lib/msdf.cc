@@ -101,7 +101,7 @@ static int ftCubicTo(const FT_Vector *control1, const FT_Vector *control2,
  */
 
 atlas_entry glyph_renderer_msdf::render(font_atlas *atlas, font_face_ft *face,
-	int font_size, int glyph)
+	int font_size, int glyph, int phase)
 {
     msdfgen::Shape shape;
     msdfgen::Vector2 translate, scale = { 1, 1 };
@@ -112,8 +112,8 @@ atlas_entry glyph_renderer_msdf::render(font_atlas *atlas, font_face_ft *face,
     atlas_entry ae;
 
     int char_height = 128 * 64; /* magic - shader uses textureSize() */
-    int horz_resolution = font_manager::dpi;
-	double range = 8;
+    int horz_resolution = atlas->dpi;
+    double range = atlas->range;
     bool overlapSupport = true;
     bool scanlinePass = true;
     double angleThreshold = 3;
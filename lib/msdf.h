@@ -10,5 +10,5 @@ struct glyph_renderer_msdf : glyph_renderer
     virtual ~glyph_renderer_msdf() = default;
 
     atlas_entry render(font_atlas* atlas, font_face_ft *face,
-    	int font_size, int glyph);
+    	int font_size, int glyph, int phase);
 };
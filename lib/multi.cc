@@ -32,6 +32,7 @@
 #include "draw.h"
 #include "font.h"
 #include "glyph.h"
+#include "taskpool.h"
 #include "multi.h"
 #include "logger.h"
 
@@ -41,43 +42,8 @@
 
 static const char log_name[] = "glyph_renderer_worker";
 
-void glyph_renderer_worker::mainloop()
-{
-    std::unique_ptr<glyph_renderer> renderer = renderer_factory.create();
-
-    while (master->running) {
-        size_t total, processing, workitem, processed;
-
-        total = master->total.load(std::memory_order_acquire);
-        processing = master->processing.load(std::memory_order_acquire);
-
-        if (processing >= total) {
-            std::unique_lock<std::mutex> lock(master->mutex);
-            master->request.wait(lock);
-            continue;
-        }
-
-        workitem = master->processing.fetch_add(1, std::memory_order_seq_cst);
-        glyph_render_request r = master->queue[workitem];
-        r.atlas->multithreading.store(true, std::memory_order_release);
-        renderer->render(r.atlas, get_face(r.face), 0, r.glyph);
-        processed = master->processed.fetch_add(1, std::memory_order_seq_cst);
-
-        if (debug) {
-            Debug("%s-%02zu workitem=%zu\t[font=%s, glyph=%d]\n",
-                log_name, worker_num, workitem, r.face->name.c_str(),
-                r.glyph);
-        }
-
-        total = master->total.load(std::memory_order_acquire);
-        if (processed == total - 1) {
-            if (debug) {
-                Debug("%s-%02zu notify-master\n", log_name, worker_num);
-            }
-            master->response.notify_one();
-        }
-    }
-}
+/* FT_New_Face is not thread safe as workers share the FT_Library */
+static std::mutex face_mutex;
 
 font_face_ft* glyph_renderer_worker::get_face(font_face_ft *face)
 {
@@ -85,12 +51,26 @@ font_face_ft* glyph_renderer_worker::get_face(font_face_ft *face)
     if (fi != face_map.end()) {
         return fi->second.get();
     } else {
+        std::lock_guard<std::mutex> lock(face_mutex);
         fi = face_map.insert(face_map.end(), std::make_pair(face,
             std::unique_ptr<font_face_ft>(face->dup_thread())));
         return fi->second.get();
     }
 }
 
+glyph_renderer* glyph_renderer_worker::get_renderer(glyph_renderer_factory *factory)
+{
+    if (!factory) factory = &renderer_factory;
+    auto ri = renderer_map.find(factory);
+    if (ri != renderer_map.end()) {
+        return ri->second.get();
+    } else {
+        ri = renderer_map.insert(renderer_map.end(),
+            std::make_pair(factory, factory->create()));
+        return ri->second.get();
+    }
+}
+
 /*
  * glyph_renderer_multi
  */
@@ -98,15 +78,13 @@ font_face_ft* glyph_renderer_worker::get_face(font_face_ft *face)
 glyph_renderer_multi::glyph_renderer_multi(font_manager* manager,
     glyph_renderer_factory& renderer_factory, size_t num_threads) :
     variable_size(true), manager(manager),
-    workers(), running(true), dedup(), queue(),
-    capacity(1024), total(0), processing(0), processed(0),
-    mutex(), request(), response()
+    workers(), sched(), group(), dedup(), capacity(1024)
 {
     for (size_t i = 0; i < num_threads; i++) {
         workers.push_back(std::make_unique<glyph_renderer_worker>
-            (this, i, renderer_factory));
+            (renderer_factory));
     }
-    queue.resize(1024);
+    sched = std::make_unique<task_scheduler>(workers.size());
 }
 
 glyph_renderer_multi::~glyph_renderer_multi()
@@ -119,69 +97,77 @@ void glyph_renderer_multi::add(std::vector<glyph_shape> &shapes,
 {
     font_face_ft *face = static_cast<font_face_ft*>(segment->face);
     int font_size = segment->font_size;
-    font_atlas *atlas = manager->getCurrentAtlas(face);
+    font_atlas *atlas = manager->getCurrentAtlas(face, font_size);
 
     for (auto shape : shapes) {
         auto gi = atlas->glyph_map.find({face->font_id, 0, shape.glyph});
         if (gi != atlas->glyph_map.end()) continue;
 
-        glyph_render_request r{atlas, face, shape.glyph};
-        auto i = std::lower_bound(dedup.begin(), dedup.end(), r,
-            [](const glyph_render_request &l,
-               const glyph_render_request &r) { return l < r; });
-
-        if (i == dedup.end() || *i != r) {
-            dedup.insert(i, r);
-            enqueue(r);
-        }
+        glyph_render_request r{atlas, face, shape.glyph,
+            variable_size ? 0 : font_size, 0, nullptr};
+        submit(r);
     }
 }
 
-void glyph_renderer_multi::enqueue(glyph_render_request &r)
+bool glyph_renderer_multi::submit(glyph_render_request &r)
 {
-    size_t workitem;
-    do {
-        workitem = total.load(std::memory_order_relaxed);
-        if (workitem == capacity) return;
-        queue[workitem] = r;
-    } while (!total.compare_exchange_strong(workitem, workitem + 1,
-        std::memory_order_seq_cst));
-
-    request.notify_one();
+    auto i = std::lower_bound(dedup.begin(), dedup.end(), r,
+        [](const glyph_render_request &l,
+           const glyph_render_request &r) { return l < r; });
+
+    if (i != dedup.end() && *i == r) {
+        return true;
+    }
+    if (dedup.size() == capacity) {
+        return false;
+    }
+    dedup.insert(i, r);
+    sched->spawn(group, [this, r]() mutable { render(r); });
+    return true;
 }
 
-void glyph_renderer_multi::run()
+void glyph_renderer_multi::render(glyph_render_request &r)
 {
-    /* if no workers or queue empty, do nothing */
-    if (workers.size() == 0 || processed == total) {
-        return;
+    size_t worker_num = sched->worker_index();
+    glyph_renderer_worker *worker = workers[worker_num].get();
+
+    atlas_entry ae = worker->get_renderer(r.factory)->render(r.atlas,
+        worker->get_face(r.face), r.font_size, r.glyph, r.phase);
+    if (ae.bin_id >= 0) {
+        /*
+         * mark the region dirty again now the pixels are written, as
+         * the render thread may have uploaded the region meanwhile.
+         */
+        std::lock_guard<std::mutex> lock(r.atlas->mutex);
+        r.atlas->add_dirty(bin_rect(bin_point(ae.x, ae.y),
+            bin_point(ae.x + ae.w, ae.y + ae.h)));
     }
 
-    /* wake all workers */
-    request.notify_all();
-
-    /* while processed less than queue size, wait for response */
-    while (processed < total) {
-        std::unique_lock<std::mutex> lock(mutex);
-        response.wait(lock);
+    if (debug) {
+        Debug("%s-%02zu [font=%s, glyph=%d]\n",
+            log_name, worker_num, r.face->name.c_str(), r.glyph);
     }
+}
+
+bool glyph_renderer_multi::done()
+{
+    return group.done();
+}
 
-    /* work queue is processed, take lock and clear queue */
-    mutex.lock();
-    total.store(0, std::memory_order_release);
-    processing.store(0, std::memory_order_release);
-    processed.store(0, std::memory_order_release);
+void glyph_renderer_multi::reset()
+{
+    /* tasks are done, so clear the batch */
     dedup.clear();
-    queue.clear();
-    mutex.unlock();
+}
+
+void glyph_renderer_multi::run()
+{
+    sched->wait(group);
+    reset();
 }
 
 void glyph_renderer_multi::shutdown()
 {
-    running = false;
-    request.notify_all();
-    for (size_t i = 0; i < workers.size(); i++) {
-        workers[i]->thread.join();
-    }
-    workers.clear();
-}
\ No newline at end of file
+    /* join the scheduler threads before the worker state is freed */
+    sched.reset();
+}
@@ -4,30 +4,39 @@
 
 /*
  * glyph_render_request
+ *
+ * font_size is zero for variable size renderers. phase is the subpixel
+ * x offset in quarter pixels. factory selects the renderer used by the
+ * worker, or the default factory if it is null.
  */
 
+struct glyph_renderer_factory;
+
 struct glyph_render_request
 {
     font_atlas* atlas;
     font_face_ft *face;
     unsigned glyph;
+    int font_size;
+    int phase;
+    glyph_renderer_factory *factory;
 
     const bool operator==(const glyph_render_request &o) const {
-        return std::tie(atlas, face, glyph) ==
-            std::tie(o.atlas, o.face, o.glyph);
+        return std::tie(atlas, face, glyph, font_size, phase) ==
+            std::tie(o.atlas, o.face, o.glyph, o.font_size, o.phase);
     }
     const bool operator!=(const glyph_render_request &o) const {
-        return std::tie(atlas, face, glyph) !=
-            std::tie(o.atlas, o.face, o.glyph);
+        return std::tie(atlas, face, glyph, font_size, phase) !=
+            std::tie(o.atlas, o.face, o.glyph, o.font_size, o.phase);
     }
     const bool operator<(const glyph_render_request &o) const {
-        return std::tie(atlas, face, glyph) <
-            std::tie(o.atlas, o.face, o.glyph);
+        return std::tie(atlas, face, glyph, font_size, phase) <
+            std::tie(o.atlas, o.face, o.glyph, o.font_size, o.phase);
     }
 };
 
 /*
- * glyph_renderer_worker
+ * glyph_renderer_factory
  */
 
 struct glyph_renderer_factory
@@ -47,37 +56,33 @@ struct glyph_renderer_factory_impl : glyph_renderer_factory
 
 /*
  * glyph_renderer_worker
+ *
+ * per worker faces and renderers. FT_Face is not thread safe so each
+ * worker renders with its own duplicate of every face it is given.
  */
 
-struct glyph_renderer_multi;
-
 struct glyph_renderer_worker
 {
-    static const bool debug = false;
-
-    glyph_renderer_multi* master;
-    size_t worker_num;
     glyph_renderer_factory& renderer_factory;
-    std::thread thread;
     std::map<font_face_ft*,std::unique_ptr<font_face_ft>> face_map;
+    std::map<glyph_renderer_factory*,std::unique_ptr<glyph_renderer>> renderer_map;
 
-    glyph_renderer_worker(glyph_renderer_multi* master, size_t worker_num,
-        glyph_renderer_factory& renderer_factory);
+    glyph_renderer_worker(glyph_renderer_factory& renderer_factory);
 
     font_face_ft* get_face(font_face_ft *face);
-
-    void mainloop();
+    glyph_renderer* get_renderer(glyph_renderer_factory *factory);
 };
 
 inline glyph_renderer_worker::glyph_renderer_worker(
-    glyph_renderer_multi* master, size_t worker_num,
     glyph_renderer_factory& renderer_factory) :
-    master(master), worker_num(worker_num),
-    renderer_factory(renderer_factory),
-    thread(&glyph_renderer_worker::mainloop, this) {}
+    renderer_factory(renderer_factory) {}
 
 /*
  * glyph_renderer_multi
+ *
+ * renders glyphs as tasks on a work-stealing scheduler. requests are
+ * submitted while a frame is drawn and the batch is committed once the
+ * task group is done, then reset before the next batch is submitted.
  */
 
 struct glyph_renderer_multi
@@ -94,37 +99,31 @@ struct glyph_renderer_multi
     font_manager*                     manager;
 
     /*
-     * multithreaded work queue specific structure members
+     * scheduler specific structure members
      *
-     * workers    - worker threads to process work queue
-     * running    - boolean variable that is cleared to shutdown workers
-     * queue      - storage for work items
-     * capacity   - work item queue capacity
-     * total      - upper bound of items to process, write to start work
-     * processing - upper bound of items processing, written to dequeue work
-     * processed  - lower bound of items processing, written to finish work
-     * mutex      - lock for condition variable
-     * request    - condition variable waited on by workers to start work
-     * response   - condition variable waited on by master on completed work
+     * workers    - per worker state indexed by the scheduler worker index
+     * sched      - work-stealing scheduler that runs the render tasks
+     * group      - render tasks submitted since the last reset
+     * dedup      - sorted requests submitted since the last reset
+     * capacity   - limit of requests submitted between resets
      */
     std::vector<std::unique_ptr<glyph_renderer_worker>> workers;
-    std::atomic<bool>                 running;
+    std::unique_ptr<task_scheduler>   sched;
+    task_group                        group;
     std::vector<glyph_render_request> dedup;
-    std::vector<glyph_render_request> queue;
-    std::atomic<size_t>               capacity;
-    std::atomic<size_t>               total;
-    std::atomic<size_t>               processing;
-    std::atomic<size_t>               processed;
-    std::mutex                        mutex;
-    std::condition_variable           request;
-    std::condition_variable           response;
+    size_t                            capacity;
 
     glyph_renderer_multi(font_manager* manager,
         glyph_renderer_factory& renderer_factory, size_t num_threads);
     virtual ~glyph_renderer_multi();
 
     void add(std::vector<glyph_shape> &shapes, text_segment *segment);
-    void enqueue(glyph_render_request &r);
+    bool submit(glyph_render_request &r);
+    bool done();
+    void reset();
     void run();
     void shutdown();
+
+protected:
+    void render(glyph_render_request &r);
 };
@@ -0,0 +1,182 @@
+// See LICENSE for license details.
+
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <functional>
+#include <condition_variable>
+
+#include "taskpool.h"
+
+/*
+ * the scheduler and worker index of the current thread, so spawn can
+ * push to the caller's own deque and wait knows whether it may help.
+ */
+
+static thread_local task_scheduler *current_sched = nullptr;
+static thread_local size_t current_worker = 0;
+
+/* steal attempts with yields before a worker parks */
+static const int spin_count = 64;
+
+task_scheduler::task_scheduler(size_t num_threads) :
+    threads(), deques(), running(true), queued(0), sleeping(0), inject(0),
+    mutex(), park(), join()
+{
+    if (num_threads == 0) num_threads = 1;
+    for (size_t i = 0; i < num_threads; i++) {
+        deques.push_back(std::make_unique<task_deque>());
+    }
+    for (size_t i = 0; i < num_threads; i++) {
+        threads.push_back(std::thread(&task_scheduler::mainloop, this, i));
+    }
+}
+
+task_scheduler::~task_scheduler()
+{
+    shutdown();
+}
+
+size_t task_scheduler::worker_index()
+{
+    return current_sched == this ? current_worker : num_workers();
+}
+
+void task_scheduler::spawn(task_group &group, task_fn fn)
+{
+    size_t worker = worker_index();
+    if (worker == num_workers()) {
+        worker = inject.fetch_add(1, std::memory_order_relaxed) % num_workers();
+    }
+
+    group.pending.fetch_add(1, std::memory_order_seq_cst);
+    task_deque *d = deques[worker].get();
+    d->mutex.lock();
+    d->tasks.push_back(task{std::move(fn), &group});
+    d->mutex.unlock();
+
+    /*
+     * queued is raised before sleeping is read, and a parking worker
+     * raises sleeping before it reads queued, so one of them sees the
+     * other and the task can't be left behind with every worker parked.
+     */
+    queued.fetch_add(1, std::memory_order_seq_cst);
+    if (sleeping.load(std::memory_order_seq_cst) > 0) {
+        std::lock_guard<std::mutex> lock(mutex);
+        park.notify_one();
+    }
+}
+
+bool task_scheduler::pop(size_t worker, task &t)
+{
+    task_deque *d = deques[worker].get();
+    std::lock_guard<std::mutex> lock(d->mutex);
+    if (d->tasks.empty()) return false;
+    t = std::move(d->tasks.back());
+    d->tasks.pop_back();
+    queued.fetch_sub(1, std::memory_order_seq_cst);
+    return true;
+}
+
+bool task_scheduler::steal(size_t worker, task &t)
+{
+    /* visit the other deques starting with our neighbour */
+    size_t n = num_workers();
+    for (size_t i = 1; i <= n; i++) {
+        task_deque *d = deques[(worker + i) % n].get();
+        if (!d->mutex.try_lock()) continue;
+        if (d->tasks.empty()) {
+            d->mutex.unlock();
+            continue;
+        }
+        t = std::move(d->tasks.front());
+        d->tasks.pop_front();
+        d->mutex.unlock();
+        queued.fetch_sub(1, std::memory_order_seq_cst);
+        return true;
+    }
+    return false;
+}
+
+void task_scheduler::execute(task &t)
+{
+    task_group *group = t.group;
+    t.fn();
+    t.fn = nullptr;
+
+    /* wake threads joining the group when its last task finishes */
+    if (group->pending.fetch_sub(1, std::memory_order_seq_cst) == 1) {
+        std::lock_guard<std::mutex> lock(mutex);
+        join.notify_all();
+    }
+}
+
+void task_scheduler::mainloop(size_t worker)
+{
+    current_sched = this;
+    current_worker = worker;
+
+    task t;
+    int spins = 0;
+    while (running.load(std::memory_order_acquire)) {
+        if (pop(worker, t) || steal(worker, t)) {
+            execute(t);
+            spins = 0;
+            continue;
+        }
+
+        /* spin briefly as new work often follows, then park */
+        if (spins++ < spin_count) {
+            std::this_thread::yield();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        sleeping.fetch_add(1, std::memory_order_seq_cst);
+        park.wait(lock, [&] {
+            return !running.load(std::memory_order_acquire) ||
+                queued.load(std::memory_order_seq_cst) > 0;
+        });
+        sleeping.fetch_sub(1, std::memory_order_seq_cst);
+        spins = 0;
+    }
+}
+
+void task_scheduler::wait(task_group &group)
+{
+    size_t worker = worker_index();
+
+    /* workers help with any queued task until the group is done */
+    if (worker < num_workers()) {
+        task t;
+        while (!group.done()) {
+            if (pop(worker, t) || steal(worker, t)) {
+                execute(t);
+            } else {
+                std::this_thread::yield();
+            }
+        }
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    join.wait(lock, [&] { return group.done(); });
+}
+
+void task_scheduler::shutdown()
+{
+    mutex.lock();
+    running = false;
+    park.notify_all();
+    mutex.unlock();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    threads.clear();
+}
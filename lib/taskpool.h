@@ -0,0 +1,143 @@
+// See LICENSE for license details.
+
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <functional>
+#include <condition_variable>
+
+/*
+ * == Overview ==
+ *
+ * work-stealing task scheduler with one deque per worker thread.
+ *
+ * - workers push and pop their own tasks at the back of their deque
+ * - idle workers steal the oldest task from the front of another deque
+ * - tasks spawned outside the pool are dealt round-robin to the deques
+ * - workers park on a condition variable when every deque is empty
+ *
+ * tasks belong to a task_group which counts pending tasks. spawn forks a
+ * task into a group and wait joins the group. a worker waiting on a group
+ * runs other tasks until the group is done so tasks can fork and join
+ * nested work. other threads block until the group is done, they never
+ * run tasks, so per-worker state can be indexed by worker_index().
+ *
+ * == Usage ==
+ *
+ *   task_scheduler sched(std::thread::hardware_concurrency());
+ *   task_group group;
+ *   for (auto &item : items) {
+ *       sched.spawn(group, [&item]() { process(item); });
+ *   }
+ *   sched.wait(group);
+ *
+ *   parallel_for(sched, 0, items.size(), 16, [&](size_t i) {
+ *       process(items[i]);
+ *   });
+ */
+
+typedef std::function<void()> task_fn;
+
+/*
+ * task_group
+ */
+
+struct task_group
+{
+    std::atomic<size_t> pending;
+
+    task_group() : pending(0) {}
+    task_group(const task_group&) = delete;
+    task_group& operator=(const task_group&) = delete;
+
+    bool done() { return pending.load(std::memory_order_acquire) == 0; }
+};
+
+/*
+ * task_scheduler
+ */
+
+struct task_scheduler
+{
+    struct task
+    {
+        task_fn fn;
+        task_group *group;
+    };
+
+    struct task_deque
+    {
+        std::mutex mutex;
+        std::deque<task> tasks;
+    };
+
+    /*
+     * scheduler structure members
+     *
+     * threads   - worker threads
+     * deques    - per worker deque of tasks
+     * running   - boolean variable that is cleared to shutdown workers
+     * queued    - count of tasks in all deques, tested before parking
+     * sleeping  - count of parked workers, tested before signalling
+     * inject    - next deque for tasks spawned outside the pool
+     * mutex     - lock for the park and join condition variables
+     * park      - condition variable waited on by idle workers
+     * join      - condition variable waited on by threads in wait
+     */
+    std::vector<std::thread>                  threads;
+    std::vector<std::unique_ptr<task_deque>>  deques;
+    std::atomic<bool>                         running;
+    std::atomic<size_t>                       queued;
+    std::atomic<size_t>                       sleeping;
+    std::atomic<size_t>                       inject;
+    std::mutex                                mutex;
+    std::condition_variable                   park;
+    std::condition_variable                   join;
+
+    task_scheduler(size_t num_threads);
+    ~task_scheduler();
+
+    size_t num_workers() { return deques.size(); }
+
+    /* index of the calling worker, or num_workers() for other threads */
+    size_t worker_index();
+
+    void spawn(task_group &group, task_fn fn);
+    void wait(task_group &group);
+    void shutdown();
+
+protected:
+    void mainloop(size_t worker);
+    bool pop(size_t worker, task &t);
+    bool steal(size_t worker, task &t);
+    void execute(task &t);
+};
+
+/*
+ * parallel_for
+ *
+ * runs fn(i) for i in [begin, end) in chunks of grain items and returns
+ * when every item is done. chunks are spawned to the calling worker's
+ * deque or dealt to all deques, then stolen by idle workers.
+ */
+
+template <typename FN>
+void parallel_for(task_scheduler &sched, size_t begin, size_t end,
+    size_t grain, FN fn)
+{
+    task_group group;
+    if (grain == 0) grain = 1;
+    for (size_t i = begin; i < end; i += grain) {
+        size_t j = std::min(i + grain, end);
+        sched.spawn(group, [&fn, i, j]() {
+            for (size_t k = i; k < j; k++) fn(k);
+        });
+    }
+    sched.wait(group);
+}
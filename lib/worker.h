@@ -78,10 +78,14 @@ struct pool_executor
      *
      * workers    - worker threads to process work queue
      * running    - boolean variable that is cleared to shutdown workers
-     * queue      - storage for work items
+     * queue      - ring of work items indexed by count modulo queue size
+     * base       - total when the queue was last drained by run
      * total      - upper bound of items to process, write to start work
      * processing - upper bound of items processing, written to dequeue work
      * processed  - lower bound of items processing, written to finish work
+     *
+     * counters only increase so a worker holding a stale total can't
+     * claim an item past the end of the queue when it is reused.
      * mutex      - lock for condition variable
      * request    - condition variable waited on by workers
      * response   - condition variable waited on by executor
@@ -89,6 +93,7 @@ struct pool_executor
     std::vector<std::unique_ptr<pool_worker_thread<ITEM,WORKER>>> workers;
     std::atomic<bool>                 running;
     std::vector<ITEM>                 queue;
+    std::atomic<size_t>               base;
     std::atomic<size_t>               total;
     std::atomic<size_t>               processing;
     std::atomic<size_t>               processed;
@@ -147,27 +152,34 @@ void pool_worker_thread<ITEM,WORKER>::mainloop()
     std::unique_ptr<pool_worker<ITEM>> worker(worker_factory());
 
     while (dispatcher.running) {
-        size_t total, processing, workitem, processed;
+        size_t total, workitem, processed;
 
         /* find out how many items still need processing */
         total = dispatcher.total.load(std::memory_order_acquire);
-        processing = dispatcher.processing.load(std::memory_order_acquire);
+        workitem = dispatcher.processing.load(std::memory_order_acquire);
 
         /* sleep on dispatcher condition if there is no work */
-        if (processing >= total) {
+        if (workitem >= total) {
             std::unique_lock<std::mutex> lock(dispatcher.mutex);
-            dispatcher.request.wait(lock);
+            dispatcher.request.wait(lock, [&] {
+                return !dispatcher.running ||
+                    dispatcher.processing < dispatcher.total;
+            });
             continue;
         }
 
-        /* dequeue work-item and process it */
-        workitem = dispatcher.processing.fetch_add(1, std::memory_order_seq_cst);
-        (*worker)(dispatcher.queue[workitem]);
+        /* claim work-item, retrying if another worker dequeued it */
+        if (!dispatcher.processing.compare_exchange_weak(workitem,
+            workitem + 1, std::memory_order_seq_cst)) {
+            continue;
+        }
+        (*worker)(dispatcher.queue[workitem % dispatcher.queue.size()]);
         processed = dispatcher.processed.fetch_add(1, std::memory_order_seq_cst);
 
         /* notify dispatcher when last item has been processed */
         total = dispatcher.total.load(std::memory_order_acquire);
         if (processed == total - 1) {
+            std::lock_guard<std::mutex> lock(dispatcher.mutex);
             dispatcher.response.notify_one();
         }
     }
@@ -181,7 +193,8 @@ template <typename ITEM, typename WORKER>
 pool_executor<ITEM,WORKER>::pool_executor(size_t num_threads, size_t queue_size,
     const worker_factory_fn &worker_factory
 ) :
-    workers(), running(true), queue(), total(0), processing(0), processed(0),
+    workers(), running(true), queue(), base(0), total(0), processing(0),
+    processed(0),
     mutex(), request(), response()
 {
     for (size_t i = 0; i < num_threads; i++) {
@@ -209,11 +222,14 @@ bool pool_executor<ITEM,WORKER>::enqueue(const ITEM &item)
     size_t workitem;
     do {
         workitem = total.load(std::memory_order_relaxed);
-        if (workitem == queue.size()) return false;
-        queue[workitem] = item;
+        if (workitem - base.load(std::memory_order_relaxed) == queue.size()) {
+            return false;
+        }
+        queue[workitem % queue.size()] = item;
     } while (!total.compare_exchange_strong(workitem, workitem + 1,
         std::memory_order_seq_cst));
 
+    std::lock_guard<std::mutex> lock(mutex);
     request.notify_one();
     return true;
 }
@@ -221,33 +237,31 @@ bool pool_executor<ITEM,WORKER>::enqueue(const ITEM &item)
 template <typename ITEM, typename WORKER>
 void pool_executor<ITEM,WORKER>::run()
 {
-    /* if no workers or queue empty, do nothing */
-    if (workers.size() == 0 || processed == total) {
+    /* if no workers, do nothing */
+    if (workers.size() == 0) {
         return;
     }
 
-    /* wake all workers */
+    /*
+     * wake all workers and wait until processed reaches the queue size.
+     * conditions are signalled with the lock held so that a wakeup
+     * can't be lost between testing a predicate and waiting.
+     */
+    std::unique_lock<std::mutex> lock(mutex);
     request.notify_all();
+    response.wait(lock, [&] { return processed >= total; });
 
-    /* while processed less than queue size, wait for response */
-    while (processed < total) {
-        std::unique_lock<std::mutex> lock(mutex);
-        response.wait(lock);
-    }
-
-    /* work queue is processed, take lock and clear queue */
-    mutex.lock();
-    total.store(0, std::memory_order_release);
-    processing.store(0, std::memory_order_release);
-    processed.store(0, std::memory_order_release);
-    mutex.unlock();
+    /* work queue is processed, so all of it can be reused */
+    base.store(total.load(std::memory_order_acquire), std::memory_order_release);
 }
 
 template <typename ITEM, typename WORKER>
 void pool_executor<ITEM,WORKER>::shutdown()
 {
+    mutex.lock();
     running = false;
     request.notify_all();
+    mutex.unlock();
     for (size_t i = 0; i < workers.size(); i++) {
         workers[i]->thread.join();
     }
@@ -0,0 +1,15 @@
+#include "capture.h"
+
+int main()
+{
+    initscr();
+    linenum();
+    printf("\x1b[5;20r");         /* set scroll region */
+    printf("\x1b[8;1H");          /* goto abs 8,1 */
+    printf("\x1b[50M");           /* delete 50 lines */
+    printf("\x1b[10;1H");         /* goto abs 10,1 */
+    printf("\x1b[2L");            /* insert 2 lines */
+    printf("\x1b[8;1H");          /* goto abs 8,1 */
+    printf("deleted 50 lines\n");
+    capture();
+}
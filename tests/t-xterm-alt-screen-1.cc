@@ -0,0 +1,15 @@
+#include "capture.h"
+
+int main()
+{
+    initscr();
+    linenum();
+    printf("\x1b[?1049h");        /* save cursor and enter alt screen */
+    printf("\x1b[1;1H");          /* goto abs 1,1 */
+    for (size_t i = 1; i <= 40; i++) {
+        printf("alt %zu\n", i);   /* scroll the alt screen */
+    }
+    printf("\x1b[?1049l");        /* leave alt screen and restore cursor */
+
+    capture();
+}
@@ -0,0 +1,19 @@
+#include "capture.h"
+
+int main()
+{
+    initscr();
+    printf("\x1b[?1049h");        /* save cursor and enter alt screen */
+    linenum();
+    printf("\x1b[5;20r");         /* set scroll region */
+    printf("\x1b[10;1H");         /* goto abs 10,1 */
+    printf("\x1b[3M");            /* delete 3 lines */
+    printf("\x1b[20;1H");         /* goto abs 20,1 */
+    printf("\r\n");               /* CR LF */
+    printf("\x1b[5;1H");          /* goto abs 5,1 */
+    printf("\x1bM");              /* reverse index */
+    printf("\x1b[7;1H");          /* goto abs 7,1 */
+    printf("\x1b[2L");            /* insert 2 lines */
+
+    capture();
+}
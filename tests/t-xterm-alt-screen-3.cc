@@ -0,0 +1,15 @@
+#include "capture.h"
+
+int main()
+{
+    initscr();
+    linenum();
+    printf("\n");
+    linenum();                    /* scroll the primary screen */
+    printf("\x1b" "7");           /* save cursor */
+    printf("\x1b[?1049h");        /* save cursor and enter alt screen */
+    printf("\x1b" "8");           /* restore cursor */
+    printf("alt");
+
+    capture();
+}
@@ -0,0 +1,14 @@
+#include "capture.h"
+
+int main()
+{
+    initscr();
+    linenum();
+    printf("\x1b[?1049h");        /* save cursor and enter alt screen */
+    printf("\x1b[5;1H");          /* goto abs 5,1 */
+    printf("\x1b" "7");           /* save cursor */
+    printf("\x1b[?1049l");        /* leave alt screen and restore cursor */
+    printf("pri");
+
+    capture();
+}
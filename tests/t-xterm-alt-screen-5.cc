@@ -0,0 +1,19 @@
+#include "capture.h"
+
+int main()
+{
+    initscr();
+    linenum();
+    printf("\n");
+    linenum();                    /* scroll the primary screen */
+    printf("\x1b[10;3H");         /* goto abs 10,3 */
+    printf("\x1b" "7");           /* save primary cursor */
+    printf("\x1b[?1049h");        /* save cursor and enter alt screen */
+    printf("\x1b[5;3H");          /* goto abs 5,3 */
+    printf("\x1b" "7");           /* save alternate cursor */
+    printf("\x1b[1;1H");          /* goto abs 1,1 */
+    printf("\x1b" "8");           /* restore alternate cursor */
+    printf("alt");
+
+    capture();
+}
@@ -24,7 +24,7 @@
 #include "logger.h"
 #include "file.h"
 #include "utf8.h"
-#include "worker.h"
+#include "taskpool.h"
 
 #include <ft2build.h>
 #include FT_FREETYPE_H
@@ -67,8 +67,10 @@ static bool help_text = false;
 static bool quiet = false;
 static bool verbose = false;
 static bool multithread = false;
+static int num_threads = 0;
 static bool batch_render = true;
 static font_manager_ft manager;
+static std::unique_ptr<task_scheduler> sched;
 
 static std::string ae_dim_str(atlas_entry *ae)
 {
@@ -126,8 +128,16 @@ static int ftCubicTo(const FT_Vector *control1, const FT_Vector *control2,
     return 0;
 }
 
-static atlas_entry generateMSDF(font_face *face, font_atlas *atlas,
-    int size, int dpi, int glyph)
+struct msdf_glyph
+{
+    uint codepoint;
+    uint glyph;
+    bool valid;
+    int ox, oy, w, h;
+    std::vector<uint32_t> pixels;
+};
+
+static void generateMSDF(font_face *face, int size, int dpi, msdf_glyph *mg)
 {
     msdfgen::Shape shape;
     msdfgen::Vector2 translate, scale = { 1, 1 };
@@ -136,7 +146,6 @@ static atlas_entry generateMSDF(font_face *face, font_atlas *atlas,
     FT_Error error;
     FT_Outline_Funcs ftFunctions;
     FtContext context = { &shape };
-    atlas_entry ae;
 
     int char_height = size;
     int horz_resolution = dpi;
@@ -148,17 +157,18 @@ static atlas_entry generateMSDF(font_face *face, font_atlas *atlas,
     long long coloringSeed = 0;
     msdfgen::FillRule fillRule = msdfgen::FILL_NONZERO;
 
+    mg->valid = false;
+    mg->pixels.clear();
+
     ftface = static_cast<font_face_ft*>(face)->ftface;
     error = FT_Set_Char_Size(ftface, 0, char_height, horz_resolution,
         horz_resolution);
     if (error) {
-        memset(&ae, 0, sizeof(ae));
-        return ae;
+        return;
     }
-    error = FT_Load_Glyph(ftface, glyph, FT_LOAD_NO_HINTING);
+    error = FT_Load_Glyph(ftface, mg->glyph, FT_LOAD_NO_HINTING);
     if (error) {
-        memset(&ae, 0, sizeof(ae));
-        return ae;
+        return;
     }
 
     ftFunctions.move_to = ftMoveTo;
@@ -170,8 +180,7 @@ static atlas_entry generateMSDF(font_face *face, font_atlas *atlas,
 
     error = FT_Outline_Decompose(&ftface->glyph->outline, &ftFunctions, &context);
     if (error) {
-        memset(&ae, 0, sizeof(ae));
-        return ae;
+        return;
     }
 
     /* font dimensions */
@@ -194,23 +203,75 @@ static atlas_entry generateMSDF(font_face *face, font_atlas *atlas,
         msdfgen::msdfErrorCorrection(msdf, edgeThreshold/(scale*range));
     }
 
-    ae = atlas->create(face, 0, glyph, char_height, ox, oy, w, h);
-    if (ae.w == w && ae.h == h) {
+    /* convert to a private bitmap so it can be packed later */
+    mg->pixels.resize((size_t)w * h);
+    for (int y = 0; y < h; y++) {
         for (int x = 0; x < w; x++) {
-            for (int y = 0; y < h; y++) {
-                int r = msdfgen::pixelFloatToByte(msdf(x,y)[0]);
-                int g = msdfgen::pixelFloatToByte(msdf(x,y)[1]);
-                int b = msdfgen::pixelFloatToByte(msdf(x,y)[2]);
-                size_t dst = ((ae.y + y) * atlas->width + ae.x + x) * 4;
-                uint32_t color = r | g << 8 | b << 16 | 0xff000000;
-                *(uint32_t*)&atlas->pixels[dst] = color;
-            }
+            int r = msdfgen::pixelFloatToByte(msdf(x,y)[0]);
+            int g = msdfgen::pixelFloatToByte(msdf(x,y)[1]);
+            int b = msdfgen::pixelFloatToByte(msdf(x,y)[2]);
+            mg->pixels[y * w + x] = r | g << 8 | b << 16 | 0xff000000;
+        }
+    }
+    mg->ox = ox, mg->oy = oy, mg->w = w, mg->h = h;
+    mg->valid = true;
+}
+
+static atlas_entry blitMSDF(font_face *face, font_atlas *atlas, int size,
+    msdf_glyph *mg)
+{
+    atlas_entry ae;
+
+    if (!mg->valid) {
+        memset(&ae, 0, sizeof(ae));
+        return ae;
+    }
+
+    int w = mg->w, h = mg->h;
+    ae = atlas->create(face, 0, mg->glyph, size, mg->ox, mg->oy, w, h);
+    if (ae.w == w && ae.h == h) {
+        for (int y = 0; y < h; y++) {
+            size_t dst = ((ae.y + y) * atlas->width + ae.x) * 4;
+            memcpy(&atlas->pixels[dst], &mg->pixels[y * w], w * 4);
         }
     }
 
     return ae;
 }
 
+/*
+ * glyph tasks render distance fields with a private face per worker,
+ * as FT_Face is not thread safe, while packing stays on one thread so
+ * the atlas is identical to the one produced serially.
+ */
+
+static std::mutex face_mutex;
+
+struct worker_faces
+{
+    font_face *face;
+    std::vector<std::unique_ptr<font_face_ft>> dups;
+
+    worker_faces(font_face *face, size_t num_workers) :
+        face(face), dups(num_workers) {}
+
+    ~worker_faces()
+    {
+        /* FT_Done_Face and FT_New_Face share the library's driver */
+        std::lock_guard<std::mutex> lock(face_mutex);
+        dups.clear();
+    }
+
+    font_face_ft* get(size_t worker)
+    {
+        if (!dups[worker]) {
+            std::lock_guard<std::mutex> lock(face_mutex);
+            dups[worker].reset(static_cast<font_face_ft*>(face)->dup_thread());
+        }
+        return dups[worker].get();
+    }
+};
+
 /*
  * ftrender -render text using freetype2, and display metrics
  *
@@ -229,6 +290,7 @@ static void print_help(int argc, char **argv)
         "  -q, --quiet            supress all output messages\n"
         "  -v, --verbose          include per glyph output messages\n"
         "  -m, --multithreaded    process multiple fonts in parallel\n"
+        "  -j, --threads <count>  worker threads (default all cores)\n"
         "  -d, --display          display glyphs (ANSI console)\n"
         "  -c, --clear            send clear before glyph (ANSI console)\n"
         "  -r, --range <float>    signed distance range (default %f)\n"
@@ -297,6 +359,10 @@ static void parse_options(int argc, char **argv)
             multithread = true;
             i++;
         }
+        else if (match_opt(argv[i], "-j", "--threads")) {
+            if (check_param(++i == argc, "--threads")) break;
+            num_threads = atoi(argv[i++]);
+        }
         else {
             fprintf(stderr, "error: unknown option: %s\n", argv[i]);
             help_text = true;
@@ -326,10 +392,13 @@ static std::vector<std::pair<uint,uint>> allCodepointGlyphPairs(FT_Face ftface)
     return l;
 }
 
-uint64_t process_one_file(font_face *face, const char *output_path)
+uint64_t process_one_file(font_face *face, const char *output_path,
+    size_t *glyph_count)
 {
     font_atlas atlas(font_atlas::DEFAULT_WIDTH, font_atlas::DEFAULT_HEIGHT,
         font_atlas::MSDF_DEPTH);
+    atlas.dpi = dpi;
+    atlas.range = range;
 
     const auto t1 = high_resolution_clock::now();
 
@@ -349,39 +418,72 @@ uint64_t process_one_file(font_face *face, const char *output_path)
         allGlyphs = allCodepointGlyphPairs(ftface);
     }
 
+    std::vector<msdf_glyph> chosenGlyphs;
+    for (auto pair : allGlyphs) {
+        if (pair.first >= glyph_limit) continue;
+        chosenGlyphs.push_back(msdf_glyph{pair.first, pair.second});
+    }
+
     /*
-     * loop through chosen glyphs and create atlas
+     * render chunks of glyphs in parallel, then pack them in order.
+     * chunks bound the memory held in private bitmaps and stop the
+     * rendering soon after the atlas is full.
      */
+    const size_t num_workers = sched ? sched->num_workers() : 1;
+    const size_t chunk_size = 64 * num_workers;
+    worker_faces faces(face, num_workers);
+
     size_t area = 0, count = 0;
-    for (auto pair : allGlyphs) {
-        uint codepoint = pair.first, glyph = pair.second;
-        atlas_entry ae;
+    bool full = false;
+    for (size_t i = 0; i < chosenGlyphs.size() && !full; i += chunk_size) {
+        size_t end = std::min(i + chunk_size, chosenGlyphs.size());
+
+        if (sched) {
+            parallel_for(*sched, i, end, 1, [&](size_t j) {
+                font_face_ft *dup = faces.get(sched->worker_index());
+                if (dup) {
+                    generateMSDF(dup, font_size * 64, dpi, &chosenGlyphs[j]);
+                } else {
+                    chosenGlyphs[j].valid = false;
+                }
+            });
+        } else {
+            for (size_t j = i; j < end; j++) {
+                generateMSDF(face, font_size * 64, dpi, &chosenGlyphs[j]);
+            }
+        }
 
-        if (codepoint >= glyph_limit) continue;
+        for (size_t j = i; j < end; j++) {
+            msdf_glyph *mg = &chosenGlyphs[j];
+            atlas_entry ae = blitMSDF(face, &atlas, font_size * 64, mg);
+            std::vector<uint32_t>().swap(mg->pixels);
+            if (ae.bin_id < 0) {
+                if (verbose) {
+                    printf("ATLAS FULL (codepoint: %u, glyph: %u)\n",
+                        mg->codepoint, mg->glyph);
+                }
+                full = true;
+                break;
+            }
 
-        ae = generateMSDF(face, &atlas, font_size * 64, dpi, glyph);
-        if (ae.bin_id < 0) {
             if (verbose) {
-                printf("ATLAS FULL (codepoint: %u, glyph: %u)\n",
-                    codepoint, glyph);
+                printf("[%zu/%zu] %20s (codepoint: %u, glyph: %u)\n",
+                    count, allGlyphs.size(), ae_dim_str(&ae).c_str(),
+                    mg->codepoint, mg->glyph);
             }
-            break;
-        }
 
-        if (verbose) {
-            printf("[%zu/%zu] %20s (codepoint: %u, glyph: %u)\n",
-                count, allGlyphs.size(), ae_dim_str(&ae).c_str(),
-                codepoint, glyph);
+            area += ae.w * ae.h;
+            count++;
         }
-
-        area += ae.w * ae.h;
-        count++;
     }
 
     if (batch_render) {
         atlas.save(&manager, face);
     }
 
+    const auto t2 = high_resolution_clock::now();
+    uint64_t d = duration_cast<nanoseconds>(t2 - t1).count();
+
     /*
      * atlas statistics
      */
@@ -390,14 +492,15 @@ uint64_t process_one_file(font_face *face, const char *output_path)
         printf("font-path        : %s\n", font_path);
         printf("total-glyphs     : %zu\n", allGlyphs.size());
         printf("glyphs-processed : %zu\n", count);
+        printf("worker-threads   : %zu\n", num_workers);
+        printf("glyphs-per-sec   : %5.1f\n", (float)count * 1e9f / (float)d);
         printf("total-area       : %zu (%d squared)\n", area, (int)sqrtf(area));
         printf("utilization      : %5.3f%%\n",
             100.0f*(float)area / (float)(atlas.width * atlas.height));
     }
 
-    const auto t2 = high_resolution_clock::now();
-
-    return duration_cast<nanoseconds>(t2 - t1).count();
+    *glyph_count = count;
+    return d;
 }
 
 static std::vector<std::string> sortList(std::vector<std::string> l)
@@ -425,17 +528,22 @@ struct font_job
     std::string path;
 };
 
-struct font_worker : pool_worker<font_job>
+static void print_time(const char *name, uint64_t d, size_t count)
 {
-    virtual void operator()(font_job &item) {
-        uint64_t d = process_one_file(item.face, item.path.c_str());
-        if (verbose) {
-            printf("processing time  : %5.3f seconds\n---\n", (float)d/ 1e9f);
-        } else if (!quiet) {
-            printf("%-40s (%5.3f seconds)\n", item.path.c_str(), (float)d/ 1e9f);
-        }
+    if (verbose) {
+        printf("processing time  : %5.3f seconds\n---\n", (float)d/ 1e9f);
+    } else if (!quiet) {
+        printf("%-40s (%5.3f seconds, %7.1f glyphs/sec)\n", name,
+            (float)d/ 1e9f, (float)count * 1e9f / (float)d);
     }
-};
+}
+
+static void process_job(font_job &job)
+{
+    size_t count;
+    uint64_t d = process_one_file(job.face, job.path.c_str(), &count);
+    print_time(job.path.c_str(), d, count);
+}
 
 int main(int argc, char **argv)
 {
@@ -453,24 +561,27 @@ int main(int argc, char **argv)
         jobs.push_back(font_job{face, output_path ? output_path : font_path});
     }
 
-    /* process them */
-    if (multithread) {
-        const size_t num_threads = std::thread::hardware_concurrency();
-        pool_executor<font_job,font_worker> pool(num_threads, jobs.size(), [](){
-            return new font_worker();
-        });
-        for (auto &path : jobs) {
-            pool.enqueue(path);
+    /* glyphs are rendered by scheduler workers unless there is one */
+    if (num_threads <= 0) {
+        num_threads = (int)std::thread::hardware_concurrency();
+    }
+    if (num_threads > 1) {
+        sched = std::make_unique<task_scheduler>(num_threads);
+    }
+
+    /* process them, fonts in parallel fork and join their glyph tasks */
+    if (multithread && sched) {
+        task_group group;
+        for (auto &job : jobs) {
+            sched->spawn(group, [&job]() { process_job(job); });
         }
-        pool.run();
+        sched->wait(group);
     } else {
-        for (auto &path : jobs) {
-            uint64_t d = process_one_file(path.face, path.path.c_str());
-            if (verbose) {
-                printf("processing time  : %5.3f seconds\n---\n", (float)d/ 1e9f);
-            } else if (!quiet) {
-                printf("%-40s (%5.3f seconds)\n", path.face->name.c_str(), (float)d/ 1e9f);
-            }
+        for (auto &job : jobs) {
+            size_t count;
+            uint64_t d = process_one_file(job.face, job.path.c_str(), &count);
+            print_time(job.face->name.c_str(), d, count);
         }
     }
+    sched.reset();
 }
@@ -0,0 +1,192 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <climits>
+#include <cstring>
+#include <cmath>
+
+#include <map>
+#include <vector>
+#include <memory>
+#include <string>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+
+#include "binpack.h"
+#include "image.h"
+#include "draw.h"
+#include "font.h"
+#include "glyph.h"
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+using namespace std::chrono;
+
+static const char *font_path = "Resources/fonts/NotoSansMono-Regular.ttf";
+static const char *renderer_name = "outline";
+static int glyph_count = 10000;
+static int font_size = 16;
+static bool help_text = false;
+
+static void print_help(int argc, char **argv)
+{
+    fprintf(stderr,
+        "\n"
+        "Usage: %s [options]\n"
+        "\n"
+        "Options:\n"
+        "  -h, --help             display this help text\n"
+        "  -f, --font <ttf-file>  font file (default %s)\n"
+        "  -n, --count <integer>  number of glyphs to rasterize (default %d)\n"
+        "  -s, --size <pixels>    font size (default %d)\n"
+        "  -r, --renderer <name>  outline, lcd or color (default %s)\n",
+        argv[0], font_path, glyph_count, font_size, renderer_name);
+}
+
+static bool check_param(bool cond, const char *param)
+{
+    if (cond) {
+        printf("error: %s requires parameter\n", param);
+    }
+    return (help_text = cond);
+}
+
+static bool match_opt(const char *arg, const char *opt, const char *longopt)
+{
+    return strcmp(arg, opt) == 0 || strcmp(arg, longopt) == 0;
+}
+
+static void parse_options(int argc, char **argv)
+{
+    int i = 1;
+    while (i < argc) {
+        if (match_opt(argv[i], "-h", "--help")) {
+            help_text = true;
+            i++;
+        }
+        else if (match_opt(argv[i], "-f", "--font")) {
+            if (check_param(++i == argc, "--font")) break;
+            font_path = argv[i++];
+        }
+        else if (match_opt(argv[i], "-n", "--count")) {
+            if (check_param(++i == argc, "--count")) break;
+            glyph_count = atoi(argv[i++]);
+        }
+        else if (match_opt(argv[i], "-s", "--size")) {
+            if (check_param(++i == argc, "--size")) break;
+            font_size = atoi(argv[i++]);
+        }
+        else if (match_opt(argv[i], "-r", "--renderer")) {
+            if (check_param(++i == argc, "--renderer")) break;
+            renderer_name = argv[i++];
+        }
+        else {
+            fprintf(stderr, "error: unknown option: %s\n", argv[i]);
+            help_text = true;
+            break;
+        }
+    }
+
+    if (help_text) {
+        print_help(argc, argv);
+        exit(1);
+    }
+}
+
+static std::unique_ptr<glyph_renderer> make_renderer(size_t *depth)
+{
+    if (strcmp(renderer_name, "outline") == 0) {
+        *depth = font_atlas::GRAY_DEPTH;
+        return std::unique_ptr<glyph_renderer>(new glyph_renderer_outline_ft());
+    } else if (strcmp(renderer_name, "lcd") == 0) {
+        *depth = font_atlas::LCD_DEPTH;
+        return std::unique_ptr<glyph_renderer>(new glyph_renderer_lcd_ft());
+    } else if (strcmp(renderer_name, "color") == 0) {
+        *depth = font_atlas::COLOR_DEPTH;
+        return std::unique_ptr<glyph_renderer>(new glyph_renderer_color_ft());
+    }
+    fprintf(stderr, "error: unknown renderer: %s\n", renderer_name);
+    exit(1);
+}
+
+static uint64_t checksum(uint64_t h, font_atlas &atlas, atlas_entry &ae)
+{
+    /* FNV-1a over the glyph so kernels can be compared for identical output */
+    size_t row = (size_t)ae.w * atlas.depth;
+    for (int y = 0; y < ae.h; y++) {
+        const uint8_t *p = atlas.pixels + ((ae.y + y) * atlas.width + ae.x) *
+            atlas.depth;
+        for (size_t i = 0; i < row; i++) {
+            h = (h ^ p[i]) * 0x100000001b3ull;
+        }
+    }
+    return h;
+}
+
+static atlas_entry render(glyph_renderer *renderer, font_atlas &atlas,
+    font_face_ft *face, int glyph, int phase, uint64_t &d)
+{
+    const auto t1 = high_resolution_clock::now();
+    atlas_entry ae = renderer->render(&atlas, face, font_size << 6,
+        glyph, phase);
+    const auto t2 = high_resolution_clock::now();
+    d += duration_cast<nanoseconds>(t2 - t1).count();
+    return ae;
+}
+
+int main(int argc, char **argv)
+{
+    parse_options(argc, argv);
+
+    font_manager_ft manager;
+    manager.scanFontPath(font_path);
+    font_face_ft *face = static_cast<font_face_ft*>(manager.findFontById(0));
+    if (!face) {
+        fprintf(stderr, "error: can't load font: %s\n", font_path);
+        exit(1);
+    }
+
+    size_t depth;
+    std::unique_ptr<glyph_renderer> renderer = make_renderer(&depth);
+    std::unique_ptr<font_atlas> atlas(new font_atlas(font_atlas::DEFAULT_WIDTH,
+        font_atlas::DEFAULT_HEIGHT, depth));
+
+    /*
+     * cycle through every glyph in the font, rendering each subpixel
+     * phase in turn. a new atlas is created when the atlas is full so
+     * every call to the renderer rasterizes and blits a glyph.
+     */
+    int num_glyphs = (int)face->ftface->num_glyphs - 1;
+    size_t atlases = 1, failed = 0;
+    uint64_t sum = 0xcbf29ce484222325ull, d = 0;
+    for (int i = 0; i < glyph_count; i++) {
+        int glyph = 1 + i % num_glyphs;
+        int phase = (i / num_glyphs) % glyph_subpixel_phases;
+        atlas_entry ae = render(renderer.get(), *atlas, face, glyph, phase, d);
+        if (ae.bin_id == -1) {
+            atlas.reset(new font_atlas(font_atlas::DEFAULT_WIDTH,
+                font_atlas::DEFAULT_HEIGHT, depth));
+            ae = render(renderer.get(), *atlas, face, glyph, phase, d);
+            atlases++;
+        }
+        if (ae.bin_id == -1) {
+            failed++;
+        } else {
+            sum = checksum(sum, *atlas, ae);
+        }
+    }
+
+    printf("renderer         : %s\n", renderer_name);
+    printf("glyphs           : %d (%d px)\n", glyph_count, font_size);
+    printf("atlases          : %zu (%zux%zux%zu)\n", atlases,
+        atlas->width, atlas->height, atlas->depth);
+    printf("failed           : %zu\n", failed);
+    printf("checksum         : %016llx\n", (unsigned long long)sum);
+    printf("total-time       : %5.3f seconds\n", (float)d / 1e9f);
+    printf("per-glyph        : %5.3f microseconds\n", (float)d / 1e3f / glyph_count);
+
+    return 0;
+}
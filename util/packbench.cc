@@ -0,0 +1,164 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+
+#include <map>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+#include "binpack.h"
+
+using namespace std::chrono;
+
+static int rect_count = 50000;
+static int bin_size = 1024;
+static bool maxrects = false;
+static bool verify = false;
+static bool help_text = false;
+
+static void print_help(int argc, char **argv)
+{
+    fprintf(stderr,
+        "\n"
+        "Usage: %s [options]\n"
+        "\n"
+        "Options:\n"
+        "  -h, --help             display this help text\n"
+        "  -n, --count <integer>  number of rectangles (default %d)\n"
+        "  -s, --size <pixels>    bin width and height (default %d)\n"
+        "  -m, --maxrects         disable shelves and use only MAXRECTS\n"
+        "  -v, --verify           verify each bin after packing\n",
+        argv[0], rect_count, bin_size);
+}
+
+static bool check_param(bool cond, const char *param)
+{
+    if (cond) {
+        printf("error: %s requires parameter\n", param);
+    }
+    return (help_text = cond);
+}
+
+static bool match_opt(const char *arg, const char *opt, const char *longopt)
+{
+    return strcmp(arg, opt) == 0 || strcmp(arg, longopt) == 0;
+}
+
+static void parse_options(int argc, char **argv)
+{
+    int i = 1;
+    while (i < argc) {
+        if (match_opt(argv[i], "-h", "--help")) {
+            help_text = true;
+            i++;
+        }
+        else if (match_opt(argv[i], "-n", "--count")) {
+            if (check_param(++i == argc, "--count")) break;
+            rect_count = atoi(argv[i++]);
+        }
+        else if (match_opt(argv[i], "-s", "--size")) {
+            if (check_param(++i == argc, "--size")) break;
+            bin_size = atoi(argv[i++]);
+        }
+        else if (match_opt(argv[i], "-m", "--maxrects")) {
+            maxrects = true;
+            i++;
+        }
+        else if (match_opt(argv[i], "-v", "--verify")) {
+            verify = true;
+            i++;
+        }
+        else {
+            fprintf(stderr, "error: unknown option: %s\n", argv[i]);
+            help_text = true;
+            break;
+        }
+    }
+
+    if (help_text) {
+        print_help(argc, argv);
+        exit(1);
+    }
+}
+
+static uint32_t rand_state = 0x9e3779b9;
+
+static uint32_t rand_next()
+{
+    /* xorshift32 so every run packs the same rectangles */
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    return rand_state;
+}
+
+static std::vector<bin_point> glyph_rects(int count)
+{
+    /*
+     * glyph sized rectangles from a few font sizes, mostly the size
+     * of the terminal font, with glyph widths and heights that vary
+     * like those of a monospace font plus one pixel of padding.
+     */
+    static const int sizes[] = { 16, 16, 16, 16, 16, 12, 24, 32 };
+    std::vector<bin_point> l;
+    for (int i = 0; i < count; i++) {
+        int size = sizes[rand_next() % 8];
+        int w = size * (30 + (int)(rand_next() % 40)) / 100;
+        int h = size * (50 + (int)(rand_next() % 75)) / 100;
+        l.push_back(bin_point(w + 1, h + 1));
+    }
+    return l;
+}
+
+int main(int argc, char **argv)
+{
+    parse_options(argc, argv);
+
+    std::vector<bin_point> rects = glyph_rects(rect_count);
+    std::vector<bin_packer> bins;
+    bins.push_back(bin_packer(bin_point(bin_size), !maxrects));
+
+    /* pack into the last bin and start a new one when it is full */
+    const auto t1 = high_resolution_clock::now();
+    size_t area = 0, full_area = 0;
+    for (int i = 0; i < rect_count; i++) {
+        auto r = bins.back().find_region(i, rects[i]);
+        if (!r.first) {
+            full_area = area;
+            bins.push_back(bin_packer(bin_point(bin_size), !maxrects));
+            r = bins.back().find_region(i, rects[i]);
+        }
+        if (!r.first) {
+            fprintf(stderr, "error: rectangle %d does not fit\n", i);
+            exit(1);
+        }
+        area += rects[i].x * rects[i].y;
+    }
+    const auto t2 = high_resolution_clock::now();
+
+    size_t conflicts = 0, free_rects = 0;
+    for (auto &bp : bins) {
+        if (verify) conflicts += bp.verify();
+        free_rects += bp.free_list.size();
+    }
+
+    uint64_t d = duration_cast<nanoseconds>(t2 - t1).count();
+    printf("packer           : %s\n", maxrects ? "maxrects" : "shelf+maxrects");
+    printf("rectangles       : %d\n", rect_count);
+    printf("bins             : %zu (%dx%d)\n", bins.size(), bin_size, bin_size);
+    printf("free-rects       : %zu\n", free_rects);
+    if (bins.size() > 1) {
+        /* the last bin is partially filled, so only count full bins */
+        printf("utilization      : %5.3f%%\n", 100.0f * (float)full_area /
+            ((float)bin_size * (float)bin_size * (float)(bins.size() - 1)));
+    }
+    printf("total-time       : %5.3f seconds\n", (float)d / 1e9f);
+    printf("per-rectangle    : %5.3f microseconds\n", (float)d / 1e3f / rect_count);
+    if (verify) {
+        printf("conflicts        : %zu\n", conflicts);
+    }
+
+    return conflicts > 0;
+}
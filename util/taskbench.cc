@@ -0,0 +1,217 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+
+#include <vector>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <functional>
+#include <condition_variable>
+
+#include "worker.h"
+#include "taskpool.h"
+
+using namespace std::chrono;
+
+static int task_count = 100000;
+static int batch_count = 20;
+static int thread_count = 0;
+static bool help_text = false;
+
+static void print_help(int argc, char **argv)
+{
+    fprintf(stderr,
+        "\n"
+        "Usage: %s [options]\n"
+        "\n"
+        "Options:\n"
+        "  -h, --help             display this help text\n"
+        "  -n, --count <integer>  number of tasks per batch (default %d)\n"
+        "  -b, --batches <count>  number of batches (default %d)\n"
+        "  -j, --threads <count>  worker threads (default all cores)\n",
+        argv[0], task_count, batch_count);
+}
+
+static bool check_param(bool cond, const char *param)
+{
+    if (cond) {
+        printf("error: %s requires parameter\n", param);
+    }
+    return (help_text = cond);
+}
+
+static bool match_opt(const char *arg, const char *opt, const char *longopt)
+{
+    return strcmp(arg, opt) == 0 || strcmp(arg, longopt) == 0;
+}
+
+static void parse_options(int argc, char **argv)
+{
+    int i = 1;
+    while (i < argc) {
+        if (match_opt(argv[i], "-h", "--help")) {
+            help_text = true;
+            i++;
+        }
+        else if (match_opt(argv[i], "-n", "--count")) {
+            if (check_param(++i == argc, "--count")) break;
+            task_count = atoi(argv[i++]);
+        }
+        else if (match_opt(argv[i], "-b", "--batches")) {
+            if (check_param(++i == argc, "--batches")) break;
+            batch_count = atoi(argv[i++]);
+        }
+        else if (match_opt(argv[i], "-j", "--threads")) {
+            if (check_param(++i == argc, "--threads")) break;
+            thread_count = atoi(argv[i++]);
+        }
+        else {
+            fprintf(stderr, "error: unknown option: %s\n", argv[i]);
+            help_text = true;
+            break;
+        }
+    }
+
+    if (help_text) {
+        print_help(argc, argv);
+        exit(1);
+    }
+}
+
+static uint32_t rand_state = 0x9e3779b9;
+
+static uint32_t rand_next()
+{
+    /* xorshift32 so every run has the same task sizes */
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    return rand_state;
+}
+
+static std::vector<uint32_t> task_sizes(int count)
+{
+    /*
+     * irregular task sizes like glyph rendering, where most glyphs are
+     * quick and a few complex outlines take a hundred times longer.
+     */
+    std::vector<uint32_t> l;
+    for (int i = 0; i < count; i++) {
+        uint32_t r = rand_next();
+        l.push_back((r % 100) < 95 ? 50 + r % 200 : 5000 + r % 20000);
+    }
+    return l;
+}
+
+static uint64_t spin(uint32_t n)
+{
+    uint64_t h = n;
+    for (uint32_t i = 0; i < n; i++) {
+        h = h * 6364136223846793005ull + 1442695040888963407ull;
+    }
+    return h;
+}
+
+static std::vector<uint32_t> sizes;
+static std::atomic<uint64_t> checksum;
+
+struct bench_item
+{
+    uint32_t size;
+};
+
+struct bench_worker : pool_worker<bench_item>
+{
+    virtual void operator()(bench_item &item) {
+        checksum.fetch_add(spin(item.size), std::memory_order_relaxed);
+    }
+};
+
+static uint64_t bench_pool_executor(size_t num_threads)
+{
+    pool_executor<bench_item,bench_worker> pool(num_threads, sizes.size());
+    const auto t1 = high_resolution_clock::now();
+    for (int b = 0; b < batch_count; b++) {
+        for (auto size : sizes) {
+            pool.enqueue(bench_item{size});
+        }
+        pool.run();
+    }
+    const auto t2 = high_resolution_clock::now();
+    return duration_cast<nanoseconds>(t2 - t1).count();
+}
+
+static uint64_t bench_task_scheduler(size_t num_threads)
+{
+    task_scheduler sched(num_threads);
+    const auto t1 = high_resolution_clock::now();
+    for (int b = 0; b < batch_count; b++) {
+        task_group group;
+        for (auto size : sizes) {
+            sched.spawn(group, [size]() {
+                checksum.fetch_add(spin(size), std::memory_order_relaxed);
+            });
+        }
+        sched.wait(group);
+    }
+    const auto t2 = high_resolution_clock::now();
+    return duration_cast<nanoseconds>(t2 - t1).count();
+}
+
+static uint64_t bench_fork_join(size_t num_threads)
+{
+    /* each batch is one task that forks the others and joins them */
+    task_scheduler sched(num_threads);
+    const auto t1 = high_resolution_clock::now();
+    for (int b = 0; b < batch_count; b++) {
+        task_group outer;
+        sched.spawn(outer, [&sched]() {
+            parallel_for(sched, 0, sizes.size(), 16, [](size_t i) {
+                checksum.fetch_add(spin(sizes[i]), std::memory_order_relaxed);
+            });
+        });
+        sched.wait(outer);
+    }
+    const auto t2 = high_resolution_clock::now();
+    return duration_cast<nanoseconds>(t2 - t1).count();
+}
+
+static void print_result(const char *name, uint64_t d, uint64_t sum)
+{
+    size_t tasks = (size_t)task_count * batch_count;
+    printf("%-16s : %7.3f seconds %7.3f microseconds/task (sum=%016llx)\n",
+        name, (float)d / 1e9f, (float)d / 1e3f / tasks,
+        (unsigned long long)sum);
+}
+
+int main(int argc, char **argv)
+{
+    parse_options(argc, argv);
+
+    size_t num_threads = thread_count > 0 ? thread_count :
+        std::thread::hardware_concurrency();
+    sizes = task_sizes(task_count);
+
+    printf("threads          : %zu\n", num_threads);
+    printf("tasks            : %d x %d\n", task_count, batch_count);
+
+    uint64_t d;
+
+    checksum = 0;
+    d = bench_pool_executor(num_threads);
+    print_result("pool_executor", d, checksum);
+
+    checksum = 0;
+    d = bench_task_scheduler(num_threads);
+    print_result("task_scheduler", d, checksum);
+
+    checksum = 0;
+    d = bench_fork_join(num_threads);
+    print_result("fork_join", d, checksum);
+
+    return 0;
+}